@@ -41,6 +41,8 @@ PRODUCT_PACKAGES += \
     libbt-vendor \
     TIInit_11.8.32.bts
 
+PRODUCT_PROPERTY_OVERRIDES += vendor.bluetooth.prewarm=true
+
 # Wi-Fi
 PRODUCT_PACKAGES += \
     wl18xx-fw-4.bin \
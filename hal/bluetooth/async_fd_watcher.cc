@@ -27,59 +27,158 @@
 #include <thread>
 #include <vector>
 #include "fcntl.h"
-#include "sys/select.h"
+#include "sys/epoll.h"
+#include "sys/eventfd.h"
+#include "sys/timerfd.h"
 #include "unistd.h"
 
 static const int INVALID_FD = -1;
 
 static const int BT_RT_PRIORITY = 1;
 
+static const int MAX_EPOLL_EVENTS = 8;
+
 namespace android {
 namespace hardware {
 namespace bluetooth {
 namespace async {
 
+namespace {
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int EpollAdd(int epoll_fd, int fd) {
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) return 0;
+  if (errno == EEXIST) return 0;
+  ALOGE("%s unable to watch fd %d: %s", __func__, fd, strerror(errno));
+  return -1;
+}
+
+void CloseFd(int& fd) {
+  if (fd == INVALID_FD) return;
+  close(fd);
+  fd = INVALID_FD;
+}
+
+}  // namespace
+
 int AsyncFdWatcher::WatchFdForNonBlockingReads(
-    int file_descriptor, const ReadCallback& on_read_fd_ready_callback) {
+    int file_descriptor, const ReadCallback& on_read_fd_ready_callback,
+    int priority, int read_budget) {
+  // Start the thread if not started yet
+  if (tryStartThread()) return -1;
+
   // Add file descriptor and callback
-  {
-    std::unique_lock<std::mutex> guard(internal_mutex_);
-    watched_fds_[file_descriptor] = on_read_fd_ready_callback;
-  }
+  std::unique_lock<std::mutex> guard(internal_mutex_);
+  watched_fds_[file_descriptor] = {on_read_fd_ready_callback, priority,
+                                   std::max(read_budget, 1)};
+  std::unique_lock<std::mutex> state_guard(fd_state_mutex_);
+  stopped_fds_.erase(file_descriptor);
+  return EpollAdd(epoll_fd_, file_descriptor);
+}
 
-  // Start the thread if not started yet
-  return tryStartThread();
+int AsyncFdWatcher::DelayReads(int file_descriptor,
+                               std::chrono::microseconds delay) {
+  if (delay <= std::chrono::microseconds(0) || !running_) return 0;
+  std::unique_lock<std::mutex> guard(fd_state_mutex_);
+  // Stopped by its callback or another thread, it must not come back with
+  // the timer.
+  if (stopped_fds_.count(file_descriptor)) return 0;
+  if (IsDelayedLocked(file_descriptor)) return 0;
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, file_descriptor, nullptr)) {
+    if (errno == ENOENT) return 0;
+    ALOGE("%s unable to delay fd %d: %s", __func__, file_descriptor,
+          strerror(errno));
+    return -1;
+  }
+  // Fds delayed while the timer runs come back with the first one.
+  if (delayed_fds_.empty()) {
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = delay.count() / 1000000;
+    spec.it_value.tv_nsec = (delay.count() % 1000000) * 1000;
+    timerfd_settime(delay_timer_fd_, 0, &spec, nullptr);
+  }
+  delayed_fds_.push_back(file_descriptor);
+  return 0;
 }
 
 int AsyncFdWatcher::ConfigureTimeout(
     const std::chrono::milliseconds timeout,
     const TimeoutCallback& on_timeout_callback) {
-  // Add timeout and callback
-  {
-    std::unique_lock<std::mutex> guard(timeout_mutex_);
-    timeout_cb_ = on_timeout_callback;
-    timeout_ms_ = timeout;
-  }
+  // Add timeout and callback, the timer is re-armed from the calling thread
+  // so the watching thread is not woken up.
+  std::unique_lock<std::mutex> guard(timeout_mutex_);
+  timeout_cb_ = on_timeout_callback;
+  timeout_ms_ = timeout;
+  timeout_start_ = std::chrono::steady_clock::now();
+
+  if (timer_fd_ == INVALID_FD) return 0;
+  return armTimerLocked(timeout_ms_);
+}
 
-  notifyThread();
+void AsyncFdWatcher::StopWatchingFileDescriptors() { stopThread(); }
+
+int AsyncFdWatcher::StopReadingFd(int file_descriptor) {
+  // The epoll set is not touched under the mutex held during callbacks.
+  if (!running_) return 0;
+  std::unique_lock<std::mutex> guard(fd_state_mutex_);
+  stopped_fds_.insert(file_descriptor);
+  delayed_fds_.erase(
+      std::remove(delayed_fds_.begin(), delayed_fds_.end(), file_descriptor),
+      delayed_fds_.end());
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, file_descriptor, nullptr) &&
+      errno != ENOENT) {
+    ALOGE("%s unable to stop fd %d: %s", __func__, file_descriptor,
+          strerror(errno));
+    return -1;
+  }
   return 0;
 }
 
-void AsyncFdWatcher::StopWatchingFileDescriptors() { stopThread(); }
+int AsyncFdWatcher::ResumeReadingFd(int file_descriptor) {
+  if (!running_) return 0;
+  std::unique_lock<std::mutex> guard(fd_state_mutex_);
+  if (stopped_fds_.erase(file_descriptor) == 0) return 0;
+  return EpollAdd(epoll_fd_, file_descriptor);
+}
 
 AsyncFdWatcher::~AsyncFdWatcher() {}
 
-// Make sure to call this with at least one file descriptor ready to be
-// watched upon or the thread routine will return immediately
 int AsyncFdWatcher::tryStartThread() {
   if (std::atomic_exchange(&running_, true)) return 0;
 
-  // Set up the communication channel
-  int pipe_fds[2];
-  if (pipe2(pipe_fds, O_NONBLOCK)) return -1;
+  // Set up the epoll set with the notification and timeout descriptors
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  notification_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  delay_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (epoll_fd_ == INVALID_FD || notification_fd_ == INVALID_FD ||
+      timer_fd == INVALID_FD || delay_timer_fd_ == INVALID_FD) {
+    ALOGE("%s unable to create descriptors: %s", __func__, strerror(errno));
+    CloseFd(timer_fd);
+    return -1;
+  }
 
-  notification_listen_fd_ = pipe_fds[0];
-  notification_write_fd_ = pipe_fds[1];
+  if (EpollAdd(epoll_fd_, notification_fd_) || EpollAdd(epoll_fd_, timer_fd) ||
+      EpollAdd(epoll_fd_, delay_timer_fd_)) {
+    CloseFd(timer_fd);
+    return -1;
+  }
+
+  {
+    std::unique_lock<std::mutex> guard(timeout_mutex_);
+    timer_fd_ = timer_fd;
+    // A timeout may have been configured before the first fd.
+    armTimerLocked(timeout_ms_);
+  }
 
   thread_ = std::thread([this]() { ThreadRoutine(); });
   if (!thread_.joinable()) return -1;
@@ -103,22 +202,188 @@ int AsyncFdWatcher::stopThread() {
   {
     std::unique_lock<std::mutex> guard(timeout_mutex_);
     timeout_cb_ = nullptr;
+    CloseFd(timer_fd_);
   }
 
-  close(notification_listen_fd_);
-  close(notification_write_fd_);
+  {
+    std::unique_lock<std::mutex> guard(fd_state_mutex_);
+    delayed_fds_.clear();
+    stopped_fds_.clear();
+  }
+  CloseFd(delay_timer_fd_);
+  CloseFd(notification_fd_);
+  CloseFd(epoll_fd_);
 
   return 0;
 }
 
 int AsyncFdWatcher::notifyThread() {
-  uint8_t buffer[] = {0};
-  if (TEMP_FAILURE_RETRY(write(notification_write_fd_, &buffer, 1)) < 0) {
+  uint64_t value = 1;
+  if (TEMP_FAILURE_RETRY(write(notification_fd_, &value, sizeof(value))) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+int AsyncFdWatcher::armTimerLocked(std::chrono::nanoseconds delay) {
+  struct itimerspec spec = {};
+  if (delay > std::chrono::nanoseconds(0)) {
+    spec.it_value.tv_sec = delay.count() / 1000000000;
+    spec.it_value.tv_nsec = delay.count() % 1000000000;
+  }
+  // A zero delay disarms the timer.
+  if (timerfd_settime(timer_fd_, 0, &spec, nullptr)) {
+    ALOGE("%s unable to arm the timer: %s", __func__, strerror(errno));
     return -1;
   }
   return 0;
 }
 
+void AsyncFdWatcher::OnTimerExpired() {
+  TimeoutCallback saved_cb;
+  {
+    std::unique_lock<std::mutex> guard(timeout_mutex_);
+    uint64_t expirations = 0;
+    // Nothing to read if the timer has been re-armed in the meantime.
+    if (TEMP_FAILURE_RETRY(read(timer_fd_, &expirations,
+                                sizeof(expirations))) < 0) {
+      return;
+    }
+    if (timeout_ms_ <= std::chrono::milliseconds(0)) return;
+
+    auto now = std::chrono::steady_clock::now();
+    auto last_activity = std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::nanoseconds(last_activity_ns_.load())));
+    auto deadline = std::max(timeout_start_, last_activity) + timeout_ms_;
+    if (now < deadline) {
+      // There was activity since the timer was armed, move the deadline.
+      armTimerLocked(deadline - now);
+      return;
+    }
+
+    // Allow the timeout callback to modify the timeout.
+    timeout_start_ = now;
+    armTimerLocked(timeout_ms_);
+    saved_cb = timeout_cb_;
+  }
+  if (saved_cb != nullptr) saved_cb();
+}
+
+void AsyncFdWatcher::OnDelayExpired() {
+  uint64_t expirations = 0;
+  if (TEMP_FAILURE_RETRY(read(delay_timer_fd_, &expirations,
+                              sizeof(expirations))) < 0) {
+    return;
+  }
+  // Still readable fds are reported by the next epoll_wait(). Fds stopped
+  // meanwhile were taken out of the list.
+  std::unique_lock<std::mutex> guard(fd_state_mutex_);
+  for (int fd : delayed_fds_) EpollAdd(epoll_fd_, fd);
+  delayed_fds_.clear();
+}
+
+bool AsyncFdWatcher::IsDelayedLocked(int fd) const {
+  return std::find(delayed_fds_.begin(), delayed_fds_.end(), fd) !=
+         delayed_fds_.end();
+}
+
+void AsyncFdWatcher::OnFdReady(int fd) {
+  last_activity_ns_ = NowNs();
+
+  // Hold the mutex to make sure that the callback is still valid.
+  std::unique_lock<std::mutex> guard(internal_mutex_);
+  auto it = watched_fds_.find(fd);
+  if (it != watched_fds_.end()) {
+    it->second.callback(it->first);
+  }
+}
+
+std::vector<int> AsyncFdWatcher::ReadyFds() {
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  int nfds = TEMP_FAILURE_RETRY(
+      epoll_wait(epoll_fd_, events, MAX_EPOLL_EVENTS, 0));
+
+  std::vector<int> ready_fds;
+  for (int i = 0; i < nfds; i++) {
+    int fd = events[i].data.fd;
+    // Internal descriptors stay ready for the next blocking epoll_wait().
+    if (fd == notification_fd_ || fd == timer_fd_ || fd == delay_timer_fd_) {
+      continue;
+    }
+    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      ready_fds.push_back(fd);
+    }
+  }
+  return ready_fds;
+}
+
+void AsyncFdWatcher::ServiceReadyFds(const std::vector<int>& ready_fds) {
+  struct ReadyFd {
+    int fd;
+    int priority;
+    int read_budget;
+  };
+  std::vector<ReadyFd> ready;
+  int max_priority = 0;
+  {
+    std::unique_lock<std::mutex> guard(internal_mutex_);
+    for (const auto& it : watched_fds_) {
+      max_priority = std::max(max_priority, it.second.priority);
+    }
+    for (int fd : ready_fds) {
+      auto it = watched_fds_.find(fd);
+      if (it == watched_fds_.end()) continue;
+      ready.push_back({fd, it->second.priority, it->second.read_budget});
+    }
+  }
+  std::stable_sort(ready.begin(), ready.end(),
+                   [](const ReadyFd& a, const ReadyFd& b) {
+                     return a.priority > b.priority;
+                   });
+
+  for (const ReadyFd& entry : ready) {
+    for (int reads = 0; reads < entry.read_budget && running_; reads++) {
+      if (reads > 0) {
+        std::vector<int> still_ready = ReadyFds();
+        if (std::find(still_ready.begin(), still_ready.end(), entry.fd) ==
+            still_ready.end()) {
+          break;
+        }
+      }
+      OnFdReady(entry.fd);
+      if (entry.priority < max_priority) DrainFdsAbove(entry.priority);
+    }
+  }
+}
+
+void AsyncFdWatcher::DrainFdsAbove(int priority) {
+  // Read budget left of each fd of a higher priority.
+  std::map<int, int> urgent_fds;
+  {
+    std::unique_lock<std::mutex> guard(internal_mutex_);
+    for (const auto& it : watched_fds_) {
+      if (it.second.priority > priority) {
+        urgent_fds[it.first] = it.second.read_budget;
+      }
+    }
+  }
+
+  // One epoll_wait() per round for every urgent fd. Stopped and delayed fds
+  // are out of the epoll set and never reported.
+  bool serviced = true;
+  while (serviced && running_) {
+    serviced = false;
+    for (int fd : ReadyFds()) {
+      auto it = urgent_fds.find(fd);
+      if (it == urgent_fds.end() || it->second == 0) continue;
+      it->second--;
+      OnFdReady(fd);
+      serviced = true;
+    }
+  }
+}
+
 void AsyncFdWatcher::ThreadRoutine() {
   // Make watching thread RT.
   struct sched_param rt_params;
@@ -129,59 +394,43 @@ void AsyncFdWatcher::ThreadRoutine() {
   }
 
   while (running_) {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(notification_listen_fd_, &read_fds);
-    int max_read_fd = INVALID_FD;
-    for (auto& it : watched_fds_) {
-      FD_SET(it.first, &read_fds);
-      max_read_fd = std::max(max_read_fd, it.first);
-    }
-
-    struct timeval timeout;
-    struct timeval* timeout_ptr = NULL;
-    if (timeout_ms_ > std::chrono::milliseconds(0)) {
-      timeout.tv_sec = timeout_ms_.count() / 1000;
-      timeout.tv_usec = (timeout_ms_.count() % 1000) * 1000;
-      timeout_ptr = &timeout;
-    }
+    struct epoll_event events[MAX_EPOLL_EVENTS];
 
     // Wait until there is data available to read on some FD.
-    int nfds = std::max(notification_listen_fd_, max_read_fd);
-    int retval = select(nfds + 1, &read_fds, NULL, NULL, timeout_ptr);
+    int nfds = TEMP_FAILURE_RETRY(
+        epoll_wait(epoll_fd_, events, MAX_EPOLL_EVENTS, -1));
 
     // There was some error.
-    if (retval < 0) continue;
-
-    // Timeout.
-    if (retval == 0) {
-      // Allow the timeout callback to modify the timeout.
-      TimeoutCallback saved_cb;
-      {
-        std::unique_lock<std::mutex> guard(timeout_mutex_);
-        if (timeout_ms_ > std::chrono::milliseconds(0)) saved_cb = timeout_cb_;
+    if (nfds < 0) continue;
+
+    std::vector<int> ready_fds;
+    for (int i = 0; i < nfds && running_; i++) {
+      int fd = events[i].data.fd;
+
+      // Read data from the notification FD.
+      if (fd == notification_fd_) {
+        uint64_t value = 0;
+        TEMP_FAILURE_RETRY(read(notification_fd_, &value, sizeof(value)));
+        continue;
       }
-      if (saved_cb != nullptr) saved_cb();
-      continue;
-    }
 
-    // Read data from the notification FD.
-    if (FD_ISSET(notification_listen_fd_, &read_fds)) {
-      char buffer[] = {0};
-      TEMP_FAILURE_RETRY(read(notification_listen_fd_, buffer, 1));
-      continue;
-    }
+      if (fd == timer_fd_) {
+        OnTimerExpired();
+        continue;
+      }
 
-    // Invoke the data ready callbacks if appropriate.
-    {
-      // Hold the mutex to make sure that the callbacks are still valid.
-      std::unique_lock<std::mutex> guard(internal_mutex_);
-      for (auto& it : watched_fds_) {
-        if (FD_ISSET(it.first, &read_fds)) {
-          it.second(it.first);
-        }
+      if (fd == delay_timer_fd_) {
+        OnDelayExpired();
+        continue;
+      }
+
+      // Hang-ups are reported as readable like select() did so the EOF is
+      // seen by the reader.
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        ready_fds.push_back(fd);
       }
     }
+    if (!ready_fds.empty()) ServiceReadyFds(ready_fds);
   }
 }
 
@@ -16,9 +16,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <map>
 #include <mutex>
+#include <set>
 #include <thread>
+#include <vector>
 
 namespace android {
 namespace hardware {
@@ -33,11 +38,25 @@ class AsyncFdWatcher {
   AsyncFdWatcher() = default;
   ~AsyncFdWatcher();
 
+  // Ready fds are serviced by decreasing priority. A fd gets up to
+  // read_budget callbacks per wakeup while it stays readable, and fds of a
+  // higher priority which became readable meanwhile are drained before each
+  // further callback of a lower priority fd.
   int WatchFdForNonBlockingReads(int file_descriptor,
-                                 const ReadCallback& on_read_fd_ready_callback);
+                                 const ReadCallback& on_read_fd_ready_callback,
+                                 int priority = 0, int read_budget = 1);
   int ConfigureTimeout(const std::chrono::milliseconds timeout,
                        const TimeoutCallback& on_timeout_callback);
   void StopWatchingFileDescriptors();
+  // Stops the callbacks of a fd without waiting, also from its own callback.
+  // It stays registered until StopWatchingFileDescriptors().
+  int StopReadingFd(int file_descriptor);
+  // Reads a fd stopped by StopReadingFd() again, from any thread.
+  int ResumeReadingFd(int file_descriptor);
+  // Holds back the next callback of a fd for the delay, so that more data
+  // is read at once. Only from the read callbacks, a zero delay and a
+  // stopped fd are ignored.
+  int DelayReads(int file_descriptor, std::chrono::microseconds delay);
 
  private:
   AsyncFdWatcher(const AsyncFdWatcher&) = delete;
@@ -48,16 +67,45 @@ class AsyncFdWatcher {
   int notifyThread();
   void ThreadRoutine();
 
+  int armTimerLocked(std::chrono::nanoseconds delay);
+  void OnTimerExpired();
+  void OnDelayExpired();
+  bool IsDelayedLocked(int fd) const;
+  void OnFdReady(int fd);
+  // The watched fds readable now, from a zero timeout epoll_wait().
+  std::vector<int> ReadyFds();
+  void ServiceReadyFds(const std::vector<int>& ready_fds);
+  void DrainFdsAbove(int priority);
+
+  struct WatchedFd {
+    ReadCallback callback;
+    int priority;
+    int read_budget;
+  };
+
   std::atomic_bool running_{false};
   std::thread thread_;
   std::mutex internal_mutex_;
   std::mutex timeout_mutex_;
 
-  std::map<int, ReadCallback> watched_fds_;
-  int notification_listen_fd_;
-  int notification_write_fd_;
+  std::map<int, WatchedFd> watched_fds_;
+  int epoll_fd_{-1};
+  int notification_fd_{-1};
+  int timer_fd_{-1};
+  int delay_timer_fd_{-1};
+  // Fds taken out of the epoll set by DelayReads() and by StopReadingFd().
+  // A stopped fd is never added back when the delay expires. Taken after
+  // internal_mutex_, no callback runs under it.
+  mutable std::mutex fd_state_mutex_;
+  std::vector<int> delayed_fds_;
+  std::set<int> stopped_fds_;
   TimeoutCallback timeout_cb_;
-  std::chrono::milliseconds timeout_ms_;
+  std::chrono::milliseconds timeout_ms_{0};
+  // The timeout expires after timeout_ms_ without activity on any watched fd,
+  // counted from the later of these two. Activity only updates the atomic, the
+  // timer is moved lazily when it expires.
+  std::chrono::steady_clock::time_point timeout_start_;
+  std::atomic<int64_t> last_activity_ns_{0};
 };
 
 }  // namespace async
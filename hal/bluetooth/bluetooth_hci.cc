@@ -19,6 +19,8 @@
 
 #include <log/log.h>
 
+#include "hci_queue_delivery.h"
+#include "hci_telemetry.h"
 #include "vendor_interface.h"
 
 namespace android {
@@ -51,7 +53,9 @@ class BluetoothDeathRecipient : public hidl_death_recipient {
 };
 
 BluetoothHci::BluetoothHci()
-    : death_recipient_(new BluetoothDeathRecipient(this)) {}
+    : death_recipient_(new BluetoothDeathRecipient(this)) {
+  hci::HciDataSink::Install(&hci::HciQueueDelivery::Get());
+}
 
 Return<void> BluetoothHci::initialize(
     const ::android::sp<IBluetoothHciCallbacks>& cb) {
@@ -73,19 +77,28 @@ Return<void> BluetoothHci::initialize(
         }
       },
       [cb](const hidl_vec<uint8_t>& packet) {
+        auto start = hci::HciTelemetry::Clock::now();
         auto hidl_status = cb->hciEventReceived(packet);
+        hci::HciTelemetry::Get().RecordCallback(
+            HCI_PACKET_TYPE_EVENT, hci::HciTelemetry::Clock::now() - start);
         if (!hidl_status.isOk()) {
           ALOGE("VendorInterface -> Unable to call hciEventReceived()");
         }
       },
       [cb](const hidl_vec<uint8_t>& packet) {
+        auto start = hci::HciTelemetry::Clock::now();
         auto hidl_status = cb->aclDataReceived(packet);
+        hci::HciTelemetry::Get().RecordCallback(
+            HCI_PACKET_TYPE_ACL_DATA, hci::HciTelemetry::Clock::now() - start);
         if (!hidl_status.isOk()) {
           ALOGE("VendorInterface -> Unable to call aclDataReceived()");
         }
       },
       [cb](const hidl_vec<uint8_t>& packet) {
+        auto start = hci::HciTelemetry::Clock::now();
         auto hidl_status = cb->scoDataReceived(packet);
+        hci::HciTelemetry::Get().RecordCallback(
+            HCI_PACKET_TYPE_SCO_DATA, hci::HciTelemetry::Clock::now() - start);
         if (!hidl_status.isOk()) {
           ALOGE("VendorInterface -> Unable to call scoDataReceived()");
         }
@@ -111,6 +124,7 @@ Return<void> BluetoothHci::close() {
   ALOGI("BluetoothHci::close()");
   unlink_cb_(death_recipient_);
   VendorInterface::Shutdown();
+  hci::HciQueueDelivery::Get().Disable();
   return Void();
 }
 
@@ -129,6 +143,35 @@ Return<void> BluetoothHci::sendScoData(const hidl_vec<uint8_t>& data) {
   return Void();
 }
 
+Return<void> BluetoothHci::debug(const hidl_handle& fd,
+                                 const hidl_vec<hidl_string>& /* options */) {
+  const native_handle_t* handle = fd.getNativeHandle();
+  if (handle == nullptr || handle->numFds < 1) {
+    ALOGE("BluetoothHci::debug() called without a file descriptor");
+    return Void();
+  }
+  hci::HciTelemetry::Get().Dump(handle->data[0]);
+  return Void();
+}
+
+Return<void> BluetoothHci::enableQueueDelivery(
+    enableQueueDelivery_cb _hidl_cb) {
+  const MQDescriptorSync<uint8_t>* descriptor = nullptr;
+  if (VendorInterface::get() == nullptr) {
+    ALOGE("BluetoothHci::enableQueueDelivery() called before initialize()");
+  } else {
+    descriptor = hci::HciQueueDelivery::Get().Enable();
+  }
+
+  if (descriptor == nullptr) {
+    _hidl_cb(false, MQDescriptorSync<uint8_t>(
+                        std::vector<GrantorDescriptor>(), nullptr, 0));
+  } else {
+    _hidl_cb(true, *descriptor);
+  }
+  return Void();
+}
+
 void BluetoothHci::sendDataToController(const uint8_t type,
                                         const hidl_vec<uint8_t>& data) {
   VendorInterface::get()->Send(type, data.data(), data.size());
@@ -18,6 +18,7 @@
 #define HIDL_GENERATED_android_hardware_bluetooth_V1_0_BluetoothHci_H_
 
 #include <android/hardware/bluetooth/1.0/IBluetoothHci.h>
+#include <vendor/renesas/hardware/bluetooth/1.0/IBluetoothHciQueue.h>
 
 #include <hidl/MQDescriptor.h>
 
@@ -29,12 +30,15 @@ namespace bluetooth {
 namespace V1_0 {
 namespace kingfisher {
 
+using ::android::hardware::hidl_handle;
+using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
 using ::android::hardware::Return;
+using ::vendor::renesas::hardware::bluetooth::V1_0::IBluetoothHciQueue;
 
 class BluetoothDeathRecipient;
 
-class BluetoothHci : public IBluetoothHci {
+class BluetoothHci : public IBluetoothHciQueue {
  public:
   BluetoothHci();
   Return<void> initialize(
@@ -43,6 +47,9 @@ class BluetoothHci : public IBluetoothHci {
   Return<void> sendAclData(const hidl_vec<uint8_t>& data) override;
   Return<void> sendScoData(const hidl_vec<uint8_t>& data) override;
   Return<void> close() override;
+  Return<void> debug(const hidl_handle& fd,
+                     const hidl_vec<hidl_string>& options) override;
+  Return<void> enableQueueDelivery(enableQueueDelivery_cb _hidl_cb) override;
 
  private:
   void sendDataToController(const uint8_t type, const hidl_vec<uint8_t>& data);
@@ -21,79 +21,157 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <log/log.h>
-#include <sys/uio.h>
 #include <unistd.h>
 
+#include "hci_snoop.h"
+#include "hci_telemetry.h"
+
+namespace {
+
+// Largest handle a controller assigns (Volume 2, Part E, 5.4.2)
+const uint16_t HCI_HANDLE_MAX = 0x0EFF;
+// Largest ACL data length of the controllers this HAL drives.
+const size_t HCI_ACL_LENGTH_MAX = 1021;
+// Highest event code defined up to Bluetooth 5.1, and the vendor event.
+const uint8_t HCI_EVENT_CODE_MAX = 0x58;
+const uint8_t HCI_VENDOR_SPECIFIC_EVENT = 0xFF;
+
+bool IsPacketType(uint8_t type) {
+  return type == HCI_PACKET_TYPE_ACL_DATA || type == HCI_PACKET_TYPE_SCO_DATA ||
+         type == HCI_PACKET_TYPE_EVENT;
+}
+
+size_t PreambleSize(uint8_t type) {
+  switch (type) {
+    case HCI_PACKET_TYPE_ACL_DATA:
+      return HCI_ACL_PREAMBLE_SIZE;
+    case HCI_PACKET_TYPE_SCO_DATA:
+      return HCI_SCO_PREAMBLE_SIZE;
+    default:
+      return HCI_EVENT_PREAMBLE_SIZE;
+  }
+}
+
+// A random byte matches a packet type too often to trust it alone, every
+// packet type byte is checked together with the preamble following it.
+bool IsPlausiblePreamble(uint8_t type, const uint8_t* preamble) {
+  if (type == HCI_PACKET_TYPE_EVENT) {
+    uint8_t code = preamble[0];
+    uint8_t length = preamble[1];
+    if (code == HCI_COMMAND_COMPLETE_EVENT) return length >= 3;
+    if (code == HCI_COMMAND_STATUS_EVENT) return length == 4;
+    return code != 0 &&
+           (code <= HCI_EVENT_CODE_MAX || code == HCI_VENDOR_SPECIFIC_EVENT);
+  }
+
+  uint16_t handle = (preamble[0] | (preamble[1] << 8)) & 0x0FFF;
+  if (handle > HCI_HANDLE_MAX) return false;
+  if (type == HCI_PACKET_TYPE_ACL_DATA) {
+    size_t length = preamble[2] | (preamble[3] << 8);
+    return length > 0 && length <= HCI_ACL_LENGTH_MAX;
+  }
+  return true;
+}
+
+}  // namespace
+
 namespace android {
 namespace hardware {
 namespace bluetooth {
 namespace hci {
 
 size_t H4Protocol::Send(uint8_t type, const uint8_t* data, size_t length) {
-  struct iovec iov[] = {{&type, sizeof(type)},
-                        {const_cast<uint8_t*>(data), length}};
-  ssize_t ret = 0;
-  do {
-    ret =
-        TEMP_FAILURE_RETRY(writev(uart_fd_, iov, sizeof(iov) / sizeof(iov[0])));
-  } while (-1 == ret && EAGAIN == errno);
-
-  if (ret == -1) {
-    ALOGE("%s error writing to UART (%s)", __func__, strerror(errno));
-  } else if (ret < static_cast<ssize_t>(length + 1)) {
-    ALOGE("%s: %d / %d bytes written - something went wrong...", __func__,
-          static_cast<int>(ret), static_cast<int>(length + 1));
-  }
-  return ret;
+  return tx_queue_.Send(type, data, length);
 }
 
 void H4Protocol::OnPacketReady() {
+  const hidl_vec<uint8_t>& packet = hci_packetizer_.GetPacket();
+  HciSnoop::Get().Capture(hci_packet_type_, true, packet.data(), packet.size());
+  rx_policy_.OnPacket(hci_packet_type_, packet.size());
+
   switch (hci_packet_type_) {
     case HCI_PACKET_TYPE_EVENT:
-      event_cb_(hci_packetizer_.GetPacket());
+      // Credits are returned right away, not when the stack gets the event.
+      tx_queue_.OnEventReceived(packet);
       break;
     case HCI_PACKET_TYPE_ACL_DATA:
-      acl_cb_(hci_packetizer_.GetPacket());
-      break;
     case HCI_PACKET_TYPE_SCO_DATA:
-      sco_cb_(hci_packetizer_.GetPacket());
       break;
     default:
-      LOG_ALWAYS_FATAL("%s: Unimplemented packet type %d", __func__,
-                       static_cast<int>(hci_packet_type_));
+      // ParseRxBuffer() only starts packets of the types above.
+      ALOGE("%s: Unimplemented packet type %d", __func__,
+            static_cast<int>(hci_packet_type_));
+      hci_packet_type_ = HCI_PACKET_TYPE_UNKNOWN;
+      return;
   }
+
+  size_t length = packet.size();
+  rx_dispatcher_.Dispatch(hci_packet_type_, hci_packetizer_.TakePacketBuffer(),
+                          length, rx_buffer_.GetReadTime());
   // Get ready for the next type byte.
   hci_packet_type_ = HCI_PACKET_TYPE_UNKNOWN;
 }
 
 void H4Protocol::OnDataReady(int fd) {
-  if (hci_packet_type_ == HCI_PACKET_TYPE_UNKNOWN) {
-    uint8_t buffer[1] = {0};
-    ssize_t bytes_read = TEMP_FAILURE_RETRY(read(fd, buffer, 1));
-    if (bytes_read != 1) {
-      if (bytes_read == 0) {
-        // This is only expected if the UART got closed when shutting down.
-        ALOGE("%s: Unexpected EOF reading the packet type!", __func__);
-        sleep(5);  // Expect to be shut down within 5 seconds.
-        return;
-      } else if (bytes_read < 0) {
-        LOG_ALWAYS_FATAL("%s: Read packet type error: %s", __func__,
-                         strerror(errno));
-      } else {
-        LOG_ALWAYS_FATAL("%s: More bytes read than expected (%u)!", __func__,
-                         static_cast<unsigned int>(bytes_read));
+  size_t buffered = rx_buffer_.Size();
+  if (!ReadSafely(fd, rx_buffer_)) return;
+  rx_policy_.OnRead(rx_buffer_.Size() - buffered);
+  ParseRxBuffer();
+}
+
+void H4Protocol::ParseRxBuffer() {
+  while (rx_buffer_.Size() > 0) {
+    if (resynchronizing_ && !Resynchronize()) return;
+
+    size_t length = 0;
+    const uint8_t* data = rx_buffer_.Front(&length);
+
+    if (hci_packet_type_ == HCI_PACKET_TYPE_UNKNOWN) {
+      if (!IsPacketType(data[0])) {
+        // A byte was lost or corrupted on the UART.
+        ALOGE("%s: Unimplemented packet type %d, resynchronizing", __func__,
+              static_cast<int>(data[0]));
+        resynchronizing_ = true;
+        continue;
+      }
+      uint8_t header[1 + HCI_PREAMBLE_SIZE_MAX];
+      if (!rx_buffer_.Peek(header, 1 + PreambleSize(data[0]))) return;
+      if (!IsPlausiblePreamble(header[0], header + 1)) {
+        ALOGE("%s: Implausible preamble for packet type %d, resynchronizing",
+              __func__, static_cast<int>(header[0]));
+        resynchronizing_ = true;
+        continue;
       }
+      hci_packet_type_ = static_cast<HciPacketType>(data[0]);
+      rx_buffer_.Consume(1);
+      continue;
     }
-    hci_packet_type_ = static_cast<HciPacketType>(buffer[0]);
-    if (hci_packet_type_ != HCI_PACKET_TYPE_ACL_DATA &&
-        hci_packet_type_ != HCI_PACKET_TYPE_SCO_DATA &&
-        hci_packet_type_ != HCI_PACKET_TYPE_EVENT) {
-      LOG_ALWAYS_FATAL("%s: Unimplemented packet type %d", __func__,
-                       static_cast<int>(hci_packet_type_));
+
+    // Resets the packet type from OnPacketReady() once a packet is complete.
+    rx_buffer_.Consume(
+        hci_packetizer_.OnDataReady(data, length, hci_packet_type_));
+  }
+}
+
+bool H4Protocol::Resynchronize() {
+  uint8_t header[1 + HCI_PREAMBLE_SIZE_MAX];
+  while (rx_buffer_.Peek(header, 1)) {
+    if (IsPacketType(header[0])) {
+      size_t preamble_size = PreambleSize(header[0]);
+      if (!rx_buffer_.Peek(header, 1 + preamble_size)) return false;
+      if (IsPlausiblePreamble(header[0], header + 1)) {
+        ALOGW("%s: resynchronized after %zu bytes", __func__,
+              discarded_bytes_);
+        HciTelemetry::Get().RecordRxResync(discarded_bytes_);
+        resynchronizing_ = false;
+        discarded_bytes_ = 0;
+        return true;
+      }
     }
-  } else {
-    hci_packetizer_.OnDataReady(fd, hci_packet_type_);
+    rx_buffer_.Consume(1);
+    discarded_bytes_++;
   }
+  return false;
 }
 
 }  // namespace hci
@@ -22,6 +22,9 @@
 #include "bt_vendor_lib.h"
 #include "hci_internals.h"
 #include "hci_protocol.h"
+#include "hci_rx_dispatcher.h"
+#include "hci_rx_policy.h"
+#include "hci_tx_queue.h"
 
 namespace android {
 namespace hardware {
@@ -32,11 +35,9 @@ class H4Protocol : public HciProtocol {
  public:
   H4Protocol(int fd, PacketReadCallback event_cb, PacketReadCallback acl_cb,
              PacketReadCallback sco_cb)
-      : uart_fd_(fd),
-        event_cb_(event_cb),
-        acl_cb_(acl_cb),
-        sco_cb_(sco_cb),
-        hci_packetizer_([this]() { OnPacketReady(); }) {}
+      : hci_packetizer_([this]() { OnPacketReady(); }),
+        tx_queue_(fd, true),
+        rx_dispatcher_(event_cb, acl_cb, sco_cb) {}
 
   size_t Send(uint8_t type, const uint8_t* data, size_t length);
 
@@ -44,15 +45,28 @@ class H4Protocol : public HciProtocol {
 
   void OnDataReady(int fd);
 
- private:
-  int uart_fd_;
+  std::chrono::microseconds NextReadDelay() {
+    return rx_policy_.NextReadDelay();
+  }
+
+  void SetRxFlowCallback(RxFlowCallback callback) {
+    rx_dispatcher_.SetFlowCallback(callback);
+  }
 
-  PacketReadCallback event_cb_;
-  PacketReadCallback acl_cb_;
-  PacketReadCallback sco_cb_;
+ private:
+  void ParseRxBuffer();
+  // Drops bytes until a packet type followed by a plausible preamble is at
+  // the head of the buffer. Returns false if more data is needed.
+  bool Resynchronize();
 
   HciPacketType hci_packet_type_{HCI_PACKET_TYPE_UNKNOWN};
+  bool resynchronizing_{false};
+  size_t discarded_bytes_{0};
   hci::HciPacketizer hci_packetizer_;
+  hci::HciRxBuffer rx_buffer_;
+  hci::HciRxPolicy rx_policy_;
+  hci::HciTxQueue tx_queue_;
+  hci::HciRxDispatcher rx_dispatcher_;
 };
 
 }  // namespace hci
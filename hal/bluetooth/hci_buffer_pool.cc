@@ -0,0 +1,196 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_buffer_pool.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <log/log.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include "hci_internals.h"
+
+namespace {
+
+// Every block starts with a header telling where it has to be returned.
+struct alignas(16) BlockHeader {
+  uint32_t magic;
+  uint32_t size_class;
+  std::atomic<uint32_t> refs;
+};
+
+const uint32_t BLOCK_MAGIC = 0x48434942;  // "HCIB"
+const uint32_t HEAP_SIZE_CLASS = UINT32_MAX;
+
+struct SizeClassConfig {
+  size_t size;
+  size_t count;
+};
+
+// Buffers held outside the transport queues: the packet being reassembled,
+// buffers lent to the vendor library and commands awaiting completion.
+const size_t IN_FLIGHT_BLOCKS = 8;
+
+// Usable sizes include room for the HC_BT_HDR used by the vendor library.
+// Every class holds the queues which can fill it at once, so a stack which
+// falls behind stops the transport before the pool falls back to the heap.
+const SizeClassConfig size_class_config[] = {
+    // Commands and short events
+    {64, HCI_TX_COMMAND_QUEUE_DEPTH + HCI_RX_EVENT_STOP_DEPTH +
+             IN_FLIGHT_BLOCKS},
+    // Any event: 2 bytes preamble + 255 bytes parameters, and SCO
+    {272, HCI_RX_EVENT_STOP_DEPTH + HCI_RX_MAX_SCO_DEPTH +
+              HCI_TX_SCO_QUEUE_DEPTH + IN_FLIGHT_BLOCKS},
+    // ACL up to 1021 bytes payload, the controller maximum
+    {1040, HCI_RX_ACL_STOP_DEPTH + HCI_TX_ACL_QUEUE_DEPTH +
+               HCI_TX_MAX_BATCH_PACKETS + IN_FLIGHT_BLOCKS},
+    // Larger ACL and vendor specific firmware chunks
+    {4096, 8},
+};
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciBufferPool& HciBufferPool::Get() {
+  static HciBufferPool pool;
+  return pool;
+}
+
+HciBufferPool::HciBufferPool() {
+  for (const auto& config : size_class_config) {
+    classes_.emplace_back();
+    SizeClass& size_class = classes_.back();
+    size_t block_size = sizeof(BlockHeader) + config.size;
+
+    size_class.size = config.size;
+    size_class.block_size = block_size;
+    size_class.count = config.count;
+    size_class.min_free = config.count;
+    size_class.storage.resize(block_size * config.count + alignof(BlockHeader));
+    size_class.free_blocks.reserve(config.count);
+
+    uintptr_t base = reinterpret_cast<uintptr_t>(size_class.storage.data());
+    base = (base + alignof(BlockHeader) - 1) & ~(alignof(BlockHeader) - 1);
+    size_class.base = base;
+    for (size_t i = 0; i < config.count; i++) {
+      BlockHeader* header =
+          new (reinterpret_cast<void*>(base + i * block_size)) BlockHeader();
+      header->magic = BLOCK_MAGIC;
+      header->size_class = classes_.size() - 1;
+      size_class.free_blocks.push_back(reinterpret_cast<uint8_t*>(header));
+    }
+  }
+}
+
+void* HciBufferPool::Allocate(size_t size) {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    SizeClass* exhausted = nullptr;
+    for (auto& size_class : classes_) {
+      if (size > size_class.size) continue;
+      if (size_class.free_blocks.empty()) {
+        if (exhausted == nullptr) exhausted = &size_class;
+        continue;
+      }
+
+      uint8_t* block = size_class.free_blocks.back();
+      size_class.free_blocks.pop_back();
+      size_class.min_free =
+          std::min(size_class.min_free, size_class.free_blocks.size());
+      reinterpret_cast<BlockHeader*>(block)->refs.store(
+          1, std::memory_order_relaxed);
+      return block + sizeof(BlockHeader);
+    }
+    // Counted against the class the request was meant for.
+    if (exhausted != nullptr) {
+      exhausted->fallbacks++;
+    } else {
+      oversize_fallbacks_++;
+    }
+  }
+
+  heap_fallbacks_++;
+  ALOGV("%s: %zu bytes allocated from heap", __func__, size);
+  BlockHeader* header =
+      new (new uint8_t[sizeof(BlockHeader) + size]) BlockHeader();
+  header->magic = BLOCK_MAGIC;
+  header->size_class = HEAP_SIZE_CLASS;
+  header->refs.store(1, std::memory_order_relaxed);
+  return header + 1;
+}
+
+void HciBufferPool::Free(void* buffer) {
+  if (buffer == nullptr) return;
+
+  BlockHeader* header = reinterpret_cast<BlockHeader*>(buffer) - 1;
+  LOG_ALWAYS_FATAL_IF(header->magic != BLOCK_MAGIC,
+                      "%s: %p was not allocated from the pool", __func__,
+                      buffer);
+  if (header->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+  if (header->size_class == HEAP_SIZE_CLASS) {
+    delete[] reinterpret_cast<uint8_t*>(header);
+    return;
+  }
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  classes_[header->size_class].free_blocks.push_back(
+      reinterpret_cast<uint8_t*>(header));
+}
+
+void HciBufferPool::Dump(int fd) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  dprintf(fd, "  buffer pool heap fallbacks %llu\n",
+          static_cast<unsigned long long>(heap_fallbacks_.load()));
+  for (const auto& size_class : classes_) {
+    dprintf(fd,
+            "    %zu bytes: %zu blocks, at least %zu free, %llu fallbacks\n",
+            size_class.size, size_class.count, size_class.min_free,
+            static_cast<unsigned long long>(size_class.fallbacks));
+  }
+  dprintf(fd, "    larger: %llu fallbacks\n",
+          static_cast<unsigned long long>(oversize_fallbacks_));
+}
+
+void* HciBufferPool::Retain(const void* data) {
+  // The storage never moves, no lock needed to find the block.
+  uintptr_t address = reinterpret_cast<uintptr_t>(data);
+  for (const auto& size_class : classes_) {
+    if (address < size_class.base) continue;
+    size_t index = (address - size_class.base) / size_class.block_size;
+    if (index >= size_class.count) continue;
+
+    BlockHeader* header = reinterpret_cast<BlockHeader*>(
+        size_class.base + index * size_class.block_size);
+    if (address < reinterpret_cast<uintptr_t>(header + 1)) return nullptr;
+    header->refs.fetch_add(1, std::memory_order_relaxed);
+    return header + 1;
+  }
+  return nullptr;
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
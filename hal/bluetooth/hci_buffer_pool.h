@@ -0,0 +1,80 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Fixed pool of packet buffers in a few size classes, shared by the packet
+// reassembly and the vendor library alloc/dealloc callbacks. A request is
+// served from the smallest class that fits. Requests larger than the biggest
+// class or made while a class is exhausted fall back to the heap, so a
+// buffer must always be returned with Free().
+//
+// Buffers are reference counted so that a received packet can be lent to
+// the vendor library without a copy, it goes back to the pool once both
+// sides freed it.
+class HciBufferPool {
+ public:
+  static HciBufferPool& Get();
+
+  void* Allocate(size_t size);
+  void Free(void* buffer);
+
+  // Takes a reference to the pooled buffer containing data and returns it,
+  // nullptr if data is not in a pooled buffer.
+  void* Retain(const void* data);
+
+  // Allocations which were not served from the pool, by size class, and the
+  // fewest free blocks each class had.
+  void Dump(int fd);
+
+ private:
+  struct SizeClass {
+    size_t size;
+    size_t block_size;
+    size_t count;
+    size_t min_free;
+    uint64_t fallbacks = 0;
+    uintptr_t base;
+    std::vector<uint8_t> storage;
+    std::vector<uint8_t*> free_blocks;
+  };
+
+  HciBufferPool();
+  HciBufferPool(const HciBufferPool&) = delete;
+  HciBufferPool& operator=(const HciBufferPool&) = delete;
+
+  std::mutex mutex_;
+  std::vector<SizeClass> classes_;
+  std::atomic<uint64_t> heap_fallbacks_{0};
+  uint64_t oversize_fallbacks_ = 0;
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
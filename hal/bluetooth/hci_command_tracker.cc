@@ -0,0 +1,232 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_command_tracker.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <log/log.h>
+
+#include "hci_buffer_pool.h"
+#include "hci_internals.h"
+
+namespace {
+
+// Reported to the vendor library for a command without an answer.
+const uint8_t HCI_ERROR_UNSPECIFIED = 0x1F;
+
+// Host_Number_Of_Completed_Packets is never answered and may be sent without
+// a credit, Core Spec Vol 4 Part E 7.3.40.
+const uint16_t HCI_HOST_NUMBER_OF_COMPLETED_PACKETS = 0x0C35;
+
+bool IsUnanswered(uint16_t opcode) {
+  return opcode == HCI_HOST_NUMBER_OF_COMPLETED_PACKETS;
+}
+
+// Command Complete with only the status as return parameter.
+android::hardware::hidl_vec<uint8_t> MakeCommandComplete(uint8_t credits,
+                                                         uint16_t opcode,
+                                                         uint8_t status) {
+  std::vector<uint8_t> event = {HCI_COMMAND_COMPLETE_EVENT,
+                                4,
+                                credits,
+                                static_cast<uint8_t>(opcode & 0xFF),
+                                static_cast<uint8_t>(opcode >> 8),
+                                status};
+  return event;
+}
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciCommandTracker::HciCommandTracker(SendFunction send,
+                                     std::chrono::milliseconds timeout)
+    : send_(send), timeout_(timeout) {
+  timeout_thread_ = std::thread([this]() { TimeoutRoutine(); });
+}
+
+HciCommandTracker::~HciCommandTracker() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (timeout_thread_.joinable()) timeout_thread_.join();
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  FreeQueuedLocked(&queued_);
+  FreeQueuedLocked(&sendable_);
+}
+
+void HciCommandTracker::SendInternal(uint16_t opcode, void* buffer,
+                                     const uint8_t* data, size_t length,
+                                     CompleteCallback callback) {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    queued_.push_back({opcode, buffer, data, length, callback});
+    TakeSendableLocked();
+  }
+  SendCommands();
+}
+
+void HciCommandTracker::OnStackCommandSent(uint16_t opcode) {
+  if (IsUnanswered(opcode)) return;
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  pending_[opcode].push_back({nullptr, Clock::now() + timeout_});
+  if (credits_ > 0) credits_--;
+  // The timeout thread may be waiting without a deadline.
+  cv_.notify_all();
+}
+
+bool HciCommandTracker::OnEventReceived(const hidl_vec<uint8_t>& event) {
+  uint8_t credits;
+  uint16_t opcode;
+  uint8_t status = 0;
+  if (event.size() >= 5 && event[0] == HCI_COMMAND_COMPLETE_EVENT) {
+    credits = event[2];
+    opcode = event[3] | (event[4] << 8);
+  } else if (event.size() >= 6 && event[0] == HCI_COMMAND_STATUS_EVENT) {
+    status = event[2];
+    credits = event[3];
+    opcode = event[4] | (event[5] << 8);
+  } else {
+    return false;
+  }
+
+  CompleteCallback callback;
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    credits_ = credits;
+
+    auto it = pending_.find(opcode);
+    if (it != pending_.end()) {
+      callback = it->second.front().callback;
+      it->second.pop_front();
+      if (it->second.empty()) pending_.erase(it);
+    }
+    TakeSendableLocked();
+  }
+  SendCommands();
+
+  // Opcode 0 only returns credits, stack commands are answered to the stack.
+  if (!callback) return false;
+
+  ALOGV("%s: internal command %04x completed", __func__, opcode);
+  if (event[0] == HCI_COMMAND_STATUS_EVENT) {
+    callback(MakeCommandComplete(credits, opcode, status));
+  } else {
+    callback(event);
+  }
+  return true;
+}
+
+void HciCommandTracker::Reset() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  pending_.clear();
+  FreeQueuedLocked(&queued_);
+  FreeQueuedLocked(&sendable_);
+  credits_ = 1;
+}
+
+void HciCommandTracker::TakeSendableLocked() {
+  bool taken = false;
+  while (credits_ > 0 && !queued_.empty()) {
+    QueuedCommand& command = queued_.front();
+    pending_[command.opcode].push_back(
+        {command.callback, Clock::now() + timeout_});
+    credits_--;
+    sendable_.push_back(std::move(command));
+    queued_.pop_front();
+    taken = true;
+  }
+  if (taken) cv_.notify_one();
+}
+
+void HciCommandTracker::SendCommands() {
+  std::unique_lock<std::mutex> send_guard(send_mutex_);
+  while (true) {
+    QueuedCommand command;
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      if (sendable_.empty()) return;
+      command = std::move(sendable_.front());
+      sendable_.pop_front();
+    }
+    send_(command.data, command.length);
+    HciBufferPool::Get().Free(command.buffer);
+  }
+}
+
+void HciCommandTracker::FreeQueuedLocked(std::deque<QueuedCommand>* commands) {
+  for (const QueuedCommand& command : *commands) {
+    HciBufferPool::Get().Free(command.buffer);
+  }
+  commands->clear();
+}
+
+void HciCommandTracker::TimeoutRoutine() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  while (!stopping_) {
+    // Every command of an opcode has the same timeout, the oldest is first.
+    Clock::time_point next_deadline = Clock::time_point::max();
+    for (const auto& it : pending_) {
+      next_deadline = std::min(next_deadline, it.second.front().deadline);
+    }
+    if (next_deadline == Clock::time_point::max()) {
+      cv_.wait(guard);
+      continue;
+    }
+    if (cv_.wait_until(guard, next_deadline) != std::cv_status::timeout) {
+      continue;
+    }
+
+    Clock::time_point now = Clock::now();
+    std::vector<std::pair<uint16_t, CompleteCallback>> expired;
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      auto& commands = it->second;
+      while (!commands.empty() && commands.front().deadline <= now) {
+        ALOGE("%s: command %04x timed out", __func__, it->first);
+        if (commands.front().callback) {
+          expired.emplace_back(it->first, commands.front().callback);
+        }
+        // The credit is not given back, the controller may still be
+        // working on the command. The next Command Complete or Command
+        // Status says how many it accepts.
+        commands.pop_front();
+      }
+      it = commands.empty() ? pending_.erase(it) : std::next(it);
+    }
+    TakeSendableLocked();
+
+    guard.unlock();
+    SendCommands();
+    for (auto& command : expired) {
+      command.second(
+          MakeCommandComplete(1, command.first, HCI_ERROR_UNSPECIFIED));
+    }
+    guard.lock();
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,122 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <hidl/HidlSupport.h>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+using ::android::hardware::hidl_vec;
+
+// Tracks the HCI commands in flight so that the completions of commands
+// sent by the HAL itself (vendor firmware configuration) are not forwarded
+// to the stack. Commands are matched by opcode, several may be in flight up
+// to the Num_HCI_Command_Packets credit of the controller, further ones wait
+// for the credit. Commands sent by the stack are tracked as well, so that a
+// completion with the same opcode goes to whoever sent first.
+//
+// A Command Status completes an internal command as a Command Complete with
+// that status, which is how the vendor library expects to see errors. A
+// command without an answer is completed with an error after a timeout,
+// the credits are only taken again from the next Command Complete or
+// Command Status. Commands the controller never answers are not tracked.
+class HciCommandTracker {
+ public:
+  using CompleteCallback = std::function<void(const hidl_vec<uint8_t>& event)>;
+  using SendFunction = std::function<void(const uint8_t* data, size_t length)>;
+
+  HciCommandTracker(SendFunction send, std::chrono::milliseconds timeout);
+  ~HciCommandTracker();
+
+  // Sends, or queues until a credit is available, a command from the HAL.
+  // Takes ownership of buffer, the HciBufferPool buffer holding data, it is
+  // freed once the command was written.
+  void SendInternal(uint16_t opcode, void* buffer, const uint8_t* data,
+                    size_t length, CompleteCallback callback);
+
+  // Has to be called for every command sent by the stack.
+  void OnStackCommandSent(uint16_t opcode);
+
+  // Returns true if the event completed an internal command and must not be
+  // forwarded to the stack.
+  bool OnEventReceived(const hidl_vec<uint8_t>& event);
+
+  // Forgets every command, the callbacks are not called.
+  void Reset();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  struct PendingCommand {
+    // Empty for commands sent by the stack.
+    CompleteCallback callback;
+    Clock::time_point deadline;
+  };
+
+  struct QueuedCommand {
+    uint16_t opcode;
+    void* buffer;
+    const uint8_t* data;
+    size_t length;
+    CompleteCallback callback;
+  };
+
+  HciCommandTracker(const HciCommandTracker&) = delete;
+  HciCommandTracker& operator=(const HciCommandTracker&) = delete;
+
+  // Moves the commands which have a credit to sendable_, SendCommands()
+  // writes them without holding the lock.
+  void TakeSendableLocked();
+  void SendCommands();
+  void FreeQueuedLocked(std::deque<QueuedCommand>* commands);
+  void TimeoutRoutine();
+
+  SendFunction send_;
+  std::chrono::milliseconds timeout_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<uint16_t, std::deque<PendingCommand>> pending_;
+  std::deque<QueuedCommand> queued_;
+  std::deque<QueuedCommand> sendable_;
+  // Keeps the sendable commands in order across threads.
+  std::mutex send_mutex_;
+  // The controller accepts one command until it says otherwise.
+  int credits_{1};
+  bool stopping_{false};
+  std::thread timeout_thread_;
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,39 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_data_sink.h"
+
+#include <atomic>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+namespace {
+
+std::atomic<HciDataSink*> installed_sink{nullptr};
+
+}  // namespace
+
+HciDataSink* HciDataSink::Get() { return installed_sink.load(); }
+
+void HciDataSink::Install(HciDataSink* sink) { installed_sink = sink; }
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
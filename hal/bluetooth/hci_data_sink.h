@@ -0,0 +1,67 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+
+#include <chrono>
+
+#include <hidl/HidlSupport.h>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+using ::android::hardware::hidl_vec;
+
+// Takes received ACL and SCO packets instead of the HIDL callbacks. The
+// transport only knows this interface, the implementation on top of FMQ is
+// part of the service and installed by it, so the transport builds for the
+// host without the HIDL interfaces.
+class HciDataSink {
+ public:
+  enum DeliveryResult { NOT_QUEUED, QUEUED, QUEUE_FULL };
+
+  virtual ~HciDataSink() = default;
+
+  // The sink of the process, nullptr until one is installed. It has to
+  // outlive every transport.
+  static HciDataSink* Get();
+  static void Install(HciDataSink* sink);
+
+  // NOT_QUEUED when the sink does not take packets now, the packet then has
+  // to be delivered through HIDL. On QUEUE_FULL nothing was taken and the
+  // reader has been woken.
+  virtual DeliveryResult Deliver(HciPacketType type,
+                                 const hidl_vec<uint8_t>& packet) = 0;
+
+  // Waits up to timeout for the reader to make room for a packet of
+  // packet_size bytes.
+  virtual void WaitForSpace(size_t packet_size,
+                            std::chrono::milliseconds timeout) = 0;
+
+  // Wakes the reader if packets were taken since the last call.
+  virtual void Flush() = 0;
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
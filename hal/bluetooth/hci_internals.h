@@ -45,5 +45,28 @@ const size_t HCI_LENGTH_OFFSET_EVT = 1;
 
 const size_t HCI_PREAMBLE_SIZE_MAX = HCI_ACL_PREAMBLE_SIZE;
 
+// Received packets start this far into their buffer, room for the HC_BT_HDR
+// the vendor library expects in front of an event.
+const size_t HCI_PACKET_HEADROOM = 8;
+
+// Depths of the transport queues, HciBufferPool is sized from them.
+//
+// Received events and ACL packets waiting for the stack at which
+// HciRxDispatcher stops reading the transport, several hundred milliseconds
+// of a saturated link. It is read again at half of that. SCO packets beyond
+// their depth are dropped, audio is useless when that late anyway.
+const size_t HCI_RX_EVENT_STOP_DEPTH = 128;
+const size_t HCI_RX_ACL_STOP_DEPTH = 256;
+const size_t HCI_RX_MAX_SCO_DEPTH = 32;
+
+// Packets HciTxQueue holds before Send() blocks, and the packets it
+// coalesces into a single writev() on top of them.
+const size_t HCI_TX_COMMAND_QUEUE_DEPTH = 8;
+const size_t HCI_TX_ACL_QUEUE_DEPTH = 32;
+const size_t HCI_TX_SCO_QUEUE_DEPTH = 16;
+const size_t HCI_TX_MAX_BATCH_PACKETS = 16;
+
 // Event codes (Volume 2, Part E, 7.7.14)
 const uint8_t HCI_COMMAND_COMPLETE_EVENT = 0x0E;
+const uint8_t HCI_COMMAND_STATUS_EVENT = 0x0F;
+const uint8_t HCI_HARDWARE_ERROR_EVENT = 0x10;
@@ -24,6 +24,11 @@
 #include <unistd.h>
 #include <utils/Log.h>
 
+#include "hci_buffer_pool.h"
+#include "hci_telemetry.h"
+
+#include <algorithm>
+
 namespace {
 
 const size_t preamble_size_for_type[] = {
@@ -46,61 +51,69 @@ namespace hardware {
 namespace bluetooth {
 namespace hci {
 
+HciPacketizer::~HciPacketizer() { ReleasePacket(); }
+
 const hidl_vec<uint8_t>& HciPacketizer::GetPacket() const { return packet_; }
 
-void HciPacketizer::OnDataReady(int fd, HciPacketType packet_type) {
-  switch (state_) {
-    case HCI_PREAMBLE: {
-      ssize_t bytes_read = TEMP_FAILURE_RETRY(
-          read(fd, preamble_ + bytes_read_,
-               preamble_size_for_type[packet_type] - bytes_read_));
-      if (bytes_read == 0) {
-        // This is only expected if the UART got closed when shutting down.
-        ALOGE("%s: Unexpected EOF reading the header!", __func__);
-        sleep(5);  // Expect to be shut down within 5 seconds.
-        return;
-      }
-      if (bytes_read < 0) {
-        LOG_ALWAYS_FATAL("%s: Read header error: %s", __func__,
-                         strerror(errno));
-      }
-      bytes_read_ += bytes_read;
-      if (bytes_read_ == preamble_size_for_type[packet_type]) {
-        size_t packet_length =
-            HciGetPacketLengthForType(packet_type, preamble_);
-        packet_.resize(preamble_size_for_type[packet_type] + packet_length);
-        memcpy(packet_.data(), preamble_, preamble_size_for_type[packet_type]);
-        bytes_remaining_ = packet_length;
-        state_ = HCI_PAYLOAD;
-        bytes_read_ = 0;
-      }
-      break;
-    }
-
-    case HCI_PAYLOAD: {
-      ssize_t bytes_read = TEMP_FAILURE_RETRY(read(
-          fd,
-          packet_.data() + preamble_size_for_type[packet_type] + bytes_read_,
-          bytes_remaining_));
-      if (bytes_read == 0) {
-        // This is only expected if the UART got closed when shutting down.
-        ALOGE("%s: Unexpected EOF reading the payload!", __func__);
-        sleep(5);  // Expect to be shut down within 5 seconds.
-        return;
-      }
-      if (bytes_read < 0) {
-        LOG_ALWAYS_FATAL("%s: Read payload error: %s", __func__,
-                         strerror(errno));
-      }
-      bytes_remaining_ -= bytes_read;
-      bytes_read_ += bytes_read;
-      if (bytes_remaining_ == 0) {
-        packet_ready_cb_();
-        state_ = HCI_PREAMBLE;
-        bytes_read_ = 0;
-      }
-      break;
-    }
+uint8_t* HciPacketizer::TakePacketBuffer() {
+  uint8_t* buffer = packet_buffer_;
+  packet_buffer_ = nullptr;
+  packet_.setToExternal(nullptr, 0);
+  return buffer;
+}
+
+void HciPacketizer::ReleasePacket() {
+  packet_.setToExternal(nullptr, 0);
+  HciBufferPool::Get().Free(packet_buffer_);
+  packet_buffer_ = nullptr;
+}
+
+size_t HciPacketizer::OnDataReady(const uint8_t* data, size_t length,
+                                 HciPacketType packet_type) {
+  size_t preamble_size = preamble_size_for_type[packet_type];
+  size_t consumed = 0;
+
+  if (state_ == HCI_PREAMBLE) {
+    size_t bytes_to_copy = std::min(length, preamble_size - bytes_read_);
+    memcpy(preamble_ + bytes_read_, data, bytes_to_copy);
+    bytes_read_ += bytes_to_copy;
+    consumed += bytes_to_copy;
+    if (bytes_read_ < preamble_size) return consumed;
+
+    size_t packet_length = HciGetPacketLengthForType(packet_type, preamble_);
+    packet_buffer_ = static_cast<uint8_t*>(HciBufferPool::Get().Allocate(
+        HCI_PACKET_HEADROOM + preamble_size + packet_length));
+    memcpy(packet_buffer_ + HCI_PACKET_HEADROOM, preamble_, preamble_size);
+    packet_.setToExternal(packet_buffer_ + HCI_PACKET_HEADROOM,
+                          preamble_size + packet_length);
+    bytes_remaining_ = packet_length;
+    state_ = HCI_PAYLOAD;
+    bytes_read_ = 0;
+  }
+
+  size_t bytes_to_copy = std::min(length - consumed, bytes_remaining_);
+  memcpy(packet_buffer_ + HCI_PACKET_HEADROOM + preamble_size + bytes_read_,
+         data + consumed, bytes_to_copy);
+  bytes_remaining_ -= bytes_to_copy;
+  bytes_read_ += bytes_to_copy;
+  consumed += bytes_to_copy;
+
+  if (bytes_remaining_ == 0) {
+    state_ = HCI_PREAMBLE;
+    bytes_read_ = 0;
+    HciTelemetry::Get().RecordRxPacket(packet_type, packet_.size());
+    packet_ready_cb_();
+    ReleasePacket();
+  }
+  return consumed;
+}
+
+void HciPacketizer::OnDataReady(HciRxBuffer& buffer,
+                                HciPacketType packet_type) {
+  while (buffer.Size() > 0) {
+    size_t length = 0;
+    const uint8_t* data = buffer.Front(&length);
+    buffer.Consume(OnDataReady(data, length, packet_type));
   }
 }
 
@@ -21,6 +21,7 @@
 #include <hidl/HidlSupport.h>
 
 #include "hci_internals.h"
+#include "hci_rx_buffer.h"
 
 namespace android {
 namespace hardware {
@@ -34,17 +35,35 @@ class HciPacketizer {
  public:
   HciPacketizer(HciPacketReadyCallback packet_cb)
       : packet_ready_cb_(packet_cb){};
-  void OnDataReady(int fd, HciPacketType packet_type);
+  ~HciPacketizer();
+  // Consumes bytes of at most one packet and calls the packet ready callback
+  // when it is complete. The packet is only valid during the callback, its
+  // buffer goes back to the pool afterwards. Returns the number of bytes
+  // consumed.
+  size_t OnDataReady(const uint8_t* data, size_t length,
+                     HciPacketType packet_type);
+  // Parses every complete packet in the buffer, a partial one is kept in the
+  // packetizer until the rest of it is read.
+  void OnDataReady(HciRxBuffer& buffer, HciPacketType packet_type);
   const hidl_vec<uint8_t>& GetPacket() const;
+  // Moves the pool buffer of the packet to the caller during the packet
+  // ready callback, it then has to be returned with HciBufferPool::Free().
+  uint8_t* TakePacketBuffer();
 
  protected:
   enum State { HCI_PREAMBLE, HCI_PAYLOAD };
   State state_{HCI_PREAMBLE};
   uint8_t preamble_[HCI_PREAMBLE_SIZE_MAX];
+  // Pool buffer the packet is reassembled in, packet_ points to it after
+  // HCI_PACKET_HEADROOM bytes.
+  uint8_t* packet_buffer_{nullptr};
   hidl_vec<uint8_t> packet_;
   size_t bytes_remaining_{0};
   size_t bytes_read_{0};
   HciPacketReadyCallback packet_ready_cb_;
+
+ private:
+  void ReleasePacket();
 };
 
 }  // namespace hci
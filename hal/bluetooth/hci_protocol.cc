@@ -23,33 +23,31 @@
 #include <log/log.h>
 #include <unistd.h>
 
+#include "hci_telemetry.h"
+
 namespace android {
 namespace hardware {
 namespace bluetooth {
 namespace hci {
 
-size_t HciProtocol::WriteSafely(int fd, const uint8_t* data, size_t length) {
-  size_t transmitted_length = 0;
-  while (length > 0) {
-    ssize_t ret =
-        TEMP_FAILURE_RETRY(write(fd, data + transmitted_length, length));
-
-    if (ret == -1) {
-      if (errno == EAGAIN) continue;
-      ALOGE("%s error writing to UART (%s)", __func__, strerror(errno));
-      break;
-
-    } else if (ret == 0) {
-      // Nothing written :(
-      ALOGE("%s zero bytes written - something went wrong...", __func__);
-      break;
+bool HciProtocol::ReadSafely(int fd, HciRxBuffer& buffer) {
+  ssize_t bytes_read = buffer.ReadFrom(fd);
+  if (bytes_read < 0 && errno == EAGAIN) return false;
+  if (bytes_read <= 0) {
+    if (!transport_failed_) {
+      if (bytes_read == 0) {
+        ALOGE("%s: Unexpected EOF reading from UART!", __func__);
+      } else {
+        ALOGE("%s: Read error: %s", __func__, strerror(errno));
+      }
+      HciTelemetry::Get().RecordTransportError();
+      transport_failed_ = true;
     }
-
-    transmitted_length += ret;
-    length -= ret;
+    if (transport_error_cb_) transport_error_cb_(fd);
+    return false;
   }
-
-  return transmitted_length;
+  HciTelemetry::Get().RecordUartRead(bytes_read);
+  return true;
 }
 
 }  // namespace hci
@@ -21,6 +21,7 @@
 #include "bt_vendor_lib.h"
 #include "hci_internals.h"
 #include "hci_packetizer.h"
+#include "hci_rx_buffer.h"
 
 namespace android {
 namespace hardware {
@@ -29,6 +30,10 @@ namespace hci {
 
 using ::android::hardware::hidl_vec;
 using PacketReadCallback = std::function<void(const hidl_vec<uint8_t>&)>;
+using TransportErrorCallback = std::function<void(int fd)>;
+// Called with true when the stack fell behind and the transport has to stop
+// reading its fds, with false once it caught up.
+using RxFlowCallback = std::function<void(bool stop_reading)>;
 
 // Implementation of HCI protocol bits common to different transports
 class HciProtocol {
@@ -39,8 +44,20 @@ class HciProtocol {
   // Protocol-specific implementation of sending packets.
   virtual size_t Send(uint8_t type, const uint8_t* data, size_t length) = 0;
 
+  // Called on the reading thread for every read of a fd which hit EOF or an
+  // error, the owner has to stop reading it and reset the transport.
+  void SetTransportErrorCallback(TransportErrorCallback callback) {
+    transport_error_cb_ = callback;
+  }
+
  protected:
-  static size_t WriteSafely(int fd, const uint8_t* data, size_t length);
+  // Reads whatever is available on the fd into the buffer. Returns false if
+  // nothing was read.
+  bool ReadSafely(int fd, HciRxBuffer& buffer);
+
+ private:
+  TransportErrorCallback transport_error_cb_;
+  bool transport_failed_{false};
 };
 
 }  // namespace hci
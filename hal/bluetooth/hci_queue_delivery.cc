@@ -0,0 +1,136 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_queue_delivery.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <log/log.h>
+
+#include <vendor/renesas/hardware/bluetooth/1.0/types.h>
+
+namespace {
+
+using ::vendor::renesas::hardware::bluetooth::V1_0::QueueFlag;
+
+// Room for about 60 maximum size ACL packets.
+const size_t QUEUE_SIZE = 64 * 1024;
+
+// Packet type and 2 bytes length in front of every packet.
+const size_t RECORD_HEADER_SIZE = 3;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciQueueDelivery& HciQueueDelivery::Get() {
+  static HciQueueDelivery delivery;
+  return delivery;
+}
+
+const MQDescriptorSync<uint8_t>* HciQueueDelivery::Enable() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  DestroyLocked();
+
+  queue_.reset(new DataQueue(QUEUE_SIZE, true /* configureEventFlagWord */));
+  if (!queue_->isValid() ||
+      EventFlag::createEventFlag(queue_->getEventFlagWord(), &event_flag_) !=
+          OK) {
+    ALOGE("%s: unable to create the receive queue", __func__);
+    DestroyLocked();
+    return nullptr;
+  }
+
+  ALOGI("%s: ACL and SCO go through a %zu byte queue", __func__, QUEUE_SIZE);
+  enabled_ = true;
+  return queue_->getDesc();
+}
+
+void HciQueueDelivery::Disable() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  DestroyLocked();
+}
+
+void HciQueueDelivery::DestroyLocked() {
+  enabled_ = false;
+  if (event_flag_ != nullptr) {
+    EventFlag::deleteEventFlag(&event_flag_);
+    event_flag_ = nullptr;
+  }
+  queue_.reset();
+  unsignalled_ = 0;
+}
+
+HciQueueDelivery::DeliveryResult HciQueueDelivery::Deliver(
+    HciPacketType type, const hidl_vec<uint8_t>& packet) {
+  if (!enabled_) return NOT_QUEUED;
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (queue_ == nullptr) return NOT_QUEUED;
+
+  size_t length = RECORD_HEADER_SIZE + packet.size();
+  if (queue_->availableToWrite() < length) {
+    // The reader may be waiting for the records already written.
+    FlushLocked();
+    return QUEUE_FULL;
+  }
+
+  // One transaction, the reader never sees a partial record.
+  DataQueue::MemTransaction transaction;
+  if (!queue_->beginWrite(length, &transaction)) return QUEUE_FULL;
+  uint8_t header[RECORD_HEADER_SIZE] = {
+      static_cast<uint8_t>(type), static_cast<uint8_t>(packet.size() & 0xFF),
+      static_cast<uint8_t>(packet.size() >> 8)};
+  transaction.copyTo(header, 0, RECORD_HEADER_SIZE);
+  transaction.copyTo(packet.data(), RECORD_HEADER_SIZE, packet.size());
+  queue_->commitWrite(length);
+  unsignalled_++;
+  return QUEUED;
+}
+
+void HciQueueDelivery::WaitForSpace(size_t packet_size,
+                                    std::chrono::milliseconds timeout) {
+  // Disable() waits for at most the timeout.
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (queue_ == nullptr ||
+      queue_->availableToWrite() >= RECORD_HEADER_SIZE + packet_size) {
+    return;
+  }
+  uint32_t state = 0;
+  event_flag_->wait(
+      static_cast<uint32_t>(QueueFlag::SPACE_READY), &state,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+}
+
+void HciQueueDelivery::Flush() {
+  if (!enabled_) return;
+  std::unique_lock<std::mutex> guard(mutex_);
+  FlushLocked();
+}
+
+void HciQueueDelivery::FlushLocked() {
+  if (unsignalled_ == 0 || event_flag_ == nullptr) return;
+  event_flag_->wake(static_cast<uint32_t>(QueueFlag::DATA_READY));
+  unsignalled_ = 0;
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
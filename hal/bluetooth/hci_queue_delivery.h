@@ -0,0 +1,84 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include <fmq/EventFlag.h>
+#include <fmq/MessageQueue.h>
+#include <hidl/HidlSupport.h>
+
+#include "hci_data_sink.h"
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::MQDescriptorSync;
+
+// Optional delivery of received ACL and SCO packets through a shared memory
+// queue, enabled by a stack using IBluetoothHciQueue. Records are written as
+// the packets are dispatched and the reader is woken once per batch through
+// the EventFlag of the queue, instead of one binder transaction per packet.
+// A full queue is reported to the caller, which keeps the packet and stops
+// reading the transport rather than blocking here.
+class HciQueueDelivery : public HciDataSink {
+ public:
+  static HciQueueDelivery& Get();
+
+  // Creates the queue, nullptr if that failed.
+  const MQDescriptorSync<uint8_t>* Enable();
+  void Disable();
+
+  // NOT_QUEUED while the queue is not enabled.
+  DeliveryResult Deliver(HciPacketType type,
+                         const hidl_vec<uint8_t>& packet) override;
+  void WaitForSpace(size_t packet_size,
+                    std::chrono::milliseconds timeout) override;
+  void Flush() override;
+
+ private:
+  using DataQueue = MessageQueue<uint8_t, kSynchronizedReadWrite>;
+
+  HciQueueDelivery() = default;
+  HciQueueDelivery(const HciQueueDelivery&) = delete;
+  HciQueueDelivery& operator=(const HciQueueDelivery&) = delete;
+
+  void DestroyLocked();
+  void FlushLocked();
+
+  std::atomic<bool> enabled_{false};
+  std::mutex mutex_;
+  std::unique_ptr<DataQueue> queue_;
+  EventFlag* event_flag_{nullptr};
+  size_t unsignalled_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
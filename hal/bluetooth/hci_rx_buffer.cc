@@ -0,0 +1,84 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_rx_buffer.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <log/log.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciRxBuffer::HciRxBuffer(size_t capacity) : data_(capacity) {}
+
+ssize_t HciRxBuffer::ReadFrom(int fd) {
+  size_t capacity = data_.size();
+  size_t free_space = FreeSpace();
+  if (free_space == 0) {
+    ALOGE("%s: RX buffer is full", __func__);
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  // The free space may wrap around the end of the buffer.
+  size_t tail = (head_ + size_) % capacity;
+  size_t first_length = std::min(free_space, capacity - tail);
+  struct iovec iov[] = {{data_.data() + tail, first_length},
+                        {data_.data(), free_space - first_length}};
+  int iov_count = (first_length == free_space) ? 1 : 2;
+
+  ssize_t bytes_read = TEMP_FAILURE_RETRY(readv(fd, iov, iov_count));
+  if (bytes_read > 0) {
+    size_ += bytes_read;
+    read_time_ = std::chrono::steady_clock::now();
+  }
+  return bytes_read;
+}
+
+const uint8_t* HciRxBuffer::Front(size_t* length) const {
+  *length = std::min(size_, data_.size() - head_);
+  return data_.data() + head_;
+}
+
+bool HciRxBuffer::Peek(uint8_t* data, size_t length) const {
+  if (length > size_) return false;
+  for (size_t i = 0; i < length; i++) {
+    data[i] = data_[(head_ + i) % data_.size()];
+  }
+  return true;
+}
+
+void HciRxBuffer::Consume(size_t length) {
+  length = std::min(length, size_);
+  head_ = (head_ + length) % data_.size();
+  size_ -= length;
+
+  // Keep the next read contiguous when everything has been parsed.
+  if (size_ == 0) head_ = 0;
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,68 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <chrono>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Ring buffer the UART is drained into. Data is read with a single large
+// read() per wakeup and then parsed from memory, so that several HCI packets
+// cost one syscall instead of three per packet.
+class HciRxBuffer {
+ public:
+  static const size_t kDefaultCapacity = 4096;
+
+  explicit HciRxBuffer(size_t capacity = kDefaultCapacity);
+
+  // Reads as much as fits into the free space. Returns the number of bytes
+  // read, 0 on EOF or -1 on error with errno set.
+  ssize_t ReadFrom(int fd);
+
+  // Returns the contiguous readable bytes at the head of the buffer.
+  const uint8_t* Front(size_t* length) const;
+  // Copies the first length bytes, which may wrap around, without consuming
+  // them. Returns false if fewer are buffered.
+  bool Peek(uint8_t* data, size_t length) const;
+  void Consume(size_t length);
+
+  size_t Size() const { return size_; }
+  size_t FreeSpace() const { return data_.size() - size_; }
+
+  // When the last successful read returned.
+  std::chrono::steady_clock::time_point GetReadTime() const {
+    return read_time_;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  size_t head_{0};
+  size_t size_{0};
+  std::chrono::steady_clock::time_point read_time_;
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
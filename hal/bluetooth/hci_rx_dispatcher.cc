@@ -0,0 +1,218 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_rx_dispatcher.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <log/log.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hci_buffer_pool.h"
+#include "hci_data_sink.h"
+#include "hci_telemetry.h"
+
+namespace {
+
+// Depth at which the transport stops being read, by type.
+const size_t stop_depth_for_type[] = {0, 0, HCI_RX_ACL_STOP_DEPTH, 0,
+                                      HCI_RX_EVENT_STOP_DEPTH};
+
+// How long the delivery thread waits at a time for the stack to make room in
+// the shared memory queue.
+const std::chrono::milliseconds QUEUE_SPACE_WAIT(20);
+
+const int BT_RT_PRIORITY = 1;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciRxDispatcher::HciRxDispatcher(PacketReadCallback event_cb,
+                                 PacketReadCallback acl_cb,
+                                 PacketReadCallback sco_cb) {
+  callbacks_[HCI_PACKET_TYPE_EVENT] = event_cb;
+  callbacks_[HCI_PACKET_TYPE_ACL_DATA] = acl_cb;
+  callbacks_[HCI_PACKET_TYPE_SCO_DATA] = sco_cb;
+  delivery_thread_ = std::thread([this]() { DeliveryRoutine(); });
+}
+
+HciRxDispatcher::~HciRxDispatcher() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (delivery_thread_.joinable()) delivery_thread_.join();
+
+  // The stack is gone when the HAL is closed, nothing to deliver to.
+  for (const RxPacket& packet : queue_) {
+    HciBufferPool::Get().Free(packet.buffer);
+  }
+}
+
+void HciRxDispatcher::Dispatch(HciPacketType type, uint8_t* buffer,
+                               size_t length, Clock::time_point read_time) {
+  if (type >= PACKET_TYPES || !callbacks_[type]) {
+    ALOGE("%s: No callback for packet type %d", __func__, type);
+    HciBufferPool::Get().Free(buffer);
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (type != HCI_PACKET_TYPE_SCO_DATA ||
+        depth_[type] < HCI_RX_MAX_SCO_DEPTH) {
+      depth_[type]++;
+      queue_.push_back({type, buffer, length, read_time});
+      buffer = nullptr;
+
+      if (stop_depth_for_type[type] != 0 &&
+          depth_[type] >= stop_depth_for_type[type]) {
+        StopReadingLocked(type);
+      }
+    }
+  }
+
+  if (buffer != nullptr) {
+    dropped_count_++;
+    HciTelemetry::Get().RecordRxDropped(type);
+    ALOGE("%s: RX queue for SCO is full, dropping %zu bytes", __func__,
+          length);
+    HciBufferPool::Get().Free(buffer);
+    return;
+  }
+  cv_.notify_one();
+}
+
+void HciRxDispatcher::StopReadingLocked(HciPacketType type) {
+  if (reading_stopped_ || !flow_cb_) return;
+  ALOGW("%s: stack is %zu packets of type %d behind, pausing RX", __func__,
+        depth_[type], type);
+  HciTelemetry::Get().RecordRxFlowStop();
+  reading_stopped_ = true;
+  flow_cb_(true);
+}
+
+void HciRxDispatcher::ResumeReadingLocked() {
+  if (!reading_stopped_ || !CaughtUpLocked()) return;
+  reading_stopped_ = false;
+  flow_cb_(false);
+}
+
+bool HciRxDispatcher::CaughtUpLocked() const {
+  for (size_t type = 0; type < PACKET_TYPES; type++) {
+    if (stop_depth_for_type[type] != 0 &&
+        depth_[type] > stop_depth_for_type[type] / 2) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void HciRxDispatcher::DeliveryRoutine() {
+  struct sched_param rt_params;
+  rt_params.sched_priority = BT_RT_PRIORITY;
+  if (sched_setscheduler(gettid(), SCHED_FIFO, &rt_params)) {
+    ALOGE("%s unable to set SCHED_FIFO for pid %d, tid %d, error %s", __func__,
+          getpid(), gettid(), strerror(errno));
+  }
+
+  HciDataSink* data_sink = HciDataSink::Get();
+  hidl_vec<uint8_t> packet;
+  while (true) {
+    RxPacket rx_packet;
+    bool idle;
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      cv_.wait(guard, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) break;
+      rx_packet = queue_.front();
+      queue_.pop_front();
+      depth_[rx_packet.type]--;
+      idle = queue_.empty();
+
+      ResumeReadingLocked();
+    }
+
+    packet.setToExternal(rx_packet.buffer + HCI_PACKET_HEADROOM,
+                         rx_packet.length);
+    if (rx_packet.type == HCI_PACKET_TYPE_EVENT) {
+      // Data queued before the event has to reach the stack first.
+      if (data_sink != nullptr) data_sink->Flush();
+      callbacks_[rx_packet.type](packet);
+    } else {
+      DeliverData(rx_packet.type, packet);
+    }
+    packet.setToExternal(nullptr, 0);
+    HciBufferPool::Get().Free(rx_packet.buffer);
+
+    HciTelemetry::Get().RecordRxLatency(rx_packet.read_time);
+    if (idle && data_sink != nullptr) data_sink->Flush();
+  }
+}
+
+void HciRxDispatcher::DeliverData(HciPacketType type,
+                                  const hidl_vec<uint8_t>& packet) {
+  HciDataSink* data_sink = HciDataSink::Get();
+  bool waited = false;
+  while (true) {
+    HciDataSink::DeliveryResult result =
+        data_sink != nullptr ? data_sink->Deliver(type, packet)
+                             : HciDataSink::NOT_QUEUED;
+    if (result == HciDataSink::QUEUED) {
+      // Nothing more may be read meanwhile, the queue can be empty.
+      if (waited) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        ResumeReadingLocked();
+      }
+      return;
+    }
+    if (result == HciDataSink::NOT_QUEUED) {
+      callbacks_[type](packet);
+      return;
+    }
+
+    if (type == HCI_PACKET_TYPE_SCO_DATA) {
+      dropped_count_++;
+      HciTelemetry::Get().RecordRxDropped(type);
+      ALOGE("%s: receive queue is full, dropping %zu bytes of SCO", __func__,
+            packet.size());
+      return;
+    }
+
+    // The stack is behind on the shared memory queue, hold the controller
+    // until it makes room.
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      if (stopping_) return;
+      StopReadingLocked(type);
+    }
+    waited = true;
+    data_sink->WaitForSpace(packet.size(), QUEUE_SPACE_WAIT);
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,105 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "hci_internals.h"
+#include "hci_protocol.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Hands received packets from the UART RX thread to a delivery thread which
+// runs the stack callbacks, so a slow binder call never stops the UART from
+// being drained. Packets keep their arrival order across types.
+//
+// Events and ACL data are never dropped. When the stack falls that far
+// behind the flow callback stops the reading of the transport, RTS/CTS then
+// holds the controller, until the delivery thread drained the queue to half
+// of that depth. Reading is stopped as well while the HciDataSink installed
+// by the service is full. Only SCO has a bounded depth, late audio is
+// dropped and counted.
+class HciRxDispatcher {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  HciRxDispatcher(PacketReadCallback event_cb, PacketReadCallback acl_cb,
+                  PacketReadCallback sco_cb);
+  ~HciRxDispatcher();
+
+  // Takes ownership of a buffer from HciBufferPool, the packet starts
+  // HCI_PACKET_HEADROOM bytes into it. read_time is when the UART read which
+  // completed the packet returned.
+  void Dispatch(HciPacketType type, uint8_t* buffer, size_t length,
+                Clock::time_point read_time);
+
+  // Has to be set before the first packet, the callback runs under the lock
+  // of the dispatcher on the RX and on the delivery thread.
+  void SetFlowCallback(RxFlowCallback callback) { flow_cb_ = callback; }
+
+  uint64_t GetDroppedCount() const { return dropped_count_.load(); }
+
+ private:
+  static const size_t PACKET_TYPES = HCI_PACKET_TYPE_EVENT + 1;
+
+  struct RxPacket {
+    HciPacketType type;
+    uint8_t* buffer;
+    size_t length;
+    Clock::time_point read_time;
+  };
+
+  HciRxDispatcher(const HciRxDispatcher&) = delete;
+  HciRxDispatcher& operator=(const HciRxDispatcher&) = delete;
+
+  void DeliveryRoutine();
+  // Delivers ACL or SCO through the HciDataSink if it takes them, through the
+  // callback otherwise.
+  void DeliverData(HciPacketType type, const hidl_vec<uint8_t>& packet);
+  void StopReadingLocked(HciPacketType type);
+  void ResumeReadingLocked();
+  bool CaughtUpLocked() const;
+
+  PacketReadCallback callbacks_[PACKET_TYPES];
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<RxPacket> queue_;
+  size_t depth_[PACKET_TYPES] = {};
+  RxFlowCallback flow_cb_;
+  bool reading_stopped_{false};
+  bool stopping_{false};
+  std::thread delivery_thread_;
+
+  std::atomic<uint64_t> dropped_count_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
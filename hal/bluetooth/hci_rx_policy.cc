@@ -0,0 +1,110 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_rx_policy.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <cutils/properties.h>
+#include <log/log.h>
+
+#include <algorithm>
+
+#include "hci_telemetry.h"
+
+namespace {
+
+const char* RX_COALESCING_PROPERTY = "vendor.bluetooth.rx_coalescing";
+
+const std::chrono::milliseconds WINDOW(100);
+
+// A stream this fast with no urgent packets in a window is bulk traffic,
+// about an A2DP sink or a file transfer.
+const uint64_t BULK_ACL_RATE = 64 * 1024;
+
+// Reads are held back until about that much is expected to be buffered,
+// never longer than MAX_DELAY.
+const size_t TARGET_READ_SIZE = 2048;
+const std::chrono::microseconds MAX_DELAY(2000);
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciRxPolicy::HciRxPolicy()
+    : enabled_(property_get_bool(RX_COALESCING_PROPERTY, true)),
+      window_start_(Clock::now()) {}
+
+void HciRxPolicy::OnRead(size_t bytes) {
+  read_done_ = true;
+  read_bytes_ += bytes;
+}
+
+void HciRxPolicy::OnPacket(HciPacketType type, size_t length) {
+  if (type == HCI_PACKET_TYPE_ACL_DATA) {
+    window_acl_bytes_ += length;
+    return;
+  }
+  // Events and SCO are latency sensitive.
+  window_urgent_packets_++;
+  read_urgent_ = true;
+}
+
+void HciRxPolicy::UpdateWindow(Clock::time_point now) {
+  auto elapsed = now - window_start_;
+  if (elapsed < WINDOW) return;
+
+  auto elapsed_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  acl_rate_ = window_acl_bytes_ * 1000000 / elapsed_us;
+  bool bulk = acl_rate_ >= BULK_ACL_RATE && window_urgent_packets_ == 0;
+  if (bulk != bulk_) {
+    ALOGV("%s: %s reads, ACL at %llu bytes/s", __func__,
+          bulk ? "coalescing" : "immediate",
+          static_cast<unsigned long long>(acl_rate_));
+    bulk_ = bulk;
+  }
+
+  window_start_ = now;
+  window_acl_bytes_ = 0;
+  window_urgent_packets_ = 0;
+}
+
+std::chrono::microseconds HciRxPolicy::NextReadDelay() {
+  std::chrono::microseconds delay(0);
+  if (!enabled_ || !read_done_) return delay;
+
+  UpdateWindow(Clock::now());
+  if (bulk_ && !read_urgent_ && read_bytes_ < TARGET_READ_SIZE) {
+    delay = std::chrono::microseconds(
+        (TARGET_READ_SIZE - read_bytes_) * 1000000 / acl_rate_);
+    delay = std::min(delay, MAX_DELAY);
+    HciTelemetry::Get().RecordRxCoalescedRead();
+  }
+
+  read_done_ = false;
+  read_bytes_ = 0;
+  read_urgent_ = false;
+  return delay;
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
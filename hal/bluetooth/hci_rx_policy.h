@@ -0,0 +1,69 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Chooses how soon a UART is read again from the traffic of the last
+// window. During a sustained ACL stream without SCO a short read is followed
+// by a delay so that the next wakeup finds a fuller buffer, trading a
+// little latency for fewer wakeups. As soon as events or SCO show up, reads
+// are immediate again. Only used from the fd watcher thread.
+class HciRxPolicy {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  HciRxPolicy();
+
+  void OnRead(size_t bytes);
+  void OnPacket(HciPacketType type, size_t length);
+
+  // Delay before the next read of the UART, zero to read it right away.
+  std::chrono::microseconds NextReadDelay();
+
+ private:
+  void UpdateWindow(Clock::time_point now);
+
+  bool enabled_;
+  bool bulk_{false};
+  // ACL bytes per second of the last window.
+  uint64_t acl_rate_{0};
+
+  Clock::time_point window_start_;
+  uint64_t window_acl_bytes_{0};
+  uint64_t window_urgent_packets_{0};
+
+  // Since the last NextReadDelay().
+  bool read_done_{false};
+  size_t read_bytes_{0};
+  bool read_urgent_{false};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,231 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_sco_pacer.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <log/log.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "hci_internals.h"
+#include "hci_telemetry.h"
+
+namespace {
+
+// Air modes of the (e)SCO Connection Complete event
+const uint8_t AIR_MODE_CVSD = 0x02;
+const uint8_t AIR_MODE_TRANSPARENT = 0x03;
+
+// 8 kHz 16 bit PCM, and 64 kbit/s for transparent data (mSBC).
+const uint32_t CVSD_BYTE_RATE = 16000;
+const uint32_t TRANSPARENT_BYTE_RATE = 8000;
+
+const uint32_t SLOT_US = 625;
+// The host sends 16 bit PCM for every 8 bit CVSD sample on the air.
+const uint32_t CVSD_HOST_BYTES_PER_AIR_BYTE = 2;
+
+const std::chrono::milliseconds MAX_LATENCY(60);
+const size_t MIN_QUEUE_PACKETS = 4;
+
+// Ticks without data after which the stream is considered stopped.
+const int MAX_UNDERRUNS = 4;
+
+const int BT_RT_PRIORITY = 1;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciScoPacer::HciScoPacer(SendFunction send)
+    : send_(send), byte_rate_(CVSD_BYTE_RATE) {
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (timer_fd_ == -1 || stop_fd_ == -1) {
+    ALOGE("%s unable to create descriptors: %s", __func__, strerror(errno));
+    return;
+  }
+  timer_thread_ = std::thread([this]() { TimerRoutine(); });
+}
+
+HciScoPacer::~HciScoPacer() {
+  if (stop_fd_ != -1) {
+    uint64_t value = 1;
+    TEMP_FAILURE_RETRY(write(stop_fd_, &value, sizeof(value)));
+  }
+  if (timer_thread_.joinable()) timer_thread_.join();
+  if (timer_fd_ != -1) close(timer_fd_);
+  if (stop_fd_ != -1) close(stop_fd_);
+}
+
+void HciScoPacer::OnScoConnected(uint8_t air_mode, uint8_t interval_slots,
+                                 uint16_t tx_packet_length) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  pcm_ = air_mode == AIR_MODE_CVSD;
+  if (interval_slots != 0 && tx_packet_length != 0) {
+    byte_rate_ = tx_packet_length * 1000000ULL / (interval_slots * SLOT_US);
+    if (pcm_) byte_rate_ *= CVSD_HOST_BYTES_PER_AIR_BYTE;
+  } else {
+    byte_rate_ = air_mode == AIR_MODE_TRANSPARENT ? TRANSPARENT_BYTE_RATE
+                                                  : CVSD_BYTE_RATE;
+  }
+  ALOGD("%s: air mode %d, %u bytes per second", __func__, air_mode,
+        byte_rate_);
+  StopLocked();
+}
+
+void HciScoPacer::Send(const uint8_t* data, size_t length) {
+  if (length <= HCI_SCO_PREAMBLE_SIZE || timer_fd_ == -1) {
+    send_(data, length);
+    return;
+  }
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  Clock::time_point now = Clock::now();
+  if (running_) {
+    // Deviation of the arrival from the audio clock.
+    auto interval = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - last_arrival_);
+    HciTelemetry::Get().RecordScoJitter(
+        std::abs((interval - period_).count()));
+  } else if (!StartLocked(length - HCI_SCO_PREAMBLE_SIZE)) {
+    guard.unlock();
+    send_(data, length);
+    return;
+  }
+  last_arrival_ = now;
+
+  if (queue_.size() >= max_queue_) {
+    HciTelemetry::Get().RecordScoOverflow();
+    queue_.pop_front();
+  }
+  queue_.emplace_back(data, data + length);
+}
+
+bool HciScoPacer::StartLocked(size_t payload_length) {
+  period_ = std::chrono::microseconds(payload_length * 1000000ULL / byte_rate_);
+  if (period_.count() == 0) return false;
+
+  max_queue_ = std::max<size_t>(MAX_LATENCY / period_, MIN_QUEUE_PACKETS);
+  underruns_ = 0;
+
+  // The first tick leaves one packet of headroom for jitter.
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = period_.count() / 1000000;
+  spec.it_value.tv_nsec = (period_.count() % 1000000) * 1000;
+  spec.it_interval = spec.it_value;
+  if (timerfd_settime(timer_fd_, 0, &spec, nullptr)) {
+    ALOGE("%s unable to arm the timer: %s", __func__, strerror(errno));
+    return false;
+  }
+  running_ = true;
+  ALOGD("%s: pacing SCO every %lld us", __func__,
+        static_cast<long long>(period_.count()));
+  return true;
+}
+
+void HciScoPacer::StopLocked() {
+  struct itimerspec spec = {};
+  timerfd_settime(timer_fd_, 0, &spec, nullptr);
+  running_ = false;
+  queue_.clear();
+  last_packet_.clear();
+}
+
+void HciScoPacer::ConcealLocked(std::vector<uint8_t>* packet) {
+  // Halve 16 bit little endian samples, repeated packets fade out.
+  for (size_t i = HCI_SCO_PREAMBLE_SIZE; i + 1 < packet->size(); i += 2) {
+    int16_t sample = (*packet)[i] | ((*packet)[i + 1] << 8);
+    sample /= 2;
+    (*packet)[i] = sample & 0xFF;
+    (*packet)[i + 1] = (sample >> 8) & 0xFF;
+  }
+}
+
+void HciScoPacer::OnTick() {
+  uint64_t expirations = 0;
+  if (TEMP_FAILURE_RETRY(
+          read(timer_fd_, &expirations, sizeof(expirations))) < 0) {
+    return;
+  }
+
+  std::vector<std::vector<uint8_t>> packets;
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (!running_) return;
+    if (expirations > 1) {
+      HciTelemetry::Get().RecordScoLateTicks(expirations - 1);
+    }
+
+    if (queue_.empty()) {
+      HciTelemetry::Get().RecordScoUnderrun();
+      if (++underruns_ > MAX_UNDERRUNS) {
+        StopLocked();
+        return;
+      }
+      // Transparent data can not be altered, the controller conceals it.
+      if (!pcm_ || last_packet_.empty()) return;
+      ConcealLocked(&last_packet_);
+      packets.push_back(last_packet_);
+    } else {
+      // Catch up on the ticks this thread was late for, the controller
+      // buffers what it can not send yet.
+      underruns_ = 0;
+      size_t count = std::min<size_t>(expirations, queue_.size());
+      for (size_t i = 0; i < count; i++) {
+        packets.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+      last_packet_ = packets.back();
+    }
+  }
+
+  // The UART write can block, Send() must not wait for it.
+  for (const auto& packet : packets) send_(packet.data(), packet.size());
+}
+
+void HciScoPacer::TimerRoutine() {
+  struct sched_param rt_params;
+  rt_params.sched_priority = BT_RT_PRIORITY;
+  if (sched_setscheduler(gettid(), SCHED_FIFO, &rt_params)) {
+    ALOGE("%s unable to set SCHED_FIFO for pid %d, tid %d, error %s", __func__,
+          getpid(), gettid(), strerror(errno));
+  }
+
+  struct pollfd fds[] = {{timer_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+  while (true) {
+    if (TEMP_FAILURE_RETRY(poll(fds, 2, -1)) < 0) continue;
+    if (fds[1].revents & POLLIN) break;
+    if (fds[0].revents & POLLIN) OnTick();
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,91 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Releases SCO packets to the controller at the rate of the audio instead of
+// the bursty rate binder delivers them at. The audio rate is the one the
+// link negotiated, the first packet of a stream starts a timerfd ticking
+// once per packet duration at that rate, every tick sends one
+// packet and a late tick one per expiration it covers. The queue holds at
+// most MAX_LATENCY of audio, the oldest packet is dropped beyond that. When
+// a tick finds the queue empty the previous CVSD packet is repeated with
+// fading volume, after a few such ticks the stream is considered stopped.
+class HciScoPacer {
+ public:
+  using SendFunction = std::function<void(const uint8_t* data, size_t length)>;
+
+  explicit HciScoPacer(SendFunction send);
+  ~HciScoPacer();
+
+  // Takes the air mode, transmission interval in slots and TX packet length
+  // of a (e)SCO Connection Complete event. Without an interval, on SCO links,
+  // the nominal rate of the air mode is used.
+  void OnScoConnected(uint8_t air_mode, uint8_t interval_slots,
+                      uint16_t tx_packet_length);
+
+  void Send(const uint8_t* data, size_t length);
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  HciScoPacer(const HciScoPacer&) = delete;
+  HciScoPacer& operator=(const HciScoPacer&) = delete;
+
+  bool StartLocked(size_t payload_length);
+  void StopLocked();
+  void ConcealLocked(std::vector<uint8_t>* packet);
+  void OnTick();
+  void TimerRoutine();
+
+  SendFunction send_;
+  int timer_fd_{-1};
+  int stop_fd_{-1};
+
+  std::mutex mutex_;
+  std::deque<std::vector<uint8_t>> queue_;
+  size_t max_queue_{0};
+  // Audio bytes per second of the link, 16 bit PCM for CVSD.
+  uint32_t byte_rate_;
+  bool pcm_{true};
+  bool running_{false};
+  std::chrono::microseconds period_{0};
+  std::vector<uint8_t> last_packet_;
+  int underruns_{0};
+  Clock::time_point last_arrival_;
+
+  std::thread timer_thread_;
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
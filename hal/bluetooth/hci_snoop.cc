@@ -0,0 +1,319 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_snoop.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+const char* SNOOP_PROPERTY = "vendor.bluetooth.snoop";
+const char* SNOOP_PATH_PROPERTY = "vendor.bluetooth.snoop_path";
+const char* SNOOP_SIZE_PROPERTY = "vendor.bluetooth.snoop_size_kb";
+const char* DEFAULT_SNOOP_PATH = "/data/vendor/bluetooth/btsnoop_hci.log";
+const int32_t DEFAULT_SNOOP_SIZE_KB = 8192;
+
+// Must be a power of two.
+const size_t RING_SIZE = 256;
+
+// While capturing the writer drains the ring at this period, and as soon as
+// it is half full. At A2DP rates a period is well below half the ring, bursts
+// of small packets wake the writer early instead of overrunning it.
+const std::chrono::milliseconds WRITER_PERIOD(20);
+const std::chrono::seconds PROPERTY_CHECK_PERIOD(1);
+
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// btsnoop format, datalink type 1002 is HCI UART (H4).
+const uint8_t BTSNOOP_HEADER[] = {'b', 't', 's', 'n', 'o', 'o', 'p', '\0',
+                                  0,   0,   0,   1,   0,   0,   0x03, 0xEA};
+const size_t BTSNOOP_RECORD_HEADER_SIZE = 24;
+const uint32_t BTSNOOP_FLAG_RECEIVED = 0x01;
+const uint32_t BTSNOOP_FLAG_COMMAND_EVENT = 0x02;
+
+// Microseconds between 0 AD and the unix epoch.
+const uint64_t BTSNOOP_EPOCH_DELTA = 0x00dcddb30f2f8000ULL;
+
+void PutBigEndian32(uint8_t* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+void PutBigEndian64(uint8_t* p, uint64_t value) {
+  PutBigEndian32(p, value >> 32);
+  PutBigEndian32(p + 4, value);
+}
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciSnoop& HciSnoop::Get() {
+  static HciSnoop snoop;
+  return snoop;
+}
+
+HciSnoop::HciSnoop() : ring_(new Record[RING_SIZE]) {
+  for (size_t i = 0; i < RING_SIZE; i++) {
+    ring_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  char path[PROPERTY_VALUE_MAX];
+  property_get(SNOOP_PATH_PROPERTY, path, DEFAULT_SNOOP_PATH);
+  path_ = path;
+  file_size_ =
+      std::max(property_get_int32(SNOOP_SIZE_PROPERTY, DEFAULT_SNOOP_SIZE_KB),
+               64) * 1024;
+  enabled_ = property_get_bool(SNOOP_PROPERTY, false);
+  next_property_check_ns_ =
+      NowNs() + std::chrono::nanoseconds(PROPERTY_CHECK_PERIOD).count();
+
+  if (enabled_) writer_ = std::thread([this]() { WriterRoutine(); });
+}
+
+HciSnoop::~HciSnoop() {
+  {
+    std::unique_lock<std::mutex> guard(writer_mutex_);
+    stopping_ = true;
+    writer_cv_.notify_one();
+  }
+  if (writer_.joinable()) writer_.join();
+}
+
+void HciSnoop::CheckProperty() {
+  int64_t now = NowNs();
+  int64_t next = next_property_check_ns_.load(std::memory_order_relaxed);
+  if (now < next) return;
+  // Only one of the capturing threads reads it.
+  if (!next_property_check_ns_.compare_exchange_strong(
+          next,
+          now + std::chrono::nanoseconds(PROPERTY_CHECK_PERIOD).count())) {
+    return;
+  }
+
+  bool requested = property_get_bool(SNOOP_PROPERTY, false);
+  std::unique_lock<std::mutex> guard(writer_mutex_);
+  // After a failure wait for the property to be toggled to retry.
+  if (!requested) open_failed_ = false;
+  bool enable = requested && !open_failed_;
+  if (enable == enabled_) return;
+
+  enabled_ = enable;
+  if (enable && !writer_.joinable()) {
+    writer_ = std::thread([this]() { WriterRoutine(); });
+  }
+  writer_cv_.notify_one();
+}
+
+void HciSnoop::WakeWriter() {
+  std::unique_lock<std::mutex> guard(writer_mutex_);
+  drain_requested_ = true;
+  writer_cv_.notify_one();
+}
+
+void HciSnoop::Capture(HciPacketType type, bool incoming, const uint8_t* data,
+                       size_t length) {
+  CheckProperty();
+  if (!enabled_.load(std::memory_order_relaxed)) return;
+
+  // Claim a slot, see Vyukov's bounded MPMC queue.
+  size_t position = enqueue_position_.load(std::memory_order_relaxed);
+  Record* record;
+  while (true) {
+    record = &ring_[position & (RING_SIZE - 1)];
+    size_t sequence = record->sequence.load(std::memory_order_acquire);
+    intptr_t diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+    if (diff == 0) {
+      if (enqueue_position_.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      position = enqueue_position_.load(std::memory_order_relaxed);
+    }
+  }
+
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  record->timestamp_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+  record->length = length;
+  record->included_length = std::min(length, SNAP_LENGTH);
+  record->type = type;
+  record->incoming = incoming;
+  memcpy(record->data, data, record->included_length);
+  record->sequence.store(position + 1, std::memory_order_release);
+
+  if (position + 1 - dequeue_position_.load(std::memory_order_relaxed) ==
+      RING_SIZE / 2) {
+    WakeWriter();
+  }
+}
+
+bool HciSnoop::OpenLogFile() {
+  fd_ = TEMP_FAILURE_RETRY(
+      open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640));
+  if (fd_ == -1) {
+    ALOGE("%s unable to open %s: %s", __func__, path_.c_str(),
+          strerror(errno));
+    return false;
+  }
+
+  // Reserve the blocks up front so that writing never allocates.
+  int error = posix_fallocate(fd_, 0, file_size_);
+  if (error == 0) {
+    map_ = static_cast<uint8_t*>(
+        mmap(nullptr, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0));
+    if (map_ == MAP_FAILED) {
+      map_ = nullptr;
+      error = errno;
+    }
+  }
+  if (map_ == nullptr) {
+    ALOGE("%s unable to map %s: %s", __func__, path_.c_str(), strerror(error));
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  memcpy(map_, BTSNOOP_HEADER, sizeof(BTSNOOP_HEADER));
+  offset_ = sizeof(BTSNOOP_HEADER);
+  ALOGI("%s: capturing HCI to %s", __func__, path_.c_str());
+  return true;
+}
+
+void HciSnoop::CloseLogFile() {
+  if (fd_ == -1) return;
+
+  munmap(map_, file_size_);
+  map_ = nullptr;
+  // Drop the unused preallocated tail, readers stop at the end of file.
+  if (TEMP_FAILURE_RETRY(ftruncate(fd_, offset_)) == -1) {
+    ALOGE("%s unable to truncate %s: %s", __func__, path_.c_str(),
+          strerror(errno));
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+void HciSnoop::RotateLogFile() {
+  CloseLogFile();
+  std::string last_path = path_ + ".last";
+  if (rename(path_.c_str(), last_path.c_str()) == -1) {
+    ALOGE("%s unable to rename %s: %s", __func__, path_.c_str(),
+          strerror(errno));
+  }
+  OpenLogFile();
+}
+
+void HciSnoop::WriteRecord(const Record& record) {
+  size_t included_length = record.included_length + 1;  // H4 type byte
+  size_t record_size = BTSNOOP_RECORD_HEADER_SIZE + included_length;
+  if (offset_ + record_size > file_size_) {
+    RotateLogFile();
+    if (fd_ == -1) return;
+  }
+
+  uint32_t flags = record.incoming ? BTSNOOP_FLAG_RECEIVED : 0;
+  if (record.type == HCI_PACKET_TYPE_COMMAND ||
+      record.type == HCI_PACKET_TYPE_EVENT) {
+    flags |= BTSNOOP_FLAG_COMMAND_EVENT;
+  }
+
+  uint8_t* p = map_ + offset_;
+  PutBigEndian32(p, record.length + 1);
+  PutBigEndian32(p + 4, included_length);
+  PutBigEndian32(p + 8, flags);
+  PutBigEndian32(p + 12, dropped_count_.load(std::memory_order_relaxed));
+  PutBigEndian64(p + 16, record.timestamp_us + BTSNOOP_EPOCH_DELTA);
+  p[BTSNOOP_RECORD_HEADER_SIZE] = record.type;
+  memcpy(p + BTSNOOP_RECORD_HEADER_SIZE + 1, record.data,
+         record.included_length);
+  offset_ += record_size;
+}
+
+void HciSnoop::DrainRing() {
+  size_t position = dequeue_position_.load(std::memory_order_relaxed);
+  while (true) {
+    Record& record = ring_[position & (RING_SIZE - 1)];
+    size_t sequence = record.sequence.load(std::memory_order_acquire);
+    if (sequence != position + 1) break;
+
+    if (fd_ != -1) WriteRecord(record);
+    record.sequence.store(position + RING_SIZE, std::memory_order_release);
+    position++;
+    dequeue_position_.store(position, std::memory_order_relaxed);
+  }
+}
+
+void HciSnoop::WriterRoutine() {
+  std::unique_lock<std::mutex> guard(writer_mutex_);
+  while (!stopping_) {
+    if (enabled_) {
+      writer_cv_.wait_for(guard, WRITER_PERIOD, [this]() {
+        return stopping_ || drain_requested_ || !enabled_;
+      });
+    } else {
+      writer_cv_.wait(guard, [this]() { return stopping_ || enabled_; });
+    }
+    drain_requested_ = false;
+    bool enabled = enabled_;
+    guard.unlock();
+
+    if (enabled && fd_ == -1 && !OpenLogFile()) {
+      guard.lock();
+      open_failed_ = true;
+      enabled_ = false;
+      guard.unlock();
+      enabled = false;
+    }
+
+    // Drain everything, also what was captured just before disabling.
+    DrainRing();
+    if (!enabled) CloseLogFile();
+    guard.lock();
+  }
+  guard.unlock();
+  CloseLogFile();
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
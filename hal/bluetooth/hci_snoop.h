@@ -0,0 +1,110 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// HCI capture in btsnoop format, enabled at runtime with the
+// vendor.bluetooth.snoop property. Capture() only copies the packet into a
+// lock-free ring, a background thread moves the records to a preallocated
+// memory mapped file. When the file is full it is rotated to a .last file so
+// at most twice the configured size is used. Packets are dropped, and the
+// drop counted in the log, if the ring is full.
+//
+// The property is read again from Capture() at most once per second. The
+// thread is only started once capture is enabled and waits without waking
+// up while it is disabled.
+class HciSnoop {
+ public:
+  static HciSnoop& Get();
+
+  // May be called from any thread.
+  void Capture(HciPacketType type, bool incoming, const uint8_t* data,
+               size_t length);
+
+ private:
+  // Large enough for the biggest ACL packet of the controller.
+  static const size_t SNAP_LENGTH = 1040;
+
+  struct Record {
+    std::atomic<size_t> sequence;
+    uint64_t timestamp_us;
+    uint16_t length;
+    uint16_t included_length;
+    uint8_t type;
+    bool incoming;
+    uint8_t data[SNAP_LENGTH];
+  };
+
+  HciSnoop();
+  ~HciSnoop();
+  HciSnoop(const HciSnoop&) = delete;
+  HciSnoop& operator=(const HciSnoop&) = delete;
+
+  // Reads the property if it is due, from the capturing threads.
+  void CheckProperty();
+  void WakeWriter();
+  void DrainRing();
+  bool OpenLogFile();
+  void CloseLogFile();
+  void RotateLogFile();
+  void WriteRecord(const Record& record);
+  void WriterRoutine();
+
+  std::atomic<bool> enabled_{false};
+  std::atomic<int64_t> next_property_check_ns_{0};
+
+  // Bounded multi producer, single consumer ring.
+  std::unique_ptr<Record[]> ring_;
+  std::atomic<size_t> enqueue_position_{0};
+  std::atomic<size_t> dequeue_position_{0};
+  std::atomic<uint32_t> dropped_count_{0};
+
+  // Guards the state below and changes of enabled_.
+  std::mutex writer_mutex_;
+  std::condition_variable writer_cv_;
+  bool drain_requested_{false};
+  bool open_failed_{false};
+  bool stopping_{false};
+
+  std::string path_;
+  size_t file_size_;
+  int fd_{-1};
+  uint8_t* map_{nullptr};
+  size_t offset_{0};
+  std::thread writer_;
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,213 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_telemetry.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "hci_buffer_pool.h"
+
+namespace {
+
+const char* packet_type_names[] = {"unknown", "command", "acl", "sco",
+                                   "event"};
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+void HciHistogram::Record(uint64_t value) {
+  size_t bucket = value ? 64 - __builtin_clzll(value) : 0;
+  if (bucket >= BUCKETS) bucket = BUCKETS - 1;
+
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t HciHistogram::Percentile(uint64_t count, int percent) const {
+  // Upper bound of the bucket the percentile falls in.
+  uint64_t rank = (count * percent + 99) / 100;
+  uint64_t seen = 0;
+  uint64_t bucket_limit = 0;
+  for (size_t i = 0; i < BUCKETS; i++, bucket_limit = bucket_limit * 2 + 1) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) break;
+  }
+  return std::min(bucket_limit, max_.load(std::memory_order_relaxed));
+}
+
+void HciHistogram::Dump(int fd, const char* name, const char* unit) const {
+  uint64_t count = count_.load(std::memory_order_relaxed);
+  if (count == 0) {
+    dprintf(fd, "  %s: no samples\n", name);
+    return;
+  }
+
+  dprintf(fd,
+          "  %s: count %llu, mean %llu %s, p50 <= %llu, p99 <= %llu, "
+          "max %llu\n",
+          name, static_cast<unsigned long long>(count),
+          static_cast<unsigned long long>(
+              sum_.load(std::memory_order_relaxed) / count),
+          unit, static_cast<unsigned long long>(Percentile(count, 50)),
+          static_cast<unsigned long long>(Percentile(count, 99)),
+          static_cast<unsigned long long>(
+              max_.load(std::memory_order_relaxed)));
+}
+
+HciTelemetry& HciTelemetry::Get() {
+  static HciTelemetry telemetry;
+  return telemetry;
+}
+
+HciTelemetry::HciTelemetry()
+    : start_time_(Clock::now()), last_dump_time_(start_time_) {}
+
+void HciTelemetry::RecordUartRead(size_t bytes) {
+  uart_read_size_.Record(bytes);
+}
+
+void HciTelemetry::RecordRxPacket(HciPacketType type, size_t length) {
+  if (type >= PACKET_TYPES) return;
+  rx_[type].packets.fetch_add(1, std::memory_order_relaxed);
+  rx_[type].bytes.fetch_add(length, std::memory_order_relaxed);
+}
+
+void HciTelemetry::RecordRxDropped(HciPacketType type) {
+  if (type >= PACKET_TYPES) return;
+  rx_dropped_[type].fetch_add(1, std::memory_order_relaxed);
+}
+
+void HciTelemetry::RecordRxLatency(Clock::time_point read_time) {
+  rx_latency_.Record(
+      duration_cast<microseconds>(Clock::now() - read_time).count());
+}
+
+void HciTelemetry::RecordCallback(HciPacketType type,
+                                  Clock::duration duration) {
+  if (type >= PACKET_TYPES) return;
+  callback_time_[type].Record(duration_cast<microseconds>(duration).count());
+}
+
+void HciTelemetry::RecordTxPacket(HciPacketType type, size_t length,
+                                  size_t queue_depth) {
+  if (type >= PACKET_TYPES) return;
+  tx_[type].packets.fetch_add(1, std::memory_order_relaxed);
+  tx_[type].bytes.fetch_add(length, std::memory_order_relaxed);
+  tx_queue_depth_.Record(queue_depth);
+}
+
+void HciTelemetry::RecordRxResync(size_t discarded_bytes) {
+  rx_resyncs_.fetch_add(1, std::memory_order_relaxed);
+  rx_resync_bytes_.fetch_add(discarded_bytes, std::memory_order_relaxed);
+}
+
+void HciTelemetry::RecordTransportRecovery(Clock::duration duration) {
+  transport_recovery_time_.Record(
+      duration_cast<std::chrono::milliseconds>(duration).count());
+}
+
+void HciTelemetry::DumpCounters(int fd, const char* direction,
+                                const Counter* counters, Snapshot* last,
+                                double interval_s) {
+  for (size_t type = HCI_PACKET_TYPE_COMMAND; type < PACKET_TYPES; type++) {
+    uint64_t packets = counters[type].packets.load(std::memory_order_relaxed);
+    uint64_t bytes = counters[type].bytes.load(std::memory_order_relaxed);
+    if (packets == 0) continue;
+
+    double packet_rate = 0;
+    double byte_rate = 0;
+    if (interval_s > 0) {
+      packet_rate = (packets - last[type].packets) / interval_s;
+      byte_rate = (bytes - last[type].bytes) / interval_s;
+    }
+    dprintf(fd,
+            "  %s %s: %llu packets, %llu bytes, %.1f packets/s, "
+            "%.0f bytes/s\n",
+            direction, packet_type_names[type],
+            static_cast<unsigned long long>(packets),
+            static_cast<unsigned long long>(bytes), packet_rate, byte_rate);
+    last[type] = {packets, bytes};
+  }
+}
+
+void HciTelemetry::Dump(int fd) {
+  std::unique_lock<std::mutex> guard(dump_mutex_);
+  Clock::time_point now = Clock::now();
+  std::chrono::duration<double> uptime = now - start_time_;
+  std::chrono::duration<double> interval = now - last_dump_time_;
+  last_dump_time_ = now;
+
+  dprintf(fd, "Bluetooth HCI telemetry (%.1f s, rates over the last %.1f s)\n",
+          uptime.count(), interval.count());
+  DumpCounters(fd, "rx", rx_, last_rx_, interval.count());
+  DumpCounters(fd, "tx", tx_, last_tx_, interval.count());
+
+  uart_read_size_.Dump(fd, "uart read size", "bytes");
+  rx_latency_.Dump(fd, "rx read to delivered", "us");
+  callback_time_[HCI_PACKET_TYPE_EVENT].Dump(fd, "hciEventReceived", "us");
+  callback_time_[HCI_PACKET_TYPE_ACL_DATA].Dump(fd, "aclDataReceived", "us");
+  callback_time_[HCI_PACKET_TYPE_SCO_DATA].Dump(fd, "scoDataReceived", "us");
+  tx_queue_depth_.Dump(fd, "tx queue depth", "packets");
+  sco_jitter_.Dump(fd, "sco tx arrival jitter", "us");
+  transport_recovery_time_.Dump(fd, "transport recovery", "ms");
+
+  dprintf(fd, "  rx dropped: event %llu, acl %llu, sco %llu\n",
+          static_cast<unsigned long long>(
+              rx_dropped_[HCI_PACKET_TYPE_EVENT].load()),
+          static_cast<unsigned long long>(
+              rx_dropped_[HCI_PACKET_TYPE_ACL_DATA].load()),
+          static_cast<unsigned long long>(
+              rx_dropped_[HCI_PACKET_TYPE_SCO_DATA].load()));
+  dprintf(fd, "  rx coalesced reads %llu, rx flow stops %llu\n",
+          static_cast<unsigned long long>(rx_coalesced_reads_.load()),
+          static_cast<unsigned long long>(rx_flow_stops_.load()));
+  dprintf(fd, "  tx backpressure %llu, tx dropped %llu\n",
+          static_cast<unsigned long long>(tx_backpressure_.load()),
+          static_cast<unsigned long long>(tx_dropped_.load()));
+  dprintf(fd, "  lpm wakes %llu, lpm sleeps %llu\n",
+          static_cast<unsigned long long>(lpm_wakes_.load()),
+          static_cast<unsigned long long>(lpm_sleeps_.load()));
+  dprintf(fd, "  sco underruns %llu, sco overflows %llu, sco late ticks %llu\n",
+          static_cast<unsigned long long>(sco_underruns_.load()),
+          static_cast<unsigned long long>(sco_overflows_.load()),
+          static_cast<unsigned long long>(sco_late_ticks_.load()));
+  dprintf(fd,
+          "  rx resyncs %llu (%llu bytes discarded), transport errors %llu\n",
+          static_cast<unsigned long long>(rx_resyncs_.load()),
+          static_cast<unsigned long long>(rx_resync_bytes_.load()),
+          static_cast<unsigned long long>(transport_errors_.load()));
+  HciBufferPool::Get().Dump(fd);
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
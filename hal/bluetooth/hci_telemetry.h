@@ -0,0 +1,143 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Lock-free histogram with power of two buckets, bucket i counts the values
+// in [2^(i-1), 2^i).
+class HciHistogram {
+ public:
+  static const size_t BUCKETS = 24;
+
+  void Record(uint64_t value);
+  void Dump(int fd, const char* name, const char* unit) const;
+
+ private:
+  uint64_t Percentile(uint64_t count, int percent) const;
+
+  std::atomic<uint64_t> buckets_[BUCKETS] = {};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Counters and histograms of the HCI transport, dumped by
+// IBluetoothHci::debug() (lshal debug). Recording only uses relaxed atomics
+// so it can be done on the RX and TX paths.
+class HciTelemetry {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static HciTelemetry& Get();
+
+  void RecordUartRead(size_t bytes);
+  void RecordRxPacket(HciPacketType type, size_t length);
+  // From the UART read which completed the packet until the stack callback
+  // returned.
+  void RecordRxLatency(Clock::time_point read_time);
+  void RecordRxDropped(HciPacketType type);
+  // The transport stopped being read until the stack caught up.
+  void RecordRxFlowStop() { rx_flow_stops_++; }
+  void RecordRxCoalescedRead() { rx_coalesced_reads_++; }
+  // Time spent in the stack callback, the HIDL call for the packet type.
+  void RecordCallback(HciPacketType type, Clock::duration duration);
+
+  void RecordTxPacket(HciPacketType type, size_t length, size_t queue_depth);
+  void RecordTxBackpressure() { tx_backpressure_++; }
+  void RecordTxDropped() { tx_dropped_++; }
+
+  void RecordLpmWake() { lpm_wakes_++; }
+  void RecordLpmSleep() { lpm_sleeps_++; }
+
+  void RecordScoJitter(uint64_t us) { sco_jitter_.Record(us); }
+  void RecordScoUnderrun() { sco_underruns_++; }
+  void RecordScoOverflow() { sco_overflows_++; }
+  void RecordScoLateTicks(uint64_t ticks) { sco_late_ticks_ += ticks; }
+
+  void RecordRxResync(size_t discarded_bytes);
+  void RecordTransportError() { transport_errors_++; }
+  void RecordTransportRecovery(Clock::duration duration);
+
+  void Dump(int fd);
+
+ private:
+  static const size_t PACKET_TYPES = HCI_PACKET_TYPE_EVENT + 1;
+
+  struct Counter {
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+
+  struct Snapshot {
+    uint64_t packets;
+    uint64_t bytes;
+  };
+
+  HciTelemetry();
+  HciTelemetry(const HciTelemetry&) = delete;
+  HciTelemetry& operator=(const HciTelemetry&) = delete;
+
+  void DumpCounters(int fd, const char* direction, const Counter* counters,
+                    Snapshot* last, double interval_s);
+
+  Counter rx_[PACKET_TYPES];
+  Counter tx_[PACKET_TYPES];
+  std::atomic<uint64_t> rx_dropped_[PACKET_TYPES] = {};
+  std::atomic<uint64_t> rx_coalesced_reads_{0};
+  std::atomic<uint64_t> rx_flow_stops_{0};
+  HciHistogram uart_read_size_;
+  HciHistogram rx_latency_;
+  HciHistogram callback_time_[PACKET_TYPES];
+  HciHistogram tx_queue_depth_;
+  std::atomic<uint64_t> tx_backpressure_{0};
+  std::atomic<uint64_t> tx_dropped_{0};
+  std::atomic<uint64_t> lpm_wakes_{0};
+  std::atomic<uint64_t> lpm_sleeps_{0};
+  HciHistogram sco_jitter_;
+  std::atomic<uint64_t> sco_underruns_{0};
+  std::atomic<uint64_t> sco_overflows_{0};
+  std::atomic<uint64_t> sco_late_ticks_{0};
+  std::atomic<uint64_t> rx_resyncs_{0};
+  std::atomic<uint64_t> rx_resync_bytes_{0};
+  std::atomic<uint64_t> transport_errors_{0};
+  HciHistogram transport_recovery_time_;
+
+  // Rates in a dump are computed since the previous one.
+  std::mutex dump_mutex_;
+  Clock::time_point start_time_;
+  Clock::time_point last_dump_time_;
+  Snapshot last_rx_[PACKET_TYPES] = {};
+  Snapshot last_tx_[PACKET_TYPES] = {};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,502 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_tx_queue.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "hci_buffer_pool.h"
+#include "hci_snoop.h"
+#include "hci_telemetry.h"
+
+namespace {
+
+// Bytes coalesced into a single writev(), bounds how long a command or SCO
+// packet queued behind an ACL batch waits for the UART.
+const size_t MAX_BATCH_BYTES = 4096;
+
+// Flow control is dropped if the controller does not return any ACL credit
+// for that long, the HAL must not stall the link on a lost event.
+const std::chrono::milliseconds CREDIT_TIMEOUT(2000);
+
+const uint16_t INVALID_HANDLE = 0xFFFF;
+const uint16_t HANDLE_MASK = 0x0FFF;
+
+// Events and commands parsed for flow control (Volume 2, Part E, 7.7)
+const uint8_t HCI_DISCONNECTION_COMPLETE_EVENT = 0x05;
+const uint8_t HCI_NUM_COMPLETED_PACKETS_EVENT = 0x13;
+const uint8_t HCI_LE_META_EVENT = 0x3E;
+const uint8_t HCI_LE_CONNECTION_COMPLETE_SUBEVENT = 0x01;
+const uint8_t HCI_LE_ENHANCED_CONNECTION_COMPLETE_SUBEVENT = 0x0A;
+const uint16_t HCI_RESET_OPCODE = 0x0C03;
+const uint16_t HCI_READ_BUFFER_SIZE_OPCODE = 0x1005;
+const uint16_t HCI_LE_READ_BUFFER_SIZE_OPCODE = 0x2002;
+
+const char* TX_FAIRNESS_PROPERTY = "vendor.bluetooth.tx_fairness";
+
+// How long Send() may block on a full queue before dropping the packet.
+const std::chrono::milliseconds BACKPRESSURE_TIMEOUT(1000);
+
+// How long pending packets are given to drain when the queue is destroyed.
+const std::chrono::milliseconds DRAIN_TIMEOUT(200);
+
+const int BT_RT_PRIORITY = 1;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+void HciTxQueue::TypeQueue::Push(const TxPacket& packet) {
+  slots[(head + count) % slots.size()] = packet;
+  count++;
+}
+
+HciTxQueue::TxPacket HciTxQueue::TypeQueue::Pop() {
+  TxPacket packet = slots[head];
+  head = (head + 1) % slots.size();
+  count--;
+  return packet;
+}
+
+HciTxQueue::HciTxQueue(int fd, bool add_type_header)
+    : fd_(fd),
+      add_type_header_(add_type_header),
+      acl_fairness_(property_get_bool(TX_FAIRNESS_PROPERTY, true)) {
+  command_queue_.slots.resize(HCI_TX_COMMAND_QUEUE_DEPTH);
+  sco_queue_.slots.resize(HCI_TX_SCO_QUEUE_DEPTH);
+  batch_.reserve(HCI_TX_MAX_BATCH_PACKETS);
+
+  // Writes must not block, the writer waits for EPOLLOUT instead.
+  int flags = fcntl(fd_, F_GETFL);
+  if (flags == -1 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) == -1) {
+    ALOGE("%s unable to set O_NONBLOCK on fd %d: %s", __func__, fd_,
+          strerror(errno));
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  stop_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd_ != -1 && stop_fd_ != -1) {
+    struct epoll_event event = {};
+    event.events = EPOLLOUT | EPOLLET;
+    event.data.fd = fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &event);
+    event.events = EPOLLIN;
+    event.data.fd = stop_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &event);
+  } else {
+    ALOGE("%s unable to create descriptors: %s", __func__, strerror(errno));
+  }
+
+  writer_ = std::thread([this]() { WriterRoutine(); });
+}
+
+HciTxQueue::~HciTxQueue() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    space_cv_.wait_for(guard, DRAIN_TIMEOUT, [this]() {
+      return !HasQueuedLocked() && batch_.empty();
+    });
+    stopping_ = true;
+  }
+  data_cv_.notify_all();
+  space_cv_.notify_all();
+  if (stop_fd_ != -1) {
+    uint64_t value = 1;
+    TEMP_FAILURE_RETRY(write(stop_fd_, &value, sizeof(value)));
+  }
+  if (writer_.joinable()) writer_.join();
+
+  size_t dropped = batch_.size();
+  for (const TxPacket& packet : batch_) HciBufferPool::Get().Free(packet.buffer);
+  for (TypeQueue* queue : {&command_queue_, &sco_queue_}) {
+    for (dropped += queue->count; queue->count > 0;) {
+      HciBufferPool::Get().Free(queue->Pop().buffer);
+    }
+  }
+  for (auto& it : connections_) {
+    TypeQueue& queue = it.second.queue;
+    for (dropped += queue.count; queue.count > 0;) {
+      HciBufferPool::Get().Free(queue.Pop().buffer);
+    }
+  }
+  if (dropped) ALOGW("%s: dropping %zu queued packets", __func__, dropped);
+
+  if (stop_fd_ != -1) close(stop_fd_);
+  if (epoll_fd_ != -1) close(epoll_fd_);
+}
+
+size_t HciTxQueue::Send(uint8_t type, const uint8_t* data, size_t length) {
+  TypeQueue* queue = nullptr;
+  if (type == HCI_PACKET_TYPE_COMMAND) {
+    queue = &command_queue_;
+  } else if (type == HCI_PACKET_TYPE_SCO_DATA) {
+    queue = &sco_queue_;
+  } else if (type != HCI_PACKET_TYPE_ACL_DATA) {
+    ALOGE("%s: Unimplemented packet type = %d", __func__, type);
+    return 0;
+  }
+
+  uint16_t handle = INVALID_HANDLE;
+  if (type == HCI_PACKET_TYPE_ACL_DATA && length >= 2) {
+    handle = (data[0] | (data[1] << 8)) & HANDLE_MASK;
+  }
+
+  size_t header_length = add_type_header_ ? 1 : 0;
+  uint8_t* buffer = static_cast<uint8_t*>(
+      HciBufferPool::Get().Allocate(header_length + length));
+  if (add_type_header_) buffer[0] = type;
+  memcpy(buffer + header_length, data, length);
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  auto has_space = [&]() {
+    return queue ? !queue->Full() : acl_queued_ < HCI_TX_ACL_QUEUE_DEPTH;
+  };
+  if (!has_space()) {
+    backpressure_count_++;
+    HciTelemetry::Get().RecordTxBackpressure();
+    bool ready = space_cv_.wait_for(guard, BACKPRESSURE_TIMEOUT, [&]() {
+      return has_space() || stopping_;
+    });
+    if (!ready || stopping_) {
+      dropped_count_++;
+      HciTelemetry::Get().RecordTxDropped();
+      guard.unlock();
+      ALOGE("%s: TX queue for type %d is full, dropping %zu bytes", __func__,
+            type, length);
+      HciBufferPool::Get().Free(buffer);
+      return 0;
+    }
+  }
+
+  TxPacket packet = {buffer, header_length + length, handle, next_sequence_++};
+  size_t depth;
+  if (queue) {
+    queue->Push(packet);
+    depth = queue->count;
+  } else {
+    ConnectionLocked(handle).queue.Push(packet);
+    depth = ++acl_queued_;
+  }
+  guard.unlock();
+  data_cv_.notify_one();
+
+  HciSnoop::Get().Capture(static_cast<HciPacketType>(type), false, data,
+                          length);
+  HciTelemetry::Get().RecordTxPacket(static_cast<HciPacketType>(type), length,
+                                     depth);
+  return length;
+}
+
+HciTxQueue::Connection& HciTxQueue::ConnectionLocked(uint16_t handle) {
+  Connection& connection = connections_[handle];
+  // Only allocates the first time a handle is seen.
+  if (connection.queue.slots.empty()) {
+    connection.queue.slots.resize(HCI_TX_ACL_QUEUE_DEPTH);
+  }
+  return connection;
+}
+
+HciTxQueue::CreditPool& HciTxQueue::PoolForLocked(
+    const Connection& connection) {
+  // LE links share the BR/EDR buffers unless the controller has its own.
+  if (connection.is_le && le_credits_.known) return le_credits_;
+  return acl_credits_;
+}
+
+void HciTxQueue::ReturnCreditsLocked(uint16_t handle, int count) {
+  auto it = connections_.find(handle);
+  if (it == connections_.end()) return;
+
+  Connection& connection = it->second;
+  count = std::min(count, connection.outstanding);
+  connection.outstanding -= count;
+  PoolForLocked(connection).available += count;
+}
+
+HciTxQueue::Connection* HciTxQueue::NextAclLocked() {
+  if (acl_queued_ == 0) return nullptr;
+
+  auto has_credit = [this](Connection& connection) {
+    CreditPool& pool = PoolForLocked(connection);
+    return !pool.known || pool.available > 0;
+  };
+
+  if (!acl_fairness_) {
+    // Oldest packet first, it blocks the others while it has no credit.
+    Connection* oldest = nullptr;
+    for (auto& it : connections_) {
+      if (it.second.queue.count == 0) continue;
+      if (oldest == nullptr ||
+          it.second.queue.Front().sequence < oldest->queue.Front().sequence) {
+        oldest = &it.second;
+      }
+    }
+    return (oldest && has_credit(*oldest)) ? oldest : nullptr;
+  }
+
+  // Round robin, starting after the connection served last.
+  auto start = connections_.upper_bound(last_acl_handle_);
+  for (size_t i = 0; i < connections_.size(); i++, start++) {
+    if (start == connections_.end()) start = connections_.begin();
+    Connection& connection = start->second;
+    if (connection.queue.count && has_credit(connection)) return &connection;
+  }
+  return nullptr;
+}
+
+bool HciTxQueue::HasSendableLocked() {
+  return command_queue_.count || sco_queue_.count || NextAclLocked();
+}
+
+bool HciTxQueue::HasQueuedLocked() const {
+  return command_queue_.count || sco_queue_.count || acl_queued_;
+}
+
+void HciTxQueue::OnEventReceived(const hidl_vec<uint8_t>& event) {
+  if (event.size() < HCI_EVENT_PREAMBLE_SIZE) return;
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  switch (event[0]) {
+    case HCI_COMMAND_COMPLETE_EVENT: {
+      if (event.size() < 6) return;
+      uint16_t opcode = event[3] | (event[4] << 8);
+      uint8_t status = event[5];
+      if (opcode == HCI_RESET_OPCODE) {
+        acl_credits_.known = false;
+        le_credits_.known = false;
+        for (auto& it : connections_) {
+          it.second.outstanding = 0;
+          it.second.is_le = false;
+        }
+      } else if (opcode == HCI_READ_BUFFER_SIZE_OPCODE && status == 0 &&
+                 event.size() >= 11) {
+        acl_credits_.known = true;
+        acl_credits_.available = event[9] | (event[10] << 8);
+        for (auto& it : connections_) {
+          if (&PoolForLocked(it.second) == &acl_credits_) {
+            acl_credits_.available -= it.second.outstanding;
+          }
+        }
+        ALOGD("%s: %d ACL buffers", __func__, acl_credits_.available);
+      } else if (opcode == HCI_LE_READ_BUFFER_SIZE_OPCODE && status == 0 &&
+                 event.size() >= 9) {
+        // Zero LE buffers means LE uses the BR/EDR ones.
+        le_credits_.known = event[8] != 0;
+        le_credits_.available = event[8];
+        for (auto& it : connections_) {
+          if (&PoolForLocked(it.second) == &le_credits_) {
+            le_credits_.available -= it.second.outstanding;
+          }
+        }
+        ALOGD("%s: %d LE ACL buffers", __func__, le_credits_.available);
+      }
+      break;
+    }
+
+    case HCI_NUM_COMPLETED_PACKETS_EVENT: {
+      size_t num_handles = event.size() > 2 ? event[2] : 0;
+      for (size_t i = 0; i < num_handles && 7 + i * 4 <= event.size(); i++) {
+        size_t offset = 3 + i * 4;
+        uint16_t handle = (event[offset] | (event[offset + 1] << 8)) &
+                          HANDLE_MASK;
+        int count = event[offset + 2] | (event[offset + 3] << 8);
+        ReturnCreditsLocked(handle, count);
+      }
+      break;
+    }
+
+    case HCI_DISCONNECTION_COMPLETE_EVENT: {
+      if (event.size() < 5 || event[2] != 0) return;
+      uint16_t handle = (event[3] | (event[4] << 8)) & HANDLE_MASK;
+      // Buffers of a disconnected link are freed without a completion.
+      auto it = connections_.find(handle);
+      if (it == connections_.end()) return;
+      ReturnCreditsLocked(handle, it->second.outstanding);
+      if (it->second.queue.count == 0) {
+        connections_.erase(it);
+      } else {
+        it->second.is_le = false;
+      }
+      break;
+    }
+
+    case HCI_LE_META_EVENT: {
+      if (event.size() < 6) return;
+      if (event[2] != HCI_LE_CONNECTION_COMPLETE_SUBEVENT &&
+          event[2] != HCI_LE_ENHANCED_CONNECTION_COMPLETE_SUBEVENT) {
+        return;
+      }
+      if (event[3] != 0) return;
+      uint16_t handle = (event[4] | (event[5] << 8)) & HANDLE_MASK;
+      ConnectionLocked(handle).is_le = true;
+      break;
+    }
+
+    default:
+      return;
+  }
+  guard.unlock();
+  data_cv_.notify_one();
+}
+
+size_t HciTxQueue::CollectBatchLocked() {
+  size_t bytes = 0;
+
+  // Strict priority: commands, then SCO, then ACL within its credits.
+  while (batch_.size() < HCI_TX_MAX_BATCH_PACKETS &&
+         bytes < MAX_BATCH_BYTES) {
+    if (command_queue_.count) {
+      batch_.push_back(command_queue_.Pop());
+    } else if (sco_queue_.count) {
+      batch_.push_back(sco_queue_.Pop());
+    } else {
+      Connection* connection = NextAclLocked();
+      if (connection == nullptr) break;
+
+      batch_.push_back(connection->queue.Pop());
+      acl_queued_--;
+      connection->outstanding++;
+      CreditPool& pool = PoolForLocked(*connection);
+      if (pool.known) pool.available--;
+      last_acl_handle_ = batch_.back().handle;
+    }
+    bytes += batch_.back().length;
+  }
+  return batch_.size();
+}
+
+void HciTxQueue::CompleteBatch(size_t bytes_written) {
+  size_t completed = 0;
+  size_t offset = batch_offset_;
+
+  for (; completed < batch_.size(); completed++) {
+    size_t remaining = batch_[completed].length - offset;
+    if (bytes_written < remaining) break;
+
+    bytes_written -= remaining;
+    offset = 0;
+    HciBufferPool::Get().Free(batch_[completed].buffer);
+  }
+
+  batch_.erase(batch_.begin(), batch_.begin() + completed);
+  batch_offset_ = batch_.empty() ? 0 : offset + bytes_written;
+}
+
+bool HciTxQueue::WaitWritable() {
+  if (epoll_fd_ == -1) {
+    struct pollfd pfd = {fd_, POLLOUT, 0};
+    TEMP_FAILURE_RETRY(poll(&pfd, 1, 100));
+    std::unique_lock<std::mutex> guard(mutex_);
+    return !stopping_;
+  }
+
+  struct epoll_event events[2];
+  int nfds = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd_, events, 2, -1));
+  for (int i = 0; i < nfds; i++) {
+    if (events[i].data.fd == stop_fd_) return false;
+  }
+  return true;
+}
+
+void HciTxQueue::WriterRoutine() {
+  struct sched_param rt_params;
+  rt_params.sched_priority = BT_RT_PRIORITY;
+  if (sched_setscheduler(gettid(), SCHED_FIFO, &rt_params)) {
+    ALOGE("%s unable to set SCHED_FIFO for pid %d, tid %d, error %s", __func__,
+          getpid(), gettid(), strerror(errno));
+  }
+
+  struct iovec iov[HCI_TX_MAX_BATCH_PACKETS];
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      while (batch_.empty() && !stopping_ && !HasSendableLocked()) {
+        if (acl_queued_ == 0) {
+          data_cv_.wait(guard);
+          continue;
+        }
+
+        // Only ACL is queued and the controller has no free buffers.
+        auto now = std::chrono::steady_clock::now();
+        if (credits_blocked_since_ == std::chrono::steady_clock::time_point()) {
+          credits_blocked_since_ = now;
+        }
+        if (now - credits_blocked_since_ >= CREDIT_TIMEOUT) {
+          ALOGW("%s: no ACL credits returned in %lld ms, ignoring them",
+                __func__, static_cast<long long>(CREDIT_TIMEOUT.count()));
+          acl_credits_.known = false;
+          le_credits_.known = false;
+          continue;
+        }
+        data_cv_.wait_for(guard, CREDIT_TIMEOUT - (now - credits_blocked_since_));
+      }
+      if (stopping_) break;
+      credits_blocked_since_ = std::chrono::steady_clock::time_point();
+      if (batch_.empty()) CollectBatchLocked();
+    }
+    space_cv_.notify_all();
+
+    // Only the writer changes the batch, it is safe to use it unlocked.
+    size_t total = 0;
+    for (size_t i = 0; i < batch_.size(); i++) {
+      size_t skip = (i == 0) ? batch_offset_ : 0;
+      iov[i].iov_base = batch_[i].buffer + skip;
+      iov[i].iov_len = batch_[i].length - skip;
+      total += iov[i].iov_len;
+    }
+
+    ssize_t ret = TEMP_FAILURE_RETRY(writev(fd_, iov, batch_.size()));
+    if (ret == -1) {
+      if (errno == EAGAIN) {
+        if (!WaitWritable()) break;
+        continue;
+      }
+      ALOGE("%s error writing to UART (%s), dropping %zu packets", __func__,
+            strerror(errno), batch_.size());
+      dropped_count_ += batch_.size();
+      ret = total;
+    }
+
+    {
+      std::unique_lock<std::mutex> guard(mutex_);
+      CompleteBatch(ret);
+    }
+    space_cv_.notify_all();
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
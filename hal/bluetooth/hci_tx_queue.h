@@ -0,0 +1,147 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <hidl/HidlSupport.h>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+using ::android::hardware::hidl_vec;
+
+// Bounded per packet type queues drained by a writer thread. Send() only
+// copies the packet into a pool buffer, the writer coalesces queued packets
+// into one writev() and waits for EPOLLOUT when the UART is full instead of
+// spinning. When a queue is full Send() blocks the caller for a bounded time
+// and then drops the packet, both are counted as backpressure.
+//
+// The writer schedules by strict priority, commands before SCO before ACL.
+// ACL packets are only written while the controller has free buffers, the
+// credits are learnt from Read_Buffer_Size and returned by
+// Number_Of_Completed_Packets, so a bulk transfer cannot fill the UART ahead
+// of a command. With fairness enabled ACL connections are served round robin.
+class HciTxQueue {
+ public:
+  // With add_type_header the H4 packet type byte is written before every
+  // packet, MCT channels carry a single packet type and do not need it.
+  HciTxQueue(int fd, bool add_type_header);
+  ~HciTxQueue();
+
+  // Returns the number of bytes queued, 0 if the packet was dropped.
+  size_t Send(uint8_t type, const uint8_t* data, size_t length);
+
+  // Has to see every event from the controller to track buffer credits.
+  void OnEventReceived(const hidl_vec<uint8_t>& event);
+
+  uint64_t GetBackpressureCount() const { return backpressure_count_.load(); }
+  uint64_t GetDroppedCount() const { return dropped_count_.load(); }
+
+ private:
+  struct TxPacket {
+    uint8_t* buffer;
+    size_t length;
+    uint16_t handle;
+    uint64_t sequence;
+  };
+
+  // Fixed ring so that queueing never allocates.
+  struct TypeQueue {
+    std::vector<TxPacket> slots;
+    size_t head{0};
+    size_t count{0};
+
+    bool Full() const { return count == slots.size(); }
+    TxPacket& Front() { return slots[head]; }
+    void Push(const TxPacket& packet);
+    TxPacket Pop();
+  };
+
+  // Controller ACL buffers, unlimited until the size is known.
+  struct CreditPool {
+    bool known{false};
+    int available{0};
+  };
+
+  struct Connection {
+    TypeQueue queue;
+    bool is_le{false};
+    int outstanding{0};
+  };
+
+  HciTxQueue(const HciTxQueue&) = delete;
+  HciTxQueue& operator=(const HciTxQueue&) = delete;
+
+  Connection& ConnectionLocked(uint16_t handle);
+  CreditPool& PoolForLocked(const Connection& connection);
+  void ReturnCreditsLocked(uint16_t handle, int count);
+  Connection* NextAclLocked();
+  bool HasSendableLocked();
+  bool HasQueuedLocked() const;
+  size_t CollectBatchLocked();
+  void CompleteBatch(size_t bytes_written);
+  bool WaitWritable();
+  void WriterRoutine();
+
+  int fd_;
+  bool add_type_header_;
+  bool acl_fairness_;
+  int epoll_fd_{-1};
+  int stop_fd_{-1};
+
+  std::mutex mutex_;
+  std::condition_variable data_cv_;
+  std::condition_variable space_cv_;
+  TypeQueue command_queue_;
+  TypeQueue sco_queue_;
+  std::map<uint16_t, Connection> connections_;
+  size_t acl_queued_{0};
+  uint16_t last_acl_handle_{0};
+  uint64_t next_sequence_{0};
+  CreditPool acl_credits_;
+  CreditPool le_credits_;
+  std::chrono::steady_clock::time_point credits_blocked_since_;
+  bool stopping_{false};
+
+  // Packets taken by the writer and not completely written yet, the first
+  // one may be partially written.
+  std::vector<TxPacket> batch_;
+  size_t batch_offset_{0};
+  std::thread writer_;
+
+  std::atomic<uint64_t> backpressure_count_{0};
+  std::atomic<uint64_t> dropped_count_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
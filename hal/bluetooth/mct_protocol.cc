@@ -23,6 +23,8 @@
 
 #include <fcntl.h>
 
+#include "hci_snoop.h"
+
 namespace android {
 namespace hardware {
 namespace bluetooth {
@@ -30,10 +32,11 @@ namespace hci {
 
 MctProtocol::MctProtocol(int* fds, PacketReadCallback event_cb,
                          PacketReadCallback acl_cb)
-    : event_cb_(event_cb),
-      acl_cb_(acl_cb),
-      event_packetizer_([this]() { OnEventPacketReady(); }),
-      acl_packetizer_([this]() { OnAclDataPacketReady(); }) {
+    : event_packetizer_([this]() { OnEventPacketReady(); }),
+      acl_packetizer_([this]() { OnAclDataPacketReady(); }),
+      cmd_tx_queue_(fds[CH_CMD], false),
+      acl_tx_queue_(fds[CH_ACL_OUT], false),
+      rx_dispatcher_(event_cb, acl_cb, nullptr) {
   for (int i = 0; i < CH_MAX; i++) {
     uart_fds_[i] = fds[i];
   }
@@ -41,27 +44,48 @@ MctProtocol::MctProtocol(int* fds, PacketReadCallback event_cb,
 
 size_t MctProtocol::Send(uint8_t type, const uint8_t* data, size_t length) {
   if (type == HCI_PACKET_TYPE_COMMAND)
-    return WriteSafely(uart_fds_[CH_CMD], data, length);
+    return cmd_tx_queue_.Send(type, data, length);
   if (type == HCI_PACKET_TYPE_ACL_DATA)
-    return WriteSafely(uart_fds_[CH_ACL_OUT], data, length);
+    return acl_tx_queue_.Send(type, data, length);
   LOG_ALWAYS_FATAL("%s: Unimplemented packet type = %d", __func__, type);
   return 0;
 }
 
 void MctProtocol::OnEventPacketReady() {
-  event_cb_(event_packetizer_.GetPacket());
+  const hidl_vec<uint8_t>& packet = event_packetizer_.GetPacket();
+  HciSnoop::Get().Capture(HCI_PACKET_TYPE_EVENT, true, packet.data(),
+                          packet.size());
+  acl_rx_policy_.OnPacket(HCI_PACKET_TYPE_EVENT, packet.size());
+  acl_tx_queue_.OnEventReceived(packet);
+
+  size_t length = packet.size();
+  rx_dispatcher_.Dispatch(HCI_PACKET_TYPE_EVENT,
+                          event_packetizer_.TakePacketBuffer(), length,
+                          event_rx_buffer_.GetReadTime());
 }
 
 void MctProtocol::OnAclDataPacketReady() {
-  acl_cb_(acl_packetizer_.GetPacket());
+  const hidl_vec<uint8_t>& packet = acl_packetizer_.GetPacket();
+  HciSnoop::Get().Capture(HCI_PACKET_TYPE_ACL_DATA, true, packet.data(),
+                          packet.size());
+  acl_rx_policy_.OnPacket(HCI_PACKET_TYPE_ACL_DATA, packet.size());
+
+  size_t length = packet.size();
+  rx_dispatcher_.Dispatch(HCI_PACKET_TYPE_ACL_DATA,
+                          acl_packetizer_.TakePacketBuffer(), length,
+                          acl_rx_buffer_.GetReadTime());
 }
 
 void MctProtocol::OnEventDataReady(int fd) {
-  event_packetizer_.OnDataReady(fd, HCI_PACKET_TYPE_EVENT);
+  if (!ReadSafely(fd, event_rx_buffer_)) return;
+  event_packetizer_.OnDataReady(event_rx_buffer_, HCI_PACKET_TYPE_EVENT);
 }
 
 void MctProtocol::OnAclDataReady(int fd) {
-  acl_packetizer_.OnDataReady(fd, HCI_PACKET_TYPE_ACL_DATA);
+  size_t buffered = acl_rx_buffer_.Size();
+  if (!ReadSafely(fd, acl_rx_buffer_)) return;
+  acl_rx_policy_.OnRead(acl_rx_buffer_.Size() - buffered);
+  acl_packetizer_.OnDataReady(acl_rx_buffer_, HCI_PACKET_TYPE_ACL_DATA);
 }
 
 }  // namespace hci
@@ -22,6 +22,9 @@
 #include "bt_vendor_lib.h"
 #include "hci_internals.h"
 #include "hci_protocol.h"
+#include "hci_rx_dispatcher.h"
+#include "hci_rx_policy.h"
+#include "hci_tx_queue.h"
 
 namespace android {
 namespace hardware {
@@ -40,14 +43,29 @@ class MctProtocol : public HciProtocol {
   void OnEventDataReady(int fd);
   void OnAclDataReady(int fd);
 
+  // Only the ACL channel is coalesced, events have their own.
+  std::chrono::microseconds NextAclReadDelay() {
+    return acl_rx_policy_.NextReadDelay();
+  }
+
+  void SetRxFlowCallback(RxFlowCallback callback) {
+    rx_dispatcher_.SetFlowCallback(callback);
+  }
+
  private:
   int uart_fds_[CH_MAX];
 
-  PacketReadCallback event_cb_;
-  PacketReadCallback acl_cb_;
-
   hci::HciPacketizer event_packetizer_;
   hci::HciPacketizer acl_packetizer_;
+
+  hci::HciRxBuffer event_rx_buffer_;
+  hci::HciRxBuffer acl_rx_buffer_;
+  hci::HciRxPolicy acl_rx_policy_;
+
+  hci::HciTxQueue cmd_tx_queue_;
+  hci::HciTxQueue acl_tx_queue_;
+
+  hci::HciRxDispatcher rx_dispatcher_;
 };
 
 }  // namespace hci
@@ -23,15 +23,19 @@
 #include <android/hardware/bluetooth/1.0/IBluetoothHci.h>
 
 #include "bluetooth_hci.h"
+#include "vendor_interface.h"
 
 using ::android::hardware::configureRpcThreadpool;
 using ::android::hardware::bluetooth::V1_0::IBluetoothHci;
 using ::android::hardware::bluetooth::V1_0::kingfisher::BluetoothHci;
+using ::android::hardware::bluetooth::V1_0::kingfisher::VendorInterface;
 using ::android::hardware::joinRpcThreadpool;
 using ::android::sp;
 
 int main(int /* argc */, char** /* argv */)
 {
+    VendorInterface::Prewarm();
+
     sp<IBluetoothHci> bt_hal = new BluetoothHci;
     configureRpcThreadpool(1, true);
 
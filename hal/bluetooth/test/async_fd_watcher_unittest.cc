@@ -0,0 +1,108 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define LOG_TAG "bt_async_fd_watcher_unittest"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "async_fd_watcher.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::bluetooth::async::AsyncFdWatcher;
+
+namespace {
+
+const std::chrono::milliseconds READ_DELAY(20);
+
+}  // namespace
+
+class AsyncFdWatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(0, pipe(fds_));
+    ASSERT_EQ(0, watcher_.WatchFdForNonBlockingReads(fds_[0], [this](int fd) {
+      uint8_t byte;
+      if (read(fd, &byte, 1) == 1) reads_++;
+      if (delay_) watcher_.DelayReads(fd, READ_DELAY);
+    }));
+  }
+
+  void TearDown() override {
+    watcher_.StopWatchingFileDescriptors();
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  void Write(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      uint8_t byte = 0;
+      ASSERT_EQ(1, write(fds_[1], &byte, 1));
+    }
+  }
+
+  bool WaitForReads(int count) {
+    for (int i = 0; i < 500 && reads_ < count; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return reads_ >= count;
+  }
+
+  AsyncFdWatcher watcher_;
+  int fds_[2];
+  std::atomic_bool delay_{false};
+  std::atomic_int reads_{0};
+};
+
+TEST_F(AsyncFdWatcherTest, StoppedFdNotReadAfterDelay) {
+  delay_ = true;
+  Write(2);
+  ASSERT_TRUE(WaitForReads(1));
+
+  // Stopped from another thread while the reads are held back, the expired
+  // delay must not bring the fd back.
+  EXPECT_EQ(0, watcher_.StopReadingFd(fds_[0]));
+  std::this_thread::sleep_for(READ_DELAY * 5);
+  EXPECT_EQ(1, reads_);
+
+  EXPECT_EQ(0, watcher_.ResumeReadingFd(fds_[0]));
+  EXPECT_TRUE(WaitForReads(2));
+}
+
+TEST_F(AsyncFdWatcherTest, StoppedFdNotDelayed) {
+  EXPECT_EQ(0, watcher_.StopReadingFd(fds_[0]));
+  EXPECT_EQ(0, watcher_.DelayReads(fds_[0], READ_DELAY));
+  Write(1);
+  std::this_thread::sleep_for(READ_DELAY * 5);
+  EXPECT_EQ(0, reads_);
+
+  EXPECT_EQ(0, watcher_.ResumeReadingFd(fds_[0]));
+  EXPECT_TRUE(WaitForReads(1));
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,139 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "bt_vendor_fake.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+
+namespace {
+
+using android::hardware::bluetooth::test::FakeController;
+using android::hardware::bluetooth::test::FakeVendorConfig;
+
+const uint16_t HCI_RESET_OPCODE = 0x0C03;
+// Event code, length, credits and opcode come before the status.
+const size_t COMMAND_COMPLETE_STATUS_OFFSET = 5;
+
+const bt_vendor_callbacks_t* callbacks = nullptr;
+FakeVendorConfig config;
+std::unique_ptr<FakeController> controller;
+int host_fd = -1;
+
+void OnResetComplete(void* p_mem) {
+  HC_BT_HDR* event = static_cast<HC_BT_HDR*>(p_mem);
+  const uint8_t* data = event->data + event->offset;
+  bool success = event->len > COMMAND_COMPLETE_STATUS_OFFSET &&
+                 data[COMMAND_COMPLETE_STATUS_OFFSET] == 0 &&
+                 config.firmware_config_succeeds;
+  callbacks->dealloc(event);
+  callbacks->fwcfg_cb(success ? BT_VND_OP_RESULT_SUCCESS
+                              : BT_VND_OP_RESULT_FAIL);
+}
+
+int OpenUart(int* fds) {
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets)) {
+    ALOGE("%s unable to create the socketpair: %s", __func__,
+          strerror(errno));
+    return 0;
+  }
+  host_fd = sockets[0];
+  controller.reset(new FakeController(sockets[1]));
+  fds[CH_CMD] = host_fd;
+  return 1;
+}
+
+void CloseUart() {
+  if (host_fd == -1) return;
+  close(host_fd);
+  host_fd = -1;
+  controller.reset();
+}
+
+void ConfigureFirmware() {
+  HC_BT_HDR* packet = static_cast<HC_BT_HDR*>(
+      callbacks->alloc(sizeof(HC_BT_HDR) + HCI_COMMAND_PREAMBLE_SIZE));
+  packet->event = 0;
+  packet->offset = 0;
+  packet->layer_specific = 0;
+  packet->len = HCI_COMMAND_PREAMBLE_SIZE;
+  packet->data[0] = HCI_RESET_OPCODE & 0xFF;
+  packet->data[1] = HCI_RESET_OPCODE >> 8;
+  packet->data[2] = 0;
+  callbacks->xmit_cb(HCI_RESET_OPCODE, packet, OnResetComplete);
+}
+
+int Init(const bt_vendor_callbacks_t* p_cb, unsigned char* local_bdaddr) {
+  callbacks = p_cb;
+  const unsigned char address[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+  memcpy(local_bdaddr, address, sizeof(address));
+  return 0;
+}
+
+int Op(bt_vendor_opcode_t opcode, void* param) {
+  switch (opcode) {
+    case BT_VND_OP_USERIAL_OPEN:
+      return OpenUart(static_cast<int*>(param));
+    case BT_VND_OP_USERIAL_CLOSE:
+      CloseUart();
+      return 0;
+    case BT_VND_OP_FW_CFG:
+      ConfigureFirmware();
+      return 0;
+    case BT_VND_OP_SCO_CFG:
+      if (config.answer_sco_config) {
+        callbacks->scocfg_cb(BT_VND_OP_RESULT_SUCCESS);
+      }
+      return 0;
+    case BT_VND_OP_GET_LPM_IDLE_TIMEOUT:
+      *static_cast<uint32_t*>(param) = 3000;
+      return 0;
+    default:
+      return 0;
+  }
+}
+
+void Cleanup() {
+  CloseUart();
+  callbacks = nullptr;
+}
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+FakeVendorConfig& GetFakeVendorConfig() { return config; }
+
+FakeController* GetFakeController() { return controller.get(); }
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
+
+const bt_vendor_interface_t BLUETOOTH_VENDOR_LIB_INTERFACE = {
+    sizeof(bt_vendor_interface_t), Init, Op, Cleanup};
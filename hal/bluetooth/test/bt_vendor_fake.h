@@ -0,0 +1,44 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include "fake_controller.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+// Host stand-in for libbt-vendor.so. The tests link it with that soname, so
+// the dlopen() of VendorInterface gets the same instance. Opening the UART
+// starts a FakeController on a socketpair, the firmware configuration is a
+// HCI_Reset sent through the HAL.
+struct FakeVendorConfig {
+  // Completes BT_VND_OP_SCO_CFG at once, otherwise never.
+  bool answer_sco_config = true;
+  // Result reported for BT_VND_OP_FW_CFG.
+  bool firmware_config_succeeds = true;
+};
+
+FakeVendorConfig& GetFakeVendorConfig();
+// The controller of the open UART, nullptr while it is closed.
+FakeController* GetFakeController();
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
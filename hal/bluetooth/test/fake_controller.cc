@@ -0,0 +1,297 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "fake_controller.h"
+
+#define LOG_TAG "BluetoothHAL"
+
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+const uint16_t HCI_READ_BUFFER_SIZE_OPCODE = 0x1005;
+const uint8_t HCI_NUMBER_OF_COMPLETED_PACKETS_EVENT = 0x13;
+const uint8_t HCI_VENDOR_SPECIFIC_EVENT = 0xFF;
+const uint8_t SCO_BUFFER_SIZE = 64;
+const uint16_t SCO_BUFFERS = 4;
+
+bool ReadFully(int fd, uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t ret = TEMP_FAILURE_RETRY(read(fd, data, length));
+    if (ret <= 0) return false;
+    data += ret;
+    length -= ret;
+  }
+  return true;
+}
+
+size_t PreambleSize(HciPacketType type) {
+  switch (type) {
+    case HCI_PACKET_TYPE_COMMAND:
+      return HCI_COMMAND_PREAMBLE_SIZE;
+    case HCI_PACKET_TYPE_ACL_DATA:
+      return HCI_ACL_PREAMBLE_SIZE;
+    case HCI_PACKET_TYPE_SCO_DATA:
+      return HCI_SCO_PREAMBLE_SIZE;
+    case HCI_PACKET_TYPE_EVENT:
+      return HCI_EVENT_PREAMBLE_SIZE;
+    default:
+      return 0;
+  }
+}
+
+size_t PayloadSize(HciPacketType type, const uint8_t* preamble) {
+  switch (type) {
+    case HCI_PACKET_TYPE_COMMAND:
+      return preamble[HCI_LENGTH_OFFSET_CMD];
+    case HCI_PACKET_TYPE_ACL_DATA:
+      return preamble[HCI_LENGTH_OFFSET_ACL] |
+             (preamble[HCI_LENGTH_OFFSET_ACL + 1] << 8);
+    case HCI_PACKET_TYPE_SCO_DATA:
+      return preamble[HCI_LENGTH_OFFSET_SCO];
+    default:
+      return preamble[HCI_LENGTH_OFFSET_EVT];
+  }
+}
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+FakeController::FakeController(int fd) : mct_(false) {
+  for (int i = 0; i < CH_MAX; i++) fds_[i] = fd;
+  readers_.emplace_back(
+      [this, fd]() { ReadRoutine(fd, HCI_PACKET_TYPE_UNKNOWN); });
+}
+
+FakeController::FakeController(const int (&fds)[CH_MAX]) : mct_(true) {
+  for (int i = 0; i < CH_MAX; i++) fds_[i] = fds[i];
+  readers_.emplace_back([this]() {
+    ReadRoutine(fds_[CH_CMD], HCI_PACKET_TYPE_COMMAND);
+  });
+  readers_.emplace_back([this]() {
+    ReadRoutine(fds_[CH_ACL_OUT], HCI_PACKET_TYPE_ACL_DATA);
+  });
+}
+
+FakeController::~FakeController() {
+  // Unblocks the readers and the streams if the host end is still open.
+  Disconnect();
+  for (std::thread& thread : streams_) thread.join();
+  for (std::thread& thread : readers_) thread.join();
+
+  close(fds_[CH_CMD]);
+  if (mct_) {
+    for (int i = CH_CMD + 1; i < CH_MAX; i++) close(fds_[i]);
+  }
+}
+
+int64_t FakeController::NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool FakeController::ReadStamp(HciPacketType type, const uint8_t* packet,
+                               size_t length, Stamp* stamp) {
+  size_t preamble_size = PreambleSize(type);
+  if (length < preamble_size + sizeof(Stamp)) return false;
+  memcpy(stamp, packet + preamble_size, sizeof(Stamp));
+  return true;
+}
+
+void FakeController::SendEvent(uint8_t code,
+                               const std::vector<uint8_t>& parameters) {
+  std::vector<uint8_t> event = {code, static_cast<uint8_t>(parameters.size())};
+  event.insert(event.end(), parameters.begin(), parameters.end());
+  Write(HCI_PACKET_TYPE_EVENT, event.data(), event.size());
+}
+
+void FakeController::WriteRaw(const uint8_t* data, size_t length) {
+  std::unique_lock<std::mutex> guard(write_mutex_);
+  while (length > 0) {
+    ssize_t ret = TEMP_FAILURE_RETRY(
+        send(fds_[CH_EVT], data, length, MSG_NOSIGNAL));
+    if (ret < 0) return;
+    data += ret;
+    length -= ret;
+  }
+}
+
+void FakeController::Disconnect() {
+  for (int i = 0; i < CH_MAX; i++) shutdown(fds_[i], SHUT_RDWR);
+}
+
+void FakeController::Write(HciPacketType type, const uint8_t* data,
+                           size_t length) {
+  int fd = fds_[type == HCI_PACKET_TYPE_EVENT ? CH_EVT : CH_ACL_IN];
+  uint8_t type_byte = type;
+  struct iovec iov[2] = {{&type_byte, 1},
+                         {const_cast<uint8_t*>(data), length}};
+  struct msghdr msg = {};
+  msg.msg_iov = mct_ ? iov + 1 : iov;
+  msg.msg_iovlen = mct_ ? 1 : 2;
+
+  std::unique_lock<std::mutex> guard(write_mutex_);
+  while (msg.msg_iovlen > 0) {
+    ssize_t ret = TEMP_FAILURE_RETRY(sendmsg(fd, &msg, MSG_NOSIGNAL));
+    if (ret < 0) return;
+    // Skip what was written, a stream socket may take part of a packet.
+    while (msg.msg_iovlen > 0 &&
+           static_cast<size_t>(ret) >= msg.msg_iov->iov_len) {
+      ret -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base =
+          static_cast<uint8_t*>(msg.msg_iov->iov_base) + ret;
+      msg.msg_iov->iov_len -= ret;
+    }
+  }
+}
+
+void FakeController::StreamAcl(uint16_t handle, size_t size, size_t count,
+                               uint32_t packets_per_second) {
+  streams_.emplace_back([=]() {
+    Stream(HCI_PACKET_TYPE_ACL_DATA, handle, size, count, packets_per_second);
+  });
+}
+
+void FakeController::StreamSco(uint16_t handle, size_t size, size_t count,
+                               uint32_t packets_per_second) {
+  streams_.emplace_back([=]() {
+    Stream(HCI_PACKET_TYPE_SCO_DATA, handle, size, count, packets_per_second);
+  });
+}
+
+void FakeController::StreamEvents(size_t count, uint32_t events_per_second) {
+  streams_.emplace_back([=]() {
+    Stream(HCI_PACKET_TYPE_EVENT, 0, sizeof(Stamp), count, events_per_second);
+  });
+}
+
+void FakeController::WaitForStreams() {
+  for (std::thread& thread : streams_) thread.join();
+  streams_.clear();
+}
+
+void FakeController::Stream(HciPacketType type, uint16_t handle, size_t size,
+                            size_t count, uint32_t packets_per_second) {
+  size_t preamble_size = PreambleSize(type);
+  std::vector<uint8_t> packet(preamble_size + std::max(size, sizeof(Stamp)));
+  size_t payload_size = packet.size() - preamble_size;
+  if (type == HCI_PACKET_TYPE_EVENT) {
+    packet[0] = HCI_VENDOR_SPECIFIC_EVENT;
+    packet[1] = payload_size;
+  } else {
+    packet[0] = handle & 0xFF;
+    packet[1] = (handle >> 8) & 0x0F;
+    packet[2] = payload_size & 0xFF;
+    if (type == HCI_PACKET_TYPE_ACL_DATA) packet[3] = payload_size >> 8;
+  }
+  for (size_t i = preamble_size + sizeof(Stamp); i < packet.size(); i++) {
+    packet[i] = i;
+  }
+
+  auto period = std::chrono::nanoseconds(
+      packets_per_second ? 1000000000LL / packets_per_second : 0);
+  auto next = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < count; i++) {
+    if (period.count() > 0) {
+      std::this_thread::sleep_until(next);
+      next += period;
+    }
+    Stamp stamp = {static_cast<uint32_t>(i), NowNs()};
+    memcpy(packet.data() + preamble_size, &stamp, sizeof(stamp));
+    Write(type, packet.data(), packet.size());
+  }
+}
+
+void FakeController::ReadRoutine(int fd, HciPacketType packet_type) {
+  std::vector<uint8_t> payload;
+  while (true) {
+    HciPacketType type = packet_type;
+    if (type == HCI_PACKET_TYPE_UNKNOWN) {
+      uint8_t type_byte;
+      if (!ReadFully(fd, &type_byte, 1)) return;
+      type = static_cast<HciPacketType>(type_byte);
+    }
+
+    uint8_t preamble[HCI_PREAMBLE_SIZE_MAX];
+    size_t preamble_size = PreambleSize(type);
+    if (preamble_size == 0) {
+      ALOGE("%s: host sent packet type %d", __func__, type);
+      return;
+    }
+    if (!ReadFully(fd, preamble, preamble_size)) return;
+    payload.resize(PayloadSize(type, preamble));
+    if (!ReadFully(fd, payload.data(), payload.size())) return;
+
+    if (type == HCI_PACKET_TYPE_COMMAND) {
+      OnCommand(preamble[0] | (preamble[1] << 8));
+    } else if (type == HCI_PACKET_TYPE_ACL_DATA) {
+      OnAclData((preamble[0] | (preamble[1] << 8)) & 0x0FFF);
+    }
+  }
+}
+
+void FakeController::OnCommand(uint16_t opcode) {
+  {
+    std::unique_lock<std::mutex> guard(stats_mutex_);
+    commands_[opcode]++;
+  }
+
+  uint8_t opcode_lo = opcode & 0xFF;
+  uint8_t opcode_hi = opcode >> 8;
+  if (opcode == HCI_READ_BUFFER_SIZE_OPCODE) {
+    SendEvent(HCI_COMMAND_COMPLETE_EVENT,
+              {1, opcode_lo, opcode_hi, 0, ACL_BUFFER_SIZE & 0xFF,
+               ACL_BUFFER_SIZE >> 8, SCO_BUFFER_SIZE, ACL_BUFFERS & 0xFF,
+               ACL_BUFFERS >> 8, SCO_BUFFERS & 0xFF, SCO_BUFFERS >> 8});
+    return;
+  }
+  SendEvent(HCI_COMMAND_COMPLETE_EVENT, {1, opcode_lo, opcode_hi, 0});
+}
+
+void FakeController::OnAclData(uint16_t handle) {
+  received_acl_++;
+  SendEvent(HCI_NUMBER_OF_COMPLETED_PACKETS_EVENT,
+            {1, static_cast<uint8_t>(handle & 0xFF),
+             static_cast<uint8_t>(handle >> 8), 1, 0});
+}
+
+size_t FakeController::GetCommandCount(uint16_t opcode) {
+  std::unique_lock<std::mutex> guard(stats_mutex_);
+  auto it = commands_.find(opcode);
+  return it == commands_.end() ? 0 : it->second;
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,113 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bt_vendor_lib.h"
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+// Controller end of a HCI transport for host tests, the HAL gets the other
+// end of socketpairs instead of the UART. Every command is answered with a
+// successful Command Complete, Read_Buffer_Size with the buffers of a WL18xx.
+// ACL data from the host gets its credit back at once. ACL, SCO and vendor
+// event streams are written at a given rate, every payload starts with a
+// Stamp so that the receiver can check the order and measure the latency.
+class FakeController {
+ public:
+  struct Stamp {
+    uint32_t sequence;
+    int64_t sent_ns;
+  };
+
+  // H4, fd is the controller end of one socketpair.
+  explicit FakeController(int fd);
+  // MCT, fds are the controller ends indexed like the channels of
+  // BT_VND_OP_USERIAL_OPEN. Only H4 carries SCO.
+  explicit FakeController(const int (&fds)[CH_MAX]);
+  ~FakeController();
+
+  static const size_t ACL_BUFFER_SIZE = 1021;
+  static const uint16_t ACL_BUFFERS = 8;
+
+  void SendEvent(uint8_t code, const std::vector<uint8_t>& parameters);
+  // Writes bytes as they are, with the H4 type byte if any. With MCT they go
+  // to the event channel.
+  void WriteRaw(const uint8_t* data, size_t length);
+  // Shuts the channels down, the host reads EOF as if the UART failed.
+  void Disconnect();
+
+  // Streams count packets of size bytes, at least sizeof(Stamp), from a
+  // thread of their own. With a zero rate they are written back to back.
+  void StreamAcl(uint16_t handle, size_t size, size_t count,
+                 uint32_t packets_per_second);
+  void StreamSco(uint16_t handle, size_t size, size_t count,
+                 uint32_t packets_per_second);
+  // Vendor specific events carrying only the Stamp.
+  void StreamEvents(size_t count, uint32_t events_per_second);
+  void WaitForStreams();
+
+  size_t GetCommandCount(uint16_t opcode);
+  size_t GetReceivedAclCount() const { return received_acl_.load(); }
+
+  static int64_t NowNs();
+  // The stamp written at the start of the payload of a received packet.
+  static bool ReadStamp(HciPacketType type, const uint8_t* packet,
+                        size_t length, Stamp* stamp);
+
+ private:
+  FakeController(const FakeController&) = delete;
+  FakeController& operator=(const FakeController&) = delete;
+
+  // Reads a channel of the host until it is closed, packet_type is
+  // HCI_PACKET_TYPE_UNKNOWN when every packet starts with its type.
+  void ReadRoutine(int fd, HciPacketType packet_type);
+  void OnCommand(uint16_t opcode);
+  void OnAclData(uint16_t handle);
+
+  void Write(HciPacketType type, const uint8_t* data, size_t length);
+  void Stream(HciPacketType type, uint16_t handle, size_t size, size_t count,
+              uint32_t packets_per_second);
+
+  bool mct_;
+  int fds_[CH_MAX];
+  std::vector<std::thread> readers_;
+  std::vector<std::thread> streams_;
+
+  // Packets of several threads must not interleave on the channel.
+  std::mutex write_mutex_;
+  std::mutex stats_mutex_;
+  std::map<uint16_t, size_t> commands_;
+  std::atomic<size_t> received_acl_{0};
+};
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
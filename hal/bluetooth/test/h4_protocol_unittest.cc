@@ -0,0 +1,191 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define LOG_TAG "bt_h4_unittest"
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "async_fd_watcher.h"
+#include "fake_controller.h"
+#include "h4_protocol.h"
+#include "packet_sink.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::bluetooth::async::AsyncFdWatcher;
+using ::android::hardware::bluetooth::hci::H4Protocol;
+
+namespace {
+
+const uint16_t HCI_RESET_OPCODE = 0x0C03;
+const uint8_t HCI_INQUIRY_COMPLETE_EVENT = 0x01;
+const uint8_t HCI_RESET[] = {0x03, 0x0C, 0x00};
+
+}  // namespace
+
+class H4ProtocolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    int sockets[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets));
+    host_fd_ = sockets[0];
+    controller_.reset(new FakeController(sockets[1]));
+    h4_.reset(new H4Protocol(host_fd_, sink_.Callback(HCI_PACKET_TYPE_EVENT),
+                             sink_.Callback(HCI_PACKET_TYPE_ACL_DATA),
+                             sink_.Callback(HCI_PACKET_TYPE_SCO_DATA)));
+    // Wired like VendorInterface does.
+    h4_->SetRxFlowCallback([this](bool stop_reading) {
+      if (stop_reading) {
+        flow_stops_++;
+        watcher_.StopReadingFd(host_fd_);
+      } else {
+        watcher_.ResumeReadingFd(host_fd_);
+      }
+    });
+    watcher_.WatchFdForNonBlockingReads(host_fd_, [this](int fd) {
+      h4_->OnDataReady(fd);
+      watcher_.DelayReads(fd, h4_->NextReadDelay());
+    });
+  }
+
+  void TearDown() override {
+    watcher_.StopWatchingFileDescriptors();
+    h4_.reset();
+    close(host_fd_);
+    controller_.reset();
+  }
+
+  PacketSink sink_;
+  int host_fd_ = -1;
+  std::atomic<int> flow_stops_{0};
+  std::unique_ptr<FakeController> controller_;
+  std::unique_ptr<H4Protocol> h4_;
+  AsyncFdWatcher watcher_;
+};
+
+TEST_F(H4ProtocolTest, CommandIsAnswered) {
+  ASSERT_EQ(sizeof(HCI_RESET),
+            h4_->Send(HCI_PACKET_TYPE_COMMAND, HCI_RESET, sizeof(HCI_RESET)));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+
+  std::vector<uint8_t> event = sink_.Get(HCI_PACKET_TYPE_EVENT)[0];
+  std::vector<uint8_t> expected = {HCI_COMMAND_COMPLETE_EVENT, 4, 1, 0x03,
+                                   0x0C, 0};
+  EXPECT_EQ(expected, event);
+  EXPECT_EQ(1u, controller_->GetCommandCount(HCI_RESET_OPCODE));
+}
+
+TEST_F(H4ProtocolTest, AclStreamArrivesInOrder) {
+  const size_t count = 2000;
+  controller_->StreamAcl(1, 1021, count, 0);
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_ACL_DATA, count));
+  ExpectInOrder(HCI_PACKET_TYPE_ACL_DATA,
+                sink_.Get(HCI_PACKET_TYPE_ACL_DATA), 1021);
+}
+
+TEST_F(H4ProtocolTest, ScoAndAclInterleave) {
+  controller_->StreamAcl(1, 600, 500, 5000);
+  controller_->StreamSco(2, 60, 500, 5000);
+  controller_->SendEvent(HCI_INQUIRY_COMPLETE_EVENT, {0});
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_ACL_DATA, 500));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_SCO_DATA, 500));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  ExpectInOrder(HCI_PACKET_TYPE_ACL_DATA,
+                sink_.Get(HCI_PACKET_TYPE_ACL_DATA), 600);
+  ExpectInOrder(HCI_PACKET_TYPE_SCO_DATA,
+                sink_.Get(HCI_PACKET_TYPE_SCO_DATA), 60);
+}
+
+TEST_F(H4ProtocolTest, SlowStackStopsReadingInsteadOfDropping) {
+  const size_t count = 1000;
+  sink_.SetDelay(std::chrono::microseconds(500));
+  controller_->StreamAcl(1, 1021, count, 0);
+  for (int i = 0; i < 300; i++) {
+    controller_->SendEvent(HCI_INQUIRY_COMPLETE_EVENT, {0});
+  }
+
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_ACL_DATA, count));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 300));
+  EXPECT_GT(flow_stops_, 0);
+  ExpectInOrder(HCI_PACKET_TYPE_ACL_DATA,
+                sink_.Get(HCI_PACKET_TYPE_ACL_DATA), 1021);
+}
+
+TEST_F(H4ProtocolTest, SlowStackDropsOnlyLateSco) {
+  sink_.SetDelay(std::chrono::microseconds(500));
+  controller_->StreamSco(2, 60, 500, 0);
+  controller_->SendEvent(HCI_INQUIRY_COMPLETE_EVENT, {0});
+
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  auto sco = sink_.Get(HCI_PACKET_TYPE_SCO_DATA);
+  EXPECT_LT(sco.size(), 500u);
+  EXPECT_EQ(0, flow_stops_);
+}
+
+TEST_F(H4ProtocolTest, ImplausiblePreambleIsNotDelivered) {
+  // A valid type byte, but no event has code 0.
+  const uint8_t garbage[] = {HCI_PACKET_TYPE_EVENT, 0x00, 0x00};
+  controller_->WriteRaw(garbage, sizeof(garbage));
+  controller_->SendEvent(HCI_INQUIRY_COMPLETE_EVENT, {0});
+
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  std::vector<uint8_t> expected = {HCI_INQUIRY_COMPLETE_EVENT, 1, 0};
+  EXPECT_EQ(expected, sink_.Get(HCI_PACKET_TYPE_EVENT)[0]);
+}
+
+TEST_F(H4ProtocolTest, PacketSplitAcrossReads) {
+  const uint8_t event[] = {HCI_PACKET_TYPE_EVENT, HCI_INQUIRY_COMPLETE_EVENT,
+                           1, 0};
+  for (uint8_t byte : event) {
+    controller_->WriteRaw(&byte, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  std::vector<uint8_t> expected = {HCI_INQUIRY_COMPLETE_EVENT, 1, 0};
+  EXPECT_EQ(expected, sink_.Get(HCI_PACKET_TYPE_EVENT)[0]);
+}
+
+TEST_F(H4ProtocolTest, ResynchronizesAfterGarbage) {
+  // Not a packet type, then a type byte without a plausible preamble.
+  const uint8_t garbage[] = {0x00, 0x7F, HCI_PACKET_TYPE_EVENT, 0x00, 0x00};
+  controller_->WriteRaw(garbage, sizeof(garbage));
+  controller_->SendEvent(HCI_INQUIRY_COMPLETE_EVENT, {0});
+  controller_->StreamAcl(1, 100, 10, 0);
+
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_ACL_DATA, 10));
+  std::vector<uint8_t> expected = {HCI_INQUIRY_COMPLETE_EVENT, 1, 0};
+  EXPECT_EQ(expected, sink_.Get(HCI_PACKET_TYPE_EVENT)[0]);
+  ExpectInOrder(HCI_PACKET_TYPE_ACL_DATA,
+                sink_.Get(HCI_PACKET_TYPE_ACL_DATA), 100);
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
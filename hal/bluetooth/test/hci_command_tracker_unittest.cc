@@ -0,0 +1,138 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define LOG_TAG "bt_command_tracker_unittest"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "hci_buffer_pool.h"
+#include "hci_command_tracker.h"
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::hidl_vec;
+using ::android::hardware::bluetooth::hci::HciBufferPool;
+using ::android::hardware::bluetooth::hci::HciCommandTracker;
+
+namespace {
+
+const std::chrono::milliseconds COMMAND_TIMEOUT(50);
+
+const uint16_t HCI_RESET_OPCODE = 0x0C03;
+const uint16_t HCI_READ_BD_ADDR_OPCODE = 0x1009;
+const uint16_t HCI_HOST_NUMBER_OF_COMPLETED_PACKETS_OPCODE = 0x0C35;
+
+hidl_vec<uint8_t> CommandComplete(uint8_t credits, uint16_t opcode) {
+  std::vector<uint8_t> event = {HCI_COMMAND_COMPLETE_EVENT,
+                                4,
+                                credits,
+                                static_cast<uint8_t>(opcode & 0xFF),
+                                static_cast<uint8_t>(opcode >> 8),
+                                0};
+  return event;
+}
+
+}  // namespace
+
+class HciCommandTrackerTest : public ::testing::Test {
+ protected:
+  HciCommandTrackerTest()
+      : tracker_(
+            [this](const uint8_t* data, size_t length) {
+              std::unique_lock<std::mutex> guard(mutex_);
+              sent_.push_back(data[0] | (data[1] << 8));
+              cv_.notify_all();
+            },
+            COMMAND_TIMEOUT) {}
+
+  void SendInternal(uint16_t opcode) {
+    const uint8_t command[] = {static_cast<uint8_t>(opcode & 0xFF),
+                               static_cast<uint8_t>(opcode >> 8), 0};
+    void* buffer = HciBufferPool::Get().Allocate(sizeof(command));
+    memcpy(buffer, command, sizeof(command));
+    tracker_.SendInternal(opcode, buffer, static_cast<uint8_t*>(buffer),
+                          sizeof(command), [this](const hidl_vec<uint8_t>&) {
+                            std::unique_lock<std::mutex> guard(mutex_);
+                            completed_++;
+                            cv_.notify_all();
+                          });
+  }
+
+  size_t SentCount() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    return sent_.size();
+  }
+
+  bool WaitForCompleted(size_t count) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    return cv_.wait_for(guard, std::chrono::seconds(5),
+                        [this, count]() { return completed_ >= count; });
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<uint16_t> sent_;
+  size_t completed_ = 0;
+  HciCommandTracker tracker_;
+};
+
+TEST_F(HciCommandTrackerTest, TimeoutDoesNotReturnTheCredit) {
+  SendInternal(HCI_RESET_OPCODE);
+  SendInternal(HCI_READ_BD_ADDR_OPCODE);
+  ASSERT_EQ(1u, SentCount());
+
+  // The reset is failed to the vendor library, the controller may still be
+  // busy with it so the second command waits.
+  ASSERT_TRUE(WaitForCompleted(1));
+  EXPECT_EQ(1u, SentCount());
+
+  EXPECT_FALSE(tracker_.OnEventReceived(CommandComplete(1, 0)));
+  EXPECT_EQ(2u, SentCount());
+}
+
+TEST_F(HciCommandTrackerTest, CreditsTakenFromTheNextCompletion) {
+  tracker_.OnStackCommandSent(HCI_RESET_OPCODE);
+  SendInternal(HCI_READ_BD_ADDR_OPCODE);
+  EXPECT_EQ(0u, SentCount());
+
+  EXPECT_FALSE(tracker_.OnEventReceived(CommandComplete(1, HCI_RESET_OPCODE)));
+  EXPECT_EQ(1u, SentCount());
+  EXPECT_TRUE(
+      tracker_.OnEventReceived(CommandComplete(1, HCI_READ_BD_ADDR_OPCODE)));
+  EXPECT_TRUE(WaitForCompleted(1));
+}
+
+TEST_F(HciCommandTrackerTest, UnansweredCommandIsNotTracked) {
+  tracker_.OnStackCommandSent(HCI_HOST_NUMBER_OF_COMPLETED_PACKETS_OPCODE);
+  SendInternal(HCI_RESET_OPCODE);
+  EXPECT_EQ(1u, SentCount());
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,237 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define LOG_TAG "bt_transport_benchmark"
+
+#include <benchmark/benchmark.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "async_fd_watcher.h"
+#include "fake_controller.h"
+#include "h4_protocol.h"
+#include "mct_protocol.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::hidl_vec;
+using ::android::hardware::bluetooth::async::AsyncFdWatcher;
+using ::android::hardware::bluetooth::hci::H4Protocol;
+using ::android::hardware::bluetooth::hci::MctProtocol;
+
+namespace {
+
+// Packets streamed per benchmark iteration.
+const size_t BURST = 256;
+
+// Counts the packets of a type reaching the stack callback and the time
+// from their write by the fake controller.
+class Receiver {
+ public:
+  explicit Receiver(HciPacketType type) : type_(type) {}
+
+  hci::PacketReadCallback Callback() {
+    return [this](const hidl_vec<uint8_t>& packet) {
+      int64_t now = FakeController::NowNs();
+      FakeController::Stamp stamp;
+      std::unique_lock<std::mutex> guard(mutex_);
+      if (FakeController::ReadStamp(type_, packet.data(), packet.size(),
+                                    &stamp)) {
+        latencies_ns_.push_back(now - stamp.sent_ns);
+      }
+      count_++;
+      cv_.notify_all();
+    };
+  }
+
+  void WaitFor(size_t count) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    cv_.wait(guard, [this, count]() { return count_ >= count; });
+  }
+
+  // Reports the latency percentiles in microseconds.
+  void ReportLatency(benchmark::State& state) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (latencies_ns_.empty()) return;
+    std::sort(latencies_ns_.begin(), latencies_ns_.end());
+    auto percentile = [this](size_t percent) {
+      size_t index = (latencies_ns_.size() - 1) * percent / 100;
+      return latencies_ns_[index] / 1000.0;
+    };
+    state.counters["p50_us"] = percentile(50);
+    state.counters["p99_us"] = percentile(99);
+    state.counters["max_us"] = percentile(100);
+  }
+
+ private:
+  HciPacketType type_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t count_ = 0;
+  std::vector<int64_t> latencies_ns_;
+};
+
+// H4Protocol read by the fd watcher as in the service, on a socketpair with
+// a FakeController.
+class H4Transport {
+ public:
+  explicit H4Transport(Receiver& acl) : events_(HCI_PACKET_TYPE_EVENT) {
+    int sockets[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets);
+    host_fd_ = sockets[0];
+    controller_.reset(new FakeController(sockets[1]));
+    h4_.reset(new H4Protocol(host_fd_, events_.Callback(), acl.Callback(),
+                             [](const hidl_vec<uint8_t>&) {}));
+    watcher_.WatchFdForNonBlockingReads(host_fd_, [this](int fd) {
+      h4_->OnDataReady(fd);
+      watcher_.DelayReads(fd, h4_->NextReadDelay());
+    });
+  }
+
+  ~H4Transport() {
+    watcher_.StopWatchingFileDescriptors();
+    h4_.reset();
+    close(host_fd_);
+    controller_.reset();
+  }
+
+  FakeController& controller() { return *controller_; }
+
+ private:
+  Receiver events_;
+  int host_fd_ = -1;
+  std::unique_ptr<FakeController> controller_;
+  std::unique_ptr<H4Protocol> h4_;
+  AsyncFdWatcher watcher_;
+};
+
+// MctProtocol with its fds watched as in the service, the event channel
+// above the ACL one.
+class MctTransport {
+ public:
+  MctTransport(Receiver& events, Receiver& acl) {
+    int controller_fds[CH_MAX];
+    for (int i = 0; i < CH_MAX; i++) {
+      int sockets[2];
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets);
+      host_fds_[i] = sockets[0];
+      controller_fds[i] = sockets[1];
+    }
+    controller_.reset(new FakeController(controller_fds));
+    mct_.reset(new MctProtocol(host_fds_, events.Callback(), acl.Callback()));
+    watcher_.WatchFdForNonBlockingReads(
+        host_fds_[CH_EVT], [this](int fd) { mct_->OnEventDataReady(fd); }, 1,
+        8);
+    watcher_.WatchFdForNonBlockingReads(host_fds_[CH_ACL_IN], [this](int fd) {
+      mct_->OnAclDataReady(fd);
+      watcher_.DelayReads(fd, mct_->NextAclReadDelay());
+    });
+  }
+
+  ~MctTransport() {
+    watcher_.StopWatchingFileDescriptors();
+    mct_.reset();
+    for (int fd : host_fds_) close(fd);
+    controller_.reset();
+  }
+
+  FakeController& controller() { return *controller_; }
+
+ private:
+  int host_fds_[CH_MAX];
+  std::unique_ptr<FakeController> controller_;
+  std::unique_ptr<MctProtocol> mct_;
+  AsyncFdWatcher watcher_;
+};
+
+}  // namespace
+
+// Maximum sustained ACL throughput, the controller writes back to back.
+static void BM_H4AclThroughput(benchmark::State& state) {
+  size_t size = state.range(0);
+  Receiver acl(HCI_PACKET_TYPE_ACL_DATA);
+  H4Transport transport(acl);
+
+  size_t expected = 0;
+  for (auto _ : state) {
+    expected += BURST;
+    transport.controller().StreamAcl(1, size, BURST, 0);
+    acl.WaitFor(expected);
+    transport.controller().WaitForStreams();
+  }
+  state.SetBytesProcessed(state.iterations() * BURST *
+                          (size + HCI_ACL_PREAMBLE_SIZE + 1));
+  state.SetItemsProcessed(state.iterations() * BURST);
+  acl.ReportLatency(state);
+}
+BENCHMARK(BM_H4AclThroughput)->Arg(27)->Arg(251)->Arg(1021)->UseRealTime();
+
+// Per packet latency at a paced rate, as a link streaming A2DP would be.
+static void BM_H4AclLatency(benchmark::State& state) {
+  uint32_t packets_per_second = state.range(0);
+  Receiver acl(HCI_PACKET_TYPE_ACL_DATA);
+  H4Transport transport(acl);
+
+  size_t expected = 0;
+  for (auto _ : state) {
+    expected += BURST;
+    transport.controller().StreamAcl(1, 1021, BURST, packets_per_second);
+    acl.WaitFor(expected);
+    transport.controller().WaitForStreams();
+  }
+  state.SetItemsProcessed(state.iterations() * BURST);
+  acl.ReportLatency(state);
+}
+BENCHMARK(BM_H4AclLatency)->Arg(200)->Arg(2000)->Iterations(4)->UseRealTime();
+
+// Latency of events, paced as the completions of a busy stack would be,
+// while the controller writes ACL back to back on the other channel.
+static void BM_MctEventLatencyUnderAclLoad(benchmark::State& state) {
+  Receiver events(HCI_PACKET_TYPE_EVENT);
+  Receiver acl(HCI_PACKET_TYPE_ACL_DATA);
+  MctTransport transport(events, acl);
+
+  size_t expected = 0;
+  for (auto _ : state) {
+    expected += BURST;
+    transport.controller().StreamAcl(1, 1021, BURST * 8, 0);
+    transport.controller().StreamEvents(BURST, 2000);
+    events.WaitFor(expected);
+    acl.WaitFor(expected * 8);
+    transport.controller().WaitForStreams();
+  }
+  state.SetItemsProcessed(state.iterations() * BURST);
+  events.ReportLatency(state);
+}
+BENCHMARK(BM_MctEventLatencyUnderAclLoad)->Iterations(4)->UseRealTime();
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,99 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define LOG_TAG "bt_mct_unittest"
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "async_fd_watcher.h"
+#include "fake_controller.h"
+#include "mct_protocol.h"
+#include "packet_sink.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::bluetooth::async::AsyncFdWatcher;
+using ::android::hardware::bluetooth::hci::MctProtocol;
+
+namespace {
+
+const uint16_t HCI_RESET_OPCODE = 0x0C03;
+const uint8_t HCI_RESET[] = {0x03, 0x0C, 0x00};
+
+}  // namespace
+
+class MctProtocolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    int controller_fds[CH_MAX];
+    for (int i = 0; i < CH_MAX; i++) {
+      int sockets[2];
+      ASSERT_EQ(0,
+                socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets));
+      host_fds_[i] = sockets[0];
+      controller_fds[i] = sockets[1];
+    }
+    controller_.reset(new FakeController(controller_fds));
+    mct_.reset(new MctProtocol(host_fds_,
+                               sink_.Callback(HCI_PACKET_TYPE_EVENT),
+                               sink_.Callback(HCI_PACKET_TYPE_ACL_DATA)));
+    watcher_.WatchFdForNonBlockingReads(
+        host_fds_[CH_EVT], [this](int fd) { mct_->OnEventDataReady(fd); },
+        1, 8);
+    watcher_.WatchFdForNonBlockingReads(host_fds_[CH_ACL_IN], [this](int fd) {
+      mct_->OnAclDataReady(fd);
+      watcher_.DelayReads(fd, mct_->NextAclReadDelay());
+    });
+  }
+
+  void TearDown() override {
+    watcher_.StopWatchingFileDescriptors();
+    mct_.reset();
+    for (int fd : host_fds_) close(fd);
+    controller_.reset();
+  }
+
+  PacketSink sink_;
+  int host_fds_[CH_MAX];
+  std::unique_ptr<FakeController> controller_;
+  std::unique_ptr<MctProtocol> mct_;
+  AsyncFdWatcher watcher_;
+};
+
+TEST_F(MctProtocolTest, CommandAndAcl) {
+  ASSERT_EQ(sizeof(HCI_RESET),
+            mct_->Send(HCI_PACKET_TYPE_COMMAND, HCI_RESET, sizeof(HCI_RESET)));
+  controller_->StreamAcl(1, 1021, 500, 0);
+
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_ACL_DATA, 500));
+  EXPECT_EQ(1u, controller_->GetCommandCount(HCI_RESET_OPCODE));
+  ExpectInOrder(HCI_PACKET_TYPE_ACL_DATA,
+                sink_.Get(HCI_PACKET_TYPE_ACL_DATA), 1021);
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,92 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fake_controller.h"
+#include "hci_internals.h"
+#include "hci_protocol.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::hidl_vec;
+
+const std::chrono::seconds TIMEOUT(5);
+
+// Packets received through the HAL callbacks, by type.
+class PacketSink {
+ public:
+  hci::PacketReadCallback Callback(HciPacketType type) {
+    return [this, type](const hidl_vec<uint8_t>& packet) {
+      // A stack which is slow to take the packets.
+      std::this_thread::sleep_for(delay_);
+      std::unique_lock<std::mutex> guard(mutex_);
+      packets_[type].emplace_back(packet.begin(), packet.end());
+      cv_.notify_all();
+    };
+  }
+
+  bool WaitFor(HciPacketType type, size_t count) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    return cv_.wait_for(guard, TIMEOUT, [this, type, count]() {
+      return packets_[type].size() >= count;
+    });
+  }
+
+  void SetDelay(std::chrono::microseconds delay) { delay_ = delay; }
+
+  std::vector<std::vector<uint8_t>> Get(HciPacketType type) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    return packets_[type];
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::vector<uint8_t>> packets_[HCI_PACKET_TYPE_EVENT + 1];
+  std::chrono::microseconds delay_{0};
+};
+
+inline void ExpectInOrder(HciPacketType type,
+                   const std::vector<std::vector<uint8_t>>& packets,
+                   size_t payload_size) {
+  for (size_t i = 0; i < packets.size(); i++) {
+    FakeController::Stamp stamp;
+    ASSERT_TRUE(FakeController::ReadStamp(type, packets[i].data(),
+                                          packets[i].size(), &stamp));
+    EXPECT_EQ(i, stamp.sequence);
+    EXPECT_EQ(payload_size, packets[i].size() -
+                                (type == HCI_PACKET_TYPE_ACL_DATA
+                                     ? HCI_ACL_PREAMBLE_SIZE
+                                     : HCI_SCO_PREAMBLE_SIZE));
+  }
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,157 @@
+//
+// Copyright 2019 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#define LOG_TAG "bt_vendor_interface_unittest"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bt_vendor_fake.h"
+#include "fake_controller.h"
+#include "packet_sink.h"
+#include "vendor_interface.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace test {
+
+using ::android::hardware::bluetooth::V1_0::kingfisher::VendorInterface;
+
+namespace {
+
+const uint16_t HCI_RESET_OPCODE = 0x0C03;
+const uint8_t HCI_ESCO_CONNECTION_COMPLETE_EVENT = 0x2C;
+const uint8_t HCI_INQUIRY_COMPLETE_EVENT = 0x01;
+const uint8_t HCI_RESET[] = {0x03, 0x0C, 0x00};
+
+}  // namespace
+
+class VendorInterfaceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    GetFakeVendorConfig() = FakeVendorConfig();
+  }
+
+  void TearDown() override {
+    if (VendorInterface::get() != nullptr) VendorInterface::Shutdown();
+  }
+
+  bool Initialize() {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool completed = false;
+    bool success = false;
+    bool opened = VendorInterface::Initialize(
+        [&](bool result) {
+          std::unique_lock<std::mutex> guard(mutex);
+          completed = true;
+          success = result;
+          cv.notify_all();
+        },
+        sink_.Callback(HCI_PACKET_TYPE_EVENT),
+        sink_.Callback(HCI_PACKET_TYPE_ACL_DATA),
+        sink_.Callback(HCI_PACKET_TYPE_SCO_DATA));
+    if (!opened) return false;
+
+    std::unique_lock<std::mutex> guard(mutex);
+    return cv.wait_for(guard, TIMEOUT, [&]() { return completed; }) &&
+           success;
+  }
+
+  PacketSink sink_;
+};
+
+TEST_F(VendorInterfaceTest, FirmwareConfiguredThroughTheLibrary) {
+  ASSERT_TRUE(Initialize());
+  ASSERT_NE(nullptr, GetFakeController());
+  // The reset of the library was answered without reaching the stack.
+  EXPECT_EQ(1u, GetFakeController()->GetCommandCount(HCI_RESET_OPCODE));
+  EXPECT_TRUE(sink_.Get(HCI_PACKET_TYPE_EVENT).empty());
+
+  VendorInterface::get()->Send(HCI_PACKET_TYPE_COMMAND, HCI_RESET,
+                               sizeof(HCI_RESET));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  EXPECT_EQ(2u, GetFakeController()->GetCommandCount(HCI_RESET_OPCODE));
+
+  GetFakeController()->StreamAcl(1, 1021, 200, 0);
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_ACL_DATA, 200));
+  ExpectInOrder(HCI_PACKET_TYPE_ACL_DATA,
+                sink_.Get(HCI_PACKET_TYPE_ACL_DATA), 1021);
+}
+
+TEST_F(VendorInterfaceTest, FailedFirmwareConfigurationIsReported) {
+  GetFakeVendorConfig().firmware_config_succeeds = false;
+  EXPECT_FALSE(Initialize());
+}
+
+TEST_F(VendorInterfaceTest, TransportResetAfterUartFailure) {
+  ASSERT_TRUE(Initialize());
+  GetFakeController()->Disconnect();
+
+  // The firmware is configured again before the stack hears of it.
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  std::vector<uint8_t> expected = {HCI_HARDWARE_ERROR_EVENT, 1, 0x00};
+  EXPECT_EQ(expected, sink_.Get(HCI_PACKET_TYPE_EVENT)[0]);
+  EXPECT_EQ(1u, GetFakeController()->GetCommandCount(HCI_RESET_OPCODE));
+
+  VendorInterface::get()->Send(HCI_PACKET_TYPE_COMMAND, HCI_RESET,
+                               sizeof(HCI_RESET));
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 2));
+}
+
+TEST_F(VendorInterfaceTest, FailedTransportResetIsReported) {
+  ASSERT_TRUE(Initialize());
+  GetFakeVendorConfig().firmware_config_succeeds = false;
+  GetFakeController()->Disconnect();
+
+  // Reported instead of aborting the service, nothing is sent any more.
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 1));
+  std::vector<uint8_t> expected = {HCI_HARDWARE_ERROR_EVENT, 1, 0x01};
+  EXPECT_EQ(expected, sink_.Get(HCI_PACKET_TYPE_EVENT)[0]);
+  EXPECT_EQ(nullptr, GetFakeController());
+  EXPECT_EQ(0u, VendorInterface::get()->Send(HCI_PACKET_TYPE_COMMAND,
+                                             HCI_RESET, sizeof(HCI_RESET)));
+}
+
+TEST_F(VendorInterfaceTest, EventsReleasedWhenScoConfigurationHangs) {
+  GetFakeVendorConfig().answer_sco_config = false;
+  ASSERT_TRUE(Initialize());
+
+  // Status 0, the air mode is the last parameter.
+  std::vector<uint8_t> esco(17, 0);
+  GetFakeController()->SendEvent(HCI_ESCO_CONNECTION_COMPLETE_EVENT, esco);
+  GetFakeController()->SendEvent(HCI_INQUIRY_COMPLETE_EVENT, {0});
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_TRUE(sink_.Get(HCI_PACKET_TYPE_EVENT).empty());
+
+  // Nothing else arrives, the timer alone has to release both in order.
+  ASSERT_TRUE(sink_.WaitFor(HCI_PACKET_TYPE_EVENT, 2));
+  auto events = sink_.Get(HCI_PACKET_TYPE_EVENT);
+  EXPECT_EQ(HCI_ESCO_CONNECTION_COMPLETE_EVENT, events[0][0]);
+  EXPECT_EQ(HCI_INQUIRY_COMPLETE_EVENT, events[1][0]);
+}
+
+}  // namespace test
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
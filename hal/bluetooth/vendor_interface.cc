@@ -22,10 +22,18 @@
 
 #include <dlfcn.h>
 #include <fcntl.h>
-#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <shared_mutex>
 
 #include "bluetooth_address.h"
 #include "h4_protocol.h"
+#include "hci_buffer_pool.h"
+#include "hci_telemetry.h"
 #include "mct_protocol.h"
 
 #define HCI_ESCO_CONNECTION_COMP_EVT 0x2C
@@ -37,72 +45,116 @@ static const char* VENDOR_LIBRARY_SYMBOL_NAME =
 
 static const int INVALID_FD = -1;
 
+// With MCT the event channel is drained before every ACL read, so that
+// events are not delayed by a saturated ACL channel.
+static const int MCT_EVENT_PRIORITY = 1;
+static const int MCT_EVENT_READ_BUDGET = 8;
+
+// Vendor commands without an answer are failed after that long.
+static const std::chrono::milliseconds INTERNAL_COMMAND_TIMEOUT(3000);
+
+// SCO over H4 is released at the audio rate unless this is false.
+static const char* SCO_PACING_PROPERTY = "vendor.bluetooth.sco_pacing";
+
+// Transmission interval in slots, TX packet length and air mode in the eSCO
+// Connection Complete event parameters.
+static const size_t ESCO_INTERVAL_OFFSET = 12;
+static const size_t ESCO_TX_LENGTH_OFFSET = 16;
+static const size_t ESCO_AIR_MODE_OFFSET = 18;
+
+static const char* PREWARM_PROPERTY = "vendor.bluetooth.prewarm";
+static const char* FIRMWARE_PATH_PROPERTY = "vendor.bluetooth.firmware_path";
+static const char* DEFAULT_FIRMWARE_PATH =
+    "/vendor/firmware/ti-connectivity/TIInit_11.8.32.bts";
+
+// TI BTS firmware script layout
+static const uint32_t BTS_MAGIC = 0x42535442;  // "BTSB"
+static const size_t BTS_HEADER_SIZE = 32;
+static const size_t BTS_ACTION_HEADER_SIZE = 4;
+static const uint16_t BTS_ACTION_SEND_COMMAND = 1;
+
+// A transport reset has to have the firmware configured again within the
+// time the last download took times this factor, and never less than the
+// minimum. The transport is given up otherwise.
+static const int RECOVERY_TIMEOUT_FACTOR = 3;
+static const std::chrono::milliseconds MIN_RECOVERY_TIMEOUT(5000);
+
+// Hardware codes of the Hardware Error event after a transport reset, and
+// after a reset which failed. The stack restarts the HAL on the latter.
+static const uint8_t TRANSPORT_RESET_HARDWARE_CODE = 0x00;
+static const uint8_t TRANSPORT_FAILED_HARDWARE_CODE = 0x01;
+
+// Events are only held back that long for a vendor SCO configuration, a
+// timer releases them if the library never completes it.
+static const std::chrono::milliseconds SCO_CONFIG_TIMEOUT(1000);
+
 namespace {
 
 using android::hardware::hidl_vec;
+using android::hardware::bluetooth::hci::HciBufferPool;
+using android::hardware::bluetooth::hci::HciTelemetry;
 using android::hardware::bluetooth::V1_0::kingfisher::VendorInterface;
 
-std::mutex mtx;
-std::condition_variable cv;
-bool sco_cfg_status;
-bool get_sco_cfg_status() {return sco_cfg_status;}
+// False when LPM is not enabled yet or wake is not asserted. Send() only
+// stores last_send_ns and checks the state, asserting wake is its only slow
+// path. Received data never touches last_send_ns: every read of a watched fd
+// pushes the watcher timeout back, so OnTimeout() only runs once nothing was
+// received for lpm_timeout_ms, and it deasserts wake if nothing was sent in
+// that time either.
+std::atomic<bool> lpm_wake_asserted;
+uint32_t lpm_timeout_ms;
+std::atomic<int64_t> last_send_ns;
 
-typedef struct {
-  tINT_CMD_CBACK cb;
-  uint16_t opcode;
-} command_callback_t;
+int64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
-std::queue<command_callback_t>* internal_commands;
+VendorInterface* g_vendor_interface = nullptr;
 
-// True when LPM is not enabled yet or wake is not asserted.
-bool lpm_wake_deasserted;
-uint32_t lpm_timeout_ms;
-bool recent_activity_flag;
+// Vendor library loaded by VendorInterface::Prewarm(), kept loaded across
+// Open() and Close() so that enabling Bluetooth does not pay for dlopen().
+void* prewarmed_lib_handle = nullptr;
+bt_vendor_interface_t* prewarmed_lib_interface = nullptr;
 
-VendorInterface* g_vendor_interface = nullptr;
+// Firmware script mapped and locked in memory, the vendor library reads it
+// from the page cache instead of the flash.
+void* firmware_map = nullptr;
+size_t firmware_size = 0;
 std::mutex wakeup_mutex_;
 
-HC_BT_HDR* WrapPacketAndCopy(uint16_t event, const hidl_vec<uint8_t>& data) {
-  size_t packet_size = data.size() + sizeof(HC_BT_HDR);
-  HC_BT_HDR* packet = reinterpret_cast<HC_BT_HDR*>(new uint8_t[packet_size]);
+static_assert(sizeof(HC_BT_HDR) == HCI_PACKET_HEADROOM,
+              "received packets have no room for the HC_BT_HDR");
+
+// Received packets are lent to the vendor library in place, the header goes
+// in the headroom the packetizer left in front of them and the buffer stays
+// allocated until both the library and the dispatcher freed it. Synthesized
+// events are copied into a pool buffer.
+HC_BT_HDR* WrapPacket(uint16_t event, const hidl_vec<uint8_t>& data) {
+  HC_BT_HDR* packet = nullptr;
+  void* buffer = HciBufferPool::Get().Retain(data.data());
+  if (buffer != nullptr &&
+      static_cast<uint8_t*>(buffer) + sizeof(HC_BT_HDR) == data.data()) {
+    packet = static_cast<HC_BT_HDR*>(buffer);
+  } else {
+    HciBufferPool::Get().Free(buffer);
+    packet = static_cast<HC_BT_HDR*>(
+        HciBufferPool::Get().Allocate(data.size() + sizeof(HC_BT_HDR)));
+    memcpy(packet->data, data.data(), data.size());
+  }
   packet->offset = 0;
   packet->len = data.size();
   packet->layer_specific = 0;
   packet->event = event;
-  // TODO(eisenbach): Avoid copy here; if BT_HDR->data can be ensured to
-  // be the only way the data is accessed, a pointer could be passed here...
-  memcpy(packet->data, data.data(), data.size());
   return packet;
 }
 
-bool internal_command_event_match(const hidl_vec<uint8_t>& packet) {
-  if (internal_commands->empty()) {
-    return false;
-  }
-
-  uint8_t event_code = packet[0];
-  if (event_code != HCI_COMMAND_COMPLETE_EVENT) {
-    ALOGE("%s: Unhandled event type %02X", __func__, event_code);
-    return false;
-  }
-
-  size_t opcode_offset = HCI_EVENT_PREAMBLE_SIZE + 1;  // Skip num packets.
-
-  uint16_t opcode = packet[opcode_offset] | (packet[opcode_offset + 1] << 8);
-
-  ALOGV("%s internal_commands->front().opcode = %04X opcode = %04x", __func__,
-        internal_commands->front().opcode, opcode);
-  return opcode == internal_commands->front().opcode;
-}
-
 uint8_t transmit_cb(uint16_t opcode, void* buffer, tINT_CMD_CBACK callback) {
   ALOGV("%s opcode: 0x%04x, ptr: %p, cb: %p", __func__, opcode, buffer,
         callback);
-  internal_commands->push({callback, opcode});
-  uint8_t type = HCI_PACKET_TYPE_COMMAND;
-  HC_BT_HDR* bt_hdr = reinterpret_cast<HC_BT_HDR*>(buffer);
-  VendorInterface::get()->Send(type, bt_hdr->data, bt_hdr->len);
-  delete[] reinterpret_cast<uint8_t*>(buffer);
+  VendorInterface::get()->SendInternalCommand(
+      opcode, reinterpret_cast<HC_BT_HDR*>(buffer), callback);
   return true;
 }
 
@@ -112,12 +164,9 @@ void firmware_config_cb(bt_vendor_op_result_t result) {
 }
 
 void sco_config_cb(bt_vendor_op_result_t result) {
-  if (result == BT_VND_OP_RESULT_SUCCESS) {
-    sco_cfg_status = true;
-  } else {
-    ALOGE("SCO Configuration failed");
-  }
   ALOGD("%s result: %d", __func__, result);
+  VendorInterface* vendor_interface = VendorInterface::get();
+  if (vendor_interface) vendor_interface->OnScoConfigured(result);
 }
 
 void low_power_mode_cb(bt_vendor_op_result_t result) {
@@ -129,14 +178,14 @@ void sco_audiostate_cb(bt_vendor_op_result_t result) {
 }
 
 void* buffer_alloc_cb(int size) {
-  void* p = new uint8_t[size];
+  void* p = HciBufferPool::Get().Allocate(size);
   ALOGV("%s pts: %p, size: %d", __func__, p, size);
   return p;
 }
 
 void buffer_free_cb(void* buffer) {
   ALOGV("%s ptr: %p", __func__, buffer);
-  delete[] reinterpret_cast<uint8_t*>(buffer);
+  HciBufferPool::Get().Free(buffer);
 }
 
 void epilog_cb(bt_vendor_op_result_t result) {
@@ -179,6 +228,60 @@ const std::vector<uint8_t> generate_fake_vendor_capabilities_event(void) {
   return buffer;
 }
 
+// Returns the number of HCI commands in a BTS script, -1 if it is malformed.
+int count_bts_commands(const uint8_t* data, size_t size) {
+  if (size < BTS_HEADER_SIZE) return -1;
+  uint32_t magic = data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+  if (magic != BTS_MAGIC) return -1;
+
+  int commands = 0;
+  size_t offset = BTS_HEADER_SIZE;
+  while (offset + BTS_ACTION_HEADER_SIZE <= size) {
+    uint16_t type = data[offset] | (data[offset + 1] << 8);
+    uint16_t length = data[offset + 2] | (data[offset + 3] << 8);
+    offset += BTS_ACTION_HEADER_SIZE + length;
+    if (type == BTS_ACTION_SEND_COMMAND) commands++;
+  }
+  return offset == size ? commands : -1;
+}
+
+void cache_firmware() {
+  char path[PROPERTY_VALUE_MAX];
+  property_get(FIRMWARE_PATH_PROPERTY, path, DEFAULT_FIRMWARE_PATH);
+
+  int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_CLOEXEC));
+  if (fd == INVALID_FD) {
+    ALOGW("%s unable to open %s: %s", __func__, path, strerror(errno));
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    firmware_size = st.st_size;
+    firmware_map = mmap(nullptr, firmware_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (firmware_map == nullptr || firmware_map == MAP_FAILED) {
+    ALOGW("%s unable to map %s: %s", __func__, path, strerror(errno));
+    firmware_map = nullptr;
+    return;
+  }
+
+  // Locking may exceed RLIMIT_MEMLOCK, the pages are still read in then.
+  if (mlock(firmware_map, firmware_size)) {
+    madvise(firmware_map, firmware_size, MADV_WILLNEED);
+  }
+
+  int commands = count_bts_commands(
+      static_cast<const uint8_t*>(firmware_map), firmware_size);
+  if (commands < 0) {
+    ALOGW("%s: %s is not a valid BTS script", __func__, path);
+  } else {
+    ALOGI("%s: %s cached, %zu bytes, %d commands", __func__, path,
+          firmware_size, commands);
+  }
+}
+
 const bt_vendor_callbacks_t lib_callbacks = {
     sizeof(lib_callbacks), firmware_config_cb, sco_config_cb,
     low_power_mode_cb,     sco_audiostate_cb,  buffer_alloc_cb,
@@ -205,6 +308,11 @@ class FirmwareStartupTimer {
     ALOGI("Firmware configured in %.3fs", s);
   }
 
+  std::chrono::milliseconds Elapsed() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time_);
+  }
+
  private:
   std::chrono::steady_clock::time_point start_time_;
 };
@@ -232,6 +340,30 @@ void VendorInterface::Shutdown() {
 
 VendorInterface* VendorInterface::get() { return g_vendor_interface; }
 
+void VendorInterface::Prewarm() {
+  if (!property_get_bool(PREWARM_PROPERTY, false)) return;
+
+  prewarmed_lib_handle = dlopen(VENDOR_LIBRARY_NAME, RTLD_NOW);
+  if (!prewarmed_lib_handle) {
+    ALOGE("%s unable to open %s (%s)", __func__, VENDOR_LIBRARY_NAME,
+          dlerror());
+    return;
+  }
+
+  prewarmed_lib_interface = reinterpret_cast<bt_vendor_interface_t*>(
+      dlsym(prewarmed_lib_handle, VENDOR_LIBRARY_SYMBOL_NAME));
+  if (!prewarmed_lib_interface) {
+    ALOGE("%s unable to find symbol %s in %s (%s)", __func__,
+          VENDOR_LIBRARY_SYMBOL_NAME, VENDOR_LIBRARY_NAME, dlerror());
+    dlclose(prewarmed_lib_handle);
+    prewarmed_lib_handle = nullptr;
+    return;
+  }
+
+  cache_firmware();
+  ALOGI("%s vendor library preloaded", __func__);
+}
+
 bool VendorInterface::Open(InitializeCompleteCallback initialize_complete_cb,
                            PacketReadCallback event_cb,
                            PacketReadCallback acl_cb,
@@ -240,19 +372,23 @@ bool VendorInterface::Open(InitializeCompleteCallback initialize_complete_cb,
 
   // Initialize vendor interface
 
-  lib_handle_ = dlopen(VENDOR_LIBRARY_NAME, RTLD_NOW);
-  if (!lib_handle_) {
-    ALOGE("%s unable to open %s (%s)", __func__, VENDOR_LIBRARY_NAME,
-          dlerror());
-    return false;
-  }
+  if (prewarmed_lib_interface != nullptr) {
+    lib_interface_ = prewarmed_lib_interface;
+  } else {
+    lib_handle_ = dlopen(VENDOR_LIBRARY_NAME, RTLD_NOW);
+    if (!lib_handle_) {
+      ALOGE("%s unable to open %s (%s)", __func__, VENDOR_LIBRARY_NAME,
+            dlerror());
+      return false;
+    }
 
-  lib_interface_ = reinterpret_cast<bt_vendor_interface_t*>(
-      dlsym(lib_handle_, VENDOR_LIBRARY_SYMBOL_NAME));
-  if (!lib_interface_) {
-    ALOGE("%s unable to find symbol %s in %s (%s)", __func__,
-          VENDOR_LIBRARY_SYMBOL_NAME, VENDOR_LIBRARY_NAME, dlerror());
-    return false;
+    lib_interface_ = reinterpret_cast<bt_vendor_interface_t*>(
+        dlsym(lib_handle_, VENDOR_LIBRARY_SYMBOL_NAME));
+    if (!lib_interface_) {
+      ALOGE("%s unable to find symbol %s in %s (%s)", __func__,
+            VENDOR_LIBRARY_SYMBOL_NAME, VENDOR_LIBRARY_NAME, dlerror());
+      return false;
+    }
   }
 
   // Get the local BD address
@@ -271,6 +407,33 @@ bool VendorInterface::Open(InitializeCompleteCallback initialize_complete_cb,
   int power_state = BT_VND_PWR_ON;
   lib_interface_->op(BT_VND_OP_POWER_CTRL, &power_state);
 
+  command_tracker_ = new hci::HciCommandTracker(
+      [this](const uint8_t* data, size_t length) {
+        Transmit(HCI_PACKET_TYPE_COMMAND, data, length);
+      },
+      INTERNAL_COMMAND_TIMEOUT);
+
+  event_cb_ = event_cb;
+  acl_cb_ = acl_cb;
+  sco_cb_ = sco_cb;
+
+  sco_config_timer_fd_ =
+      timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (sco_config_timer_fd_ == INVALID_FD) {
+    ALOGE("%s unable to create the SCO timer: %s", __func__, strerror(errno));
+    return false;
+  }
+
+  if (!OpenTransport()) return false;
+
+  // Start configuring the firmware
+  firmware_startup_timer_ = new FirmwareStartupTimer();
+  lib_interface_->op(BT_VND_OP_FW_CFG, nullptr);
+
+  return true;
+}
+
+bool VendorInterface::OpenTransport() {
   // Get the UART socket(s)
 
   int fd_list[CH_MAX] = {0};
@@ -288,40 +451,193 @@ bool VendorInterface::Open(InitializeCompleteCallback initialize_complete_cb,
     }
   }
 
-  internal_commands = new std::queue<command_callback_t>();
-
-  event_cb_ = event_cb;
   PacketReadCallback intercept_events = [this](const hidl_vec<uint8_t>& event) {
     HandleIncomingEvent(event);
   };
+  hci::TransportErrorCallback transport_error = [this](int fd) {
+    OnTransportError(fd);
+  };
+  // While the stack catches up the UART is not read and RTS/CTS holds the
+  // controller. A failed transport stays stopped for the recovery.
+  auto rx_flow = [this](std::vector<int> fds) -> hci::RxFlowCallback {
+    return [this, fds](bool stop_reading) {
+      for (int fd : fds) {
+        if (stop_reading) {
+          fd_watcher_.StopReadingFd(fd);
+        } else if (!recovering_) {
+          fd_watcher_.ResumeReadingFd(fd);
+        }
+      }
+    };
+  };
 
+  hci::HciProtocol* hci = nullptr;
   if (fd_count == 1) {
     hci::H4Protocol* h4_hci =
-        new hci::H4Protocol(fd_list[0], intercept_events, acl_cb, sco_cb);
-    fd_watcher_.WatchFdForNonBlockingReads(
-        fd_list[0], [h4_hci](int fd) { h4_hci->OnDataReady(fd); });
-    hci_ = h4_hci;
+        new hci::H4Protocol(fd_list[0], intercept_events, acl_cb_, sco_cb_);
+    h4_hci->SetTransportErrorCallback(transport_error);
+    h4_hci->SetRxFlowCallback(rx_flow({fd_list[0]}));
+    fd_watcher_.WatchFdForNonBlockingReads(fd_list[0], [this, h4_hci](int fd) {
+      h4_hci->OnDataReady(fd);
+      fd_watcher_.DelayReads(fd, h4_hci->NextReadDelay());
+    });
+    hci = h4_hci;
+
+    // MCT controllers route SCO over PCM, only H4 carries it.
+    if (sco_pacer_ == nullptr &&
+        property_get_bool(SCO_PACING_PROPERTY, true)) {
+      sco_pacer_ = new hci::HciScoPacer(
+          [this](const uint8_t* data, size_t length) {
+            Transmit(HCI_PACKET_TYPE_SCO_DATA, data, length);
+          });
+    }
   } else {
     hci::MctProtocol* mct_hci =
-        new hci::MctProtocol(fd_list, intercept_events, acl_cb);
+        new hci::MctProtocol(fd_list, intercept_events, acl_cb_);
+    mct_hci->SetTransportErrorCallback(transport_error);
+    mct_hci->SetRxFlowCallback(rx_flow({fd_list[CH_EVT], fd_list[CH_ACL_IN]}));
     fd_watcher_.WatchFdForNonBlockingReads(
-        fd_list[CH_EVT], [mct_hci](int fd) { mct_hci->OnEventDataReady(fd); });
+        fd_list[CH_EVT], [mct_hci](int fd) { mct_hci->OnEventDataReady(fd); },
+        MCT_EVENT_PRIORITY, MCT_EVENT_READ_BUDGET);
     fd_watcher_.WatchFdForNonBlockingReads(
-        fd_list[CH_ACL_IN], [mct_hci](int fd) { mct_hci->OnAclDataReady(fd); });
-    hci_ = mct_hci;
+        fd_list[CH_ACL_IN], [this, mct_hci](int fd) {
+          mct_hci->OnAclDataReady(fd);
+          fd_watcher_.DelayReads(fd, mct_hci->NextAclReadDelay());
+        });
+    hci = mct_hci;
   }
 
-  // Initially, the power management is off.
-  lpm_wake_deasserted = true;
+  // Re-registered with the UART fds, the recovery stops watching all of them.
+  fd_watcher_.WatchFdForNonBlockingReads(
+      sco_config_timer_fd_, [this](int) { OnScoConfigTimeout(); });
 
-  // Start configuring the firmware
-  firmware_startup_timer_ = new FirmwareStartupTimer();
-  lib_interface_->op(BT_VND_OP_FW_CFG, nullptr);
+  {
+    std::unique_lock<std::shared_mutex> guard(transport_mutex_);
+    hci_ = hci;
+  }
 
+  // Initially, the power management is off.
+  lpm_wake_asserted = false;
   return true;
 }
 
+void VendorInterface::CloseTransport() {
+  hci::HciProtocol* hci;
+  {
+    // Senders holding the transport finish first, later ones see none.
+    std::unique_lock<std::shared_mutex> guard(transport_mutex_);
+    hci = hci_;
+    hci_ = nullptr;
+  }
+  // Joins the RX dispatcher, whose callbacks may still try to send.
+  delete hci;
+}
+
+void VendorInterface::OnTransportError(int fd) {
+  // Runs on the watcher thread, which the recovery has to stop.
+  fd_watcher_.StopReadingFd(fd);
+
+  std::unique_lock<std::mutex> guard(recovery_mutex_);
+  if (recovering_ || closing_) return;
+  recovering_ = true;
+  firmware_configured_ = false;
+  if (recovery_thread_.joinable()) recovery_thread_.join();
+  recovery_thread_ = std::thread([this]() { RecoverTransport(); });
+}
+
+void VendorInterface::RecoverTransport() {
+  auto start = std::chrono::steady_clock::now();
+  ALOGE("%s: resetting the transport", __func__);
+
+  bt_vendor_lpm_mode_t mode = BT_VND_LPM_DISABLE;
+  lib_interface_->op(BT_VND_OP_LPM_SET_MODE, &mode);
+  fd_watcher_.StopWatchingFileDescriptors();
+  command_tracker_->Reset();
+  CloseTransport();
+  {
+    std::unique_lock<std::mutex> lock(event_mutex_);
+    sco_config_pending_ = false;
+    replaying_events_ = false;
+    deferred_events_.clear();
+  }
+
+  // The controller state is unknown, it gets the firmware again. The vendor
+  // library and the firmware file are still loaded, so this takes as long
+  // as the download over the UART.
+  lib_interface_->op(BT_VND_OP_USERIAL_CLOSE, nullptr);
+  int power_state = BT_VND_PWR_OFF;
+  lib_interface_->op(BT_VND_OP_POWER_CTRL, &power_state);
+  power_state = BT_VND_PWR_ON;
+  lib_interface_->op(BT_VND_OP_POWER_CTRL, &power_state);
+
+  bool recovered = OpenTransport();
+  if (recovered) {
+    firmware_startup_timer_ = new FirmwareStartupTimer();
+    lib_interface_->op(BT_VND_OP_FW_CFG, nullptr);
+  }
+
+  std::unique_lock<std::mutex> guard(recovery_mutex_);
+  if (recovered) {
+    // The download runs over the UART, it takes about as long as the last.
+    auto timeout = std::max(MIN_RECOVERY_TIMEOUT,
+                            firmware_duration_ * RECOVERY_TIMEOUT_FACTOR);
+    recovered = recovery_cv_.wait_for(guard, timeout, [this]() {
+      return firmware_configured_ || closing_;
+    });
+    if (!recovered) {
+      ALOGE("%s: firmware not configured within %lld ms", __func__,
+            static_cast<long long>(timeout.count()));
+    }
+  }
+  if (closing_) {
+    recovering_ = false;
+    return;
+  }
+  if (!recovered || firmware_result_ != 0) {
+    guard.unlock();
+    FailTransport();
+    return;
+  }
+
+  auto duration = std::chrono::steady_clock::now() - start;
+  HciTelemetry::Get().RecordTransportRecovery(duration);
+  ALOGI("%s: transport reset in %lld ms", __func__,
+        static_cast<long long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+                .count()));
+  recovering_ = false;
+  guard.unlock();
+
+  // The stack resets the controller and its own state on a hardware error.
+  std::vector<uint8_t> hardware_error = {HCI_HARDWARE_ERROR_EVENT, 1,
+                                         TRANSPORT_RESET_HARDWARE_CODE};
+  DeliverEvent(hardware_error);
+}
+
+void VendorInterface::FailTransport() {
+  ALOGE("%s: transport reset failed, giving up the controller", __func__);
+
+  // Sends keep being refused until the stack closes the HAL.
+  fd_watcher_.StopWatchingFileDescriptors();
+  command_tracker_->Reset();
+  CloseTransport();
+  lib_interface_->op(BT_VND_OP_USERIAL_CLOSE, nullptr);
+  int power_state = BT_VND_PWR_OFF;
+  lib_interface_->op(BT_VND_OP_POWER_CTRL, &power_state);
+
+  std::vector<uint8_t> hardware_error = {HCI_HARDWARE_ERROR_EVENT, 1,
+                                         TRANSPORT_FAILED_HARDWARE_CODE};
+  DeliverEvent(hardware_error);
+}
+
 void VendorInterface::Close() {
+  {
+    std::unique_lock<std::mutex> guard(recovery_mutex_);
+    closing_ = true;
+  }
+  recovery_cv_.notify_all();
+  if (recovery_thread_.joinable()) recovery_thread_.join();
+
   // These callbacks may send HCI events (vendor-dependent), so make sure to
   // StopWatching the file descriptor after this.
   if (lib_interface_ != nullptr) {
@@ -331,9 +647,19 @@ void VendorInterface::Close() {
 
   fd_watcher_.StopWatchingFileDescriptors();
 
-  if (hci_ != nullptr) {
-    delete hci_;
-    hci_ = nullptr;
+  // Nothing may be sent or timed out once the transport is gone.
+  if (command_tracker_ != nullptr) command_tracker_->Reset();
+
+  if (sco_pacer_ != nullptr) {
+    delete sco_pacer_;
+    sco_pacer_ = nullptr;
+  }
+
+  CloseTransport();
+
+  if (command_tracker_ != nullptr) {
+    delete command_tracker_;
+    command_tracker_ = nullptr;
   }
 
   if (lib_interface_ != nullptr) {
@@ -356,34 +682,78 @@ void VendorInterface::Close() {
     firmware_startup_timer_ = nullptr;
   }
 
-  if (internal_commands != nullptr) {
-    delete internal_commands;
-    internal_commands = nullptr;
+  if (sco_config_timer_fd_ != INVALID_FD) {
+    close(sco_config_timer_fd_);
+    sco_config_timer_fd_ = INVALID_FD;
   }
+
+  std::unique_lock<std::mutex> lock(event_mutex_);
+  sco_config_pending_ = false;
+  replaying_events_ = false;
+  deferred_events_.clear();
 }
 
 size_t VendorInterface::Send(uint8_t type, const uint8_t* data, size_t length) {
-  std::unique_lock<std::mutex> lock(wakeup_mutex_);
-  recent_activity_flag = true;
+  // The stack learns about the reset from a Hardware Error event.
+  if (recovering_) return 0;
 
-  if (lpm_wake_deasserted == true) {
-    // Restart the timer.
-    fd_watcher_.ConfigureTimeout(std::chrono::milliseconds(lpm_timeout_ms),
-                                 [this]() { OnTimeout(); });
-    // Assert wake.
-    lpm_wake_deasserted = false;
-    bt_vendor_lpm_wake_state_t wakeState = BT_VND_LPM_WAKE_ASSERT;
-    lib_interface_->op(BT_VND_OP_LPM_WAKE_SET_STATE, &wakeState);
-    ALOGV("%s: Sent wake before (%02x)", __func__, data[0] | (data[1] << 8));
+  if (type == HCI_PACKET_TYPE_COMMAND && length >= 2) {
+    command_tracker_->OnStackCommandSent(data[0] | (data[1] << 8));
+  }
+  if (type == HCI_PACKET_TYPE_SCO_DATA && sco_pacer_ != nullptr) {
+    sco_pacer_->Send(data, length);
+    return length;
   }
+  return Transmit(type, data, length);
+}
+
+void VendorInterface::SendInternalCommand(uint16_t opcode, HC_BT_HDR* packet,
+                                          tINT_CMD_CBACK callback) {
+  // The command is written straight from the buffer of the vendor library.
+  command_tracker_->SendInternal(
+      opcode, packet, packet->data + packet->offset, packet->len,
+      [callback](const hidl_vec<uint8_t>& event) {
+        HC_BT_HDR* bt_hdr = WrapPacket(HCI_PACKET_TYPE_EVENT, event);
+        if (callback) {
+          callback(bt_hdr);
+        } else {
+          HciBufferPool::Get().Free(bt_hdr);
+        }
+      });
+}
+
+size_t VendorInterface::Transmit(uint8_t type, const uint8_t* data,
+                                 size_t length) {
+  last_send_ns = NowNs();
+  // Pairs with the re-check in OnTimeout(), either the timer sees this send
+  // or this sees that wake was deasserted.
+  if (!lpm_wake_asserted) AssertWake();
 
+  std::shared_lock<std::shared_mutex> guard(transport_mutex_);
+  if (hci_ == nullptr) return 0;
   return hci_->Send(type, data, length);
 }
 
+void VendorInterface::AssertWake() {
+  std::unique_lock<std::mutex> lock(wakeup_mutex_);
+  if (lpm_wake_asserted) return;
+
+  // Restart the timer.
+  fd_watcher_.ConfigureTimeout(std::chrono::milliseconds(lpm_timeout_ms),
+                               [this]() { OnTimeout(); });
+  bt_vendor_lpm_wake_state_t wakeState = BT_VND_LPM_WAKE_ASSERT;
+  lib_interface_->op(BT_VND_OP_LPM_WAKE_SET_STATE, &wakeState);
+  lpm_wake_asserted = true;
+  HciTelemetry::Get().RecordLpmWake();
+  ALOGV("%s: Sent wake", __func__);
+}
+
 void VendorInterface::OnFirmwareConfigured(uint8_t result) {
   ALOGD("%s result: %d", __func__, result);
 
+  std::chrono::milliseconds firmware_duration(0);
   if (firmware_startup_timer_ != nullptr) {
+    firmware_duration = firmware_startup_timer_->Elapsed();
     delete firmware_startup_timer_;
     firmware_startup_timer_ = nullptr;
   }
@@ -402,47 +772,159 @@ void VendorInterface::OnFirmwareConfigured(uint8_t result) {
   ALOGD("%s Calling StartLowPowerWatchdog()", __func__);
   fd_watcher_.ConfigureTimeout(std::chrono::milliseconds(lpm_timeout_ms),
                                [this]() { OnTimeout(); });
+
+  {
+    std::unique_lock<std::mutex> guard(recovery_mutex_);
+    firmware_configured_ = true;
+    firmware_result_ = result;
+    if (result == 0) firmware_duration_ = firmware_duration;
+  }
+  recovery_cv_.notify_all();
 }
 
 void VendorInterface::OnTimeout() {
   ALOGV("%s", __func__);
   std::unique_lock<std::mutex> lock(wakeup_mutex_);
-  if (recent_activity_flag == false) {
-    lpm_wake_deasserted = true;
-    bt_vendor_lpm_wake_state_t wakeState = BT_VND_LPM_WAKE_DEASSERT;
-    lib_interface_->op(BT_VND_OP_LPM_WAKE_SET_STATE, &wakeState);
-    fd_watcher_.ConfigureTimeout(std::chrono::seconds(0), []() {
-      ALOGE("Zero timeout! Should never happen.");
-    });
+  if (!lpm_wake_asserted) return;
+
+  int64_t idle_since_ns = last_send_ns;
+  // The timer comes back after another period while packets are sent.
+  if (NowNs() - idle_since_ns < lpm_timeout_ms * 1000000LL) return;
+
+  lpm_wake_asserted = false;
+  if (last_send_ns != idle_since_ns) {
+    // A packet went out with the old state, keep the controller awake.
+    lpm_wake_asserted = true;
+    return;
   }
-  recent_activity_flag = false;
+
+  bt_vendor_lpm_wake_state_t wakeState = BT_VND_LPM_WAKE_DEASSERT;
+  lib_interface_->op(BT_VND_OP_LPM_WAKE_SET_STATE, &wakeState);
+  HciTelemetry::Get().RecordLpmSleep();
+  fd_watcher_.ConfigureTimeout(std::chrono::seconds(0), []() {
+    ALOGE("Zero timeout! Should never happen.");
+  });
 }
 
 void VendorInterface::HandleIncomingEvent(const hidl_vec<uint8_t>& hci_packet) {
 
-  if (!internal_commands->empty() &&
-      internal_command_event_match(hci_packet)) {
-    HC_BT_HDR* bt_hdr = WrapPacketAndCopy(HCI_PACKET_TYPE_EVENT, hci_packet);
+  // The callbacks can send new commands.
+  if (command_tracker_->OnEventReceived(hci_packet)) return;
 
-    // The callbacks can send new commands, so don't zero after calling.
-    tINT_CMD_CBACK saved_cb = internal_commands->front().cb;
-    internal_commands->pop();
-    saved_cb(bt_hdr);
-  } else {
-    if (hci_packet[0] == HCI_ESCO_CONNECTION_COMP_EVT) {
-      sco_cfg_status = false;
-      lib_interface_->op(BT_VND_OP_SCO_CFG, nullptr);
-      std::unique_lock<std::mutex> lck(mtx);
-      cv.wait(lck, get_sco_cfg_status);
-    }
+  if (sco_pacer_ != nullptr && hci_packet[0] == HCI_ESCO_CONNECTION_COMP_EVT &&
+      hci_packet.size() > ESCO_AIR_MODE_OFFSET && hci_packet[2] == 0) {
+    sco_pacer_->OnScoConnected(
+        hci_packet[ESCO_AIR_MODE_OFFSET], hci_packet[ESCO_INTERVAL_OFFSET],
+        hci_packet[ESCO_TX_LENGTH_OFFSET] |
+            (hci_packet[ESCO_TX_LENGTH_OFFSET + 1] << 8));
+  }
+
+  std::unique_lock<std::mutex> lock(event_mutex_);
+  if (sco_config_pending_ || replaying_events_) {
+    // Later events must not overtake the eSCO connection complete.
+    deferred_events_.push_back(hci_packet);
+    return;
+  }
+
+  if (hci_packet[0] == HCI_ESCO_CONNECTION_COMP_EVT) {
+    deferred_events_.push_back(hci_packet);
+    StartScoConfig(lock);
+    return;
+  }
+
+  lock.unlock();
+  DeliverEvent(hci_packet);
+}
+
+void VendorInterface::OnScoConfigured(uint8_t result) {
+  if (result != BT_VND_OP_RESULT_SUCCESS) {
+    ALOGE("SCO Configuration failed");
+  }
+
+  std::unique_lock<std::mutex> lock(event_mutex_);
+  if (!sco_config_pending_) return;
+  sco_config_pending_ = false;
+  ArmScoConfigTimer(std::chrono::milliseconds(0));
+  ReplayDeferredEvents(lock);
+}
+
+void VendorInterface::OnScoConfigTimeout() {
+  uint64_t expirations = 0;
+  if (TEMP_FAILURE_RETRY(read(sco_config_timer_fd_, &expirations,
+                              sizeof(expirations))) < 0) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(event_mutex_);
+  // The configuration may have completed and another one started while
+  // this waited for the mutex.
+  if (!sco_config_pending_ ||
+      std::chrono::steady_clock::now() - sco_config_start_ <
+          SCO_CONFIG_TIMEOUT) {
+    return;
+  }
+  ALOGE("%s: SCO configuration timed out, releasing %zu events", __func__,
+        deferred_events_.size());
+  sco_config_pending_ = false;
+  ReplayDeferredEvents(lock);
+}
 
-    if (get_opcode(hci_packet) == HCI_BLE_VENDOR_CAP_OCF) {
-      ALOGW("Sending fake response for LE_Get_Vendor_Capabilities_Command");
-      const hidl_vec<uint8_t> fake_hci_packet = generate_fake_vendor_capabilities_event();
-      event_cb_(fake_hci_packet);
-    } else {
-      event_cb_(hci_packet);
+void VendorInterface::ArmScoConfigTimer(std::chrono::milliseconds timeout) {
+  // A zero timeout disarms the timer.
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = timeout.count() / 1000;
+  spec.it_value.tv_nsec = (timeout.count() % 1000) * 1000000;
+  if (timerfd_settime(sco_config_timer_fd_, 0, &spec, nullptr)) {
+    ALOGE("%s unable to arm the SCO timer: %s", __func__, strerror(errno));
+  }
+}
+
+void VendorInterface::StartScoConfig(std::unique_lock<std::mutex>& lock) {
+  sco_config_pending_ = true;
+  sco_config_start_ = std::chrono::steady_clock::now();
+  ArmScoConfigTimer(SCO_CONFIG_TIMEOUT);
+
+  // The library may complete the operation before op() returns.
+  lock.unlock();
+  lib_interface_->op(BT_VND_OP_SCO_CFG, nullptr);
+}
+
+void VendorInterface::ReplayDeferredEvents(std::unique_lock<std::mutex>& lock) {
+  // The first event is the eSCO connection which was configured.
+  bool configured = true;
+  while (!deferred_events_.empty()) {
+    if (!configured &&
+        deferred_events_.front()[0] == HCI_ESCO_CONNECTION_COMP_EVT) {
+      replaying_events_ = false;
+      StartScoConfig(lock);
+      return;
     }
+
+    // The callbacks are delivered without the mutex, events arriving
+    // meanwhile are queued behind these.
+    std::deque<hidl_vec<uint8_t>> events;
+    do {
+      events.push_back(std::move(deferred_events_.front()));
+      deferred_events_.pop_front();
+      configured = false;
+    } while (!deferred_events_.empty() &&
+             deferred_events_.front()[0] != HCI_ESCO_CONNECTION_COMP_EVT);
+
+    replaying_events_ = true;
+    lock.unlock();
+    for (const auto& event : events) DeliverEvent(event);
+    lock.lock();
+  }
+  replaying_events_ = false;
+}
+
+void VendorInterface::DeliverEvent(const hidl_vec<uint8_t>& hci_packet) {
+  if (get_opcode(hci_packet) == HCI_BLE_VENDOR_CAP_OCF) {
+    ALOGW("Sending fake response for LE_Get_Vendor_Capabilities_Command");
+    const hidl_vec<uint8_t> fake_hci_packet = generate_fake_vendor_capabilities_event();
+    event_cb_(fake_hci_packet);
+  } else {
+    event_cb_(hci_packet);
   }
 }
 
@@ -18,9 +18,19 @@
 
 #include <hidl/HidlSupport.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
 #include "async_fd_watcher.h"
 #include "bt_vendor_lib.h"
+#include "hci_command_tracker.h"
 #include "hci_protocol.h"
+#include "hci_sco_pacer.h"
 
 namespace android {
 namespace hardware {
@@ -41,10 +51,18 @@ class VendorInterface {
                          PacketReadCallback sco_cb);
   static void Shutdown();
   static VendorInterface* get();
+  // Loads the vendor library and caches the firmware at service start when
+  // vendor.bluetooth.prewarm is set, Initialize() then only has to run it.
+  static void Prewarm();
 
   size_t Send(uint8_t type, const uint8_t* data, size_t length);
+  // Commands of the vendor library, their completion goes to the callback
+  // instead of the stack. Takes ownership of the packet.
+  void SendInternalCommand(uint16_t opcode, HC_BT_HDR* packet,
+                           tINT_CMD_CBACK callback);
 
   void OnFirmwareConfigured(uint8_t result);
+  void OnScoConfigured(uint8_t result);
 
  private:
   virtual ~VendorInterface() = default;
@@ -54,17 +72,61 @@ class VendorInterface {
             PacketReadCallback sco_cb);
   void Close();
 
+  // The transport is the protocol on top of the UART fds of the library.
+  bool OpenTransport();
+  void CloseTransport();
+  // A UART read failed, the transport is reset on another thread: UART and
+  // controller power are cycled and the firmware is configured again.
+  void OnTransportError(int fd);
+  void RecoverTransport();
+  // The reset failed, the controller is powered off and the stack is told
+  // with a Hardware Error. Nothing is sent until the HAL is closed.
+  void FailTransport();
+
+  size_t Transmit(uint8_t type, const uint8_t* data, size_t length);
+  void AssertWake();
   void OnTimeout();
 
   void HandleIncomingEvent(const hidl_vec<uint8_t>& hci_packet);
+  void StartScoConfig(std::unique_lock<std::mutex>& lock);
+  void OnScoConfigTimeout();
+  void ArmScoConfigTimer(std::chrono::milliseconds timeout);
+  void ReplayDeferredEvents(std::unique_lock<std::mutex>& lock);
+  void DeliverEvent(const hidl_vec<uint8_t>& hci_packet);
 
   void* lib_handle_ = nullptr;
   bt_vendor_interface_t* lib_interface_ = nullptr;
   async::AsyncFdWatcher fd_watcher_;
   InitializeCompleteCallback initialize_complete_cb_;
+  // Written only under the exclusive lock, senders hold it shared.
+  std::shared_mutex transport_mutex_;
   hci::HciProtocol* hci_ = nullptr;
+  hci::HciCommandTracker* command_tracker_ = nullptr;
+  hci::HciScoPacer* sco_pacer_ = nullptr;
 
   PacketReadCallback event_cb_;
+  PacketReadCallback acl_cb_;
+  PacketReadCallback sco_cb_;
+
+  std::mutex recovery_mutex_;
+  std::condition_variable recovery_cv_;
+  std::atomic<bool> recovering_{false};
+  bool closing_ = false;
+  bool firmware_configured_ = false;
+  uint8_t firmware_result_ = 0;
+  // How long the last successful firmware configuration took.
+  std::chrono::milliseconds firmware_duration_{0};
+  std::thread recovery_thread_;
+
+  // Events received while the vendor library configures SCO, delivered in
+  // order once it completes or the timer expires. No callback runs under the
+  // mutex, replaying_events_ keeps new events behind the replayed ones.
+  std::mutex event_mutex_;
+  bool sco_config_pending_ = false;
+  bool replaying_events_ = false;
+  std::chrono::steady_clock::time_point sco_config_start_;
+  int sco_config_timer_fd_ = -1;
+  std::deque<hidl_vec<uint8_t>> deferred_events_;
 
   FirmwareStartupTimer* firmware_startup_timer_ = nullptr;
 };
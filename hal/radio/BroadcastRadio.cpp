@@ -56,10 +56,14 @@ static Properties initProperties() {
     return properties;
 }
 
+static const char* gStationsPath = "/data/vendor/radio/stations.txt";
+
 BroadcastRadio::BroadcastRadio() :
     mProperties(initProperties()),
+    mStations(gStationsPath),
     mAmFmConfig(gDefaultAmFmConfig) {
     init();
+    mStations.load();
 }
 
 
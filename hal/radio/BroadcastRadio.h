@@ -16,6 +16,7 @@
 #ifndef ANDROID_HARDWARE_BROADCASTRADIO_V2_0_BROADCASTRADIO_H
 #define ANDROID_HARDWARE_BROADCASTRADIO_V2_0_BROADCASTRADIO_H
 
+#include "StationDatabase.h"
 #include "TunerSession.h"
 
 #include <android/hardware/broadcastradio/2.0/IBroadcastRadio.h>
@@ -54,11 +55,14 @@ public:
 
     Properties getProperties() const { return mProperties; }
 
+    StationDatabase& getStations() { return mStations; }
+
 private:
     void init();
 
     Properties          mProperties;
     int                 mFd { -1 };
+    StationDatabase     mStations;
 
     mutable std::mutex  mMut;
     AmFmRegionConfig    mAmFmConfig;
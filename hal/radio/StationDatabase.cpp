@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2018 GlobalLogic LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BcRadioDef.StationDatabase"
+
+#include "StationDatabase.h"
+
+#include <broadcastradio-utils-2x/Utils.h>
+#include <log/log.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace android {
+namespace hardware {
+namespace broadcastradio {
+namespace V2_0 {
+namespace kingfisher {
+
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+/*
+ * A header with the time of the last complete sweep, then one line per station:
+ *   stations <version> sweep <time>
+ *   <frequency> <signal quality> <stereo> <pi> <pty> <ps>
+ * The PS name is last since it may contain spaces.
+ */
+static constexpr int fileVersion = 1;
+static constexpr size_t psLength = 8;
+static constexpr char fieldSeparator = ' ';
+
+/*
+ * Makes a received PS name safe to store: at most psLength characters, no
+ * control characters that would end the line early, and no separators at either
+ * end since load() could not tell them from the one before the name.
+ */
+static std::string sanitizePs(const std::string& ps) {
+    std::string name;
+    for (char c : ps.substr(0, psLength)) {
+        unsigned char uc = static_cast<unsigned char>(c);
+        if (uc < 0x20 || uc == 0x7F) continue;
+        name.push_back(c);
+    }
+    size_t first = name.find_first_not_of(fieldSeparator);
+    if (first == std::string::npos) return {};
+    size_t last = name.find_last_not_of(fieldSeparator);
+    return name.substr(first, last - first + 1);
+}
+
+StationDatabase::StationDatabase(const std::string& path) : mPath(path) {
+}
+
+StationDatabase::~StationDatabase() {
+    saveIfDirty();
+}
+
+void StationDatabase::load() {
+    lock_guard<mutex> lk(mMut);
+
+    FILE* file = fopen(mPath.c_str(), "r");
+    if (file == nullptr) {
+        if (errno != ENOENT) {
+            ALOGE("Open '%s' failed, err=%s", mPath.c_str(), strerror(errno));
+        }
+        return;
+    }
+
+    char line[128];
+    int version = 0;
+    long long lastSweep = 0;
+    if (fgets(line, sizeof(line), file) == nullptr ||
+        sscanf(line, "stations %d sweep %lld", &version, &lastSweep) != 2 ||
+        version != fileVersion) {
+        ALOGW("Ignoring station list '%s' in unknown format", mPath.c_str());
+        fclose(file);
+        return;
+    }
+
+    mStations.clear();
+    mLastSweep = static_cast<time_t>(lastSweep);
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        Station station;
+        unsigned stereo = 0, pi = 0, pty = 0;
+        int psOffset = 0;
+        if (sscanf(line, "%u %u %u %x %u %n", &station.frequency, &station.signalQuality,
+                   &stereo, &pi, &pty, &psOffset) < 5) {
+            continue;
+        }
+        station.stereo = stereo != 0;
+        station.pi = static_cast<uint16_t>(pi);
+        station.pty = static_cast<uint8_t>(pty);
+        station.ps = std::string(line + psOffset, strcspn(line + psOffset, "\n"));
+        mStations[station.frequency] = station;
+    }
+    fclose(file);
+    mIsDirty = false;
+
+    ALOGI("Loaded %zu stations from '%s'", mStations.size(), mPath.c_str());
+}
+
+bool StationDatabase::save() {
+    lock_guard<mutex> lk(mMut);
+
+    // Written next to the list and renamed over it, a crash never leaves half a list.
+    std::string tmpPath = mPath + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "w");
+    if (file == nullptr) {
+        ALOGE("Open '%s' failed, err=%s", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    fprintf(file, "stations %d sweep %lld\n", fileVersion, static_cast<long long>(mLastSweep));
+    for (auto&& entry : mStations) {
+        const Station& station = entry.second;
+        fprintf(file, "%u %u %u %04x %u %s\n", station.frequency, station.signalQuality,
+                station.stereo ? 1U : 0U, static_cast<unsigned>(station.pi),
+                static_cast<unsigned>(station.pty), station.ps.c_str());
+    }
+
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) ok = false;
+    if (!ok || rename(tmpPath.c_str(), mPath.c_str()) < 0) {
+        ALOGE("Writing '%s' failed, err=%s", mPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    mIsDirty = false;
+    return true;
+}
+
+bool StationDatabase::saveIfDirty() {
+    {
+        lock_guard<mutex> lk(mMut);
+        if (!mIsDirty) return true;
+    }
+    return save();
+}
+
+bool StationDatabase::update(const Station& station) {
+    lock_guard<mutex> lk(mMut);
+
+    auto it = mStations.find(station.frequency);
+    if (it == mStations.end()) {
+        Station& added = mStations[station.frequency];
+        added = station;
+        added.ps = sanitizePs(station.ps);
+        mIsDirty = true;
+        return true;
+    }
+
+    // A sweep does not decode RDS on every station, keep what was learnt before.
+    Station& known = it->second;
+    bool changed = known.signalQuality != station.signalQuality || known.stereo != station.stereo;
+    known.signalQuality = station.signalQuality;
+    known.stereo = station.stereo;
+    if (station.pi != 0) {
+        std::string name = sanitizePs(station.ps);
+        changed |= known.pi != station.pi || known.pty != station.pty || known.ps != name;
+        known.pi = station.pi;
+        known.pty = station.pty;
+        known.ps = name;
+    }
+    mIsDirty |= changed;
+    return changed;
+}
+
+bool StationDatabase::refresh(uint32_t frequency, uint32_t signalQuality, bool stereo) {
+    lock_guard<mutex> lk(mMut);
+
+    auto it = mStations.find(frequency);
+    if (it == mStations.end()) return false;
+
+    Station& known = it->second;
+    if (known.signalQuality == signalQuality && known.stereo == stereo) return false;
+    known.signalQuality = signalQuality;
+    known.stereo = stereo;
+    mIsDirty = true;
+    return true;
+}
+
+bool StationDatabase::updateRds(uint32_t frequency, uint16_t pi, uint8_t pty,
+                                const std::string& ps) {
+    lock_guard<mutex> lk(mMut);
+
+    auto it = mStations.find(frequency);
+    if (it == mStations.end() || pi == 0) return false;
+
+    Station& known = it->second;
+    std::string name = sanitizePs(ps);
+    if (known.pi == pi && known.pty == pty && known.ps == name) return false;
+    known.pi = pi;
+    known.pty = pty;
+    known.ps = name;
+    mIsDirty = true;
+    return true;
+}
+
+vector<uint32_t> StationDatabase::removeMissing(uint32_t lowerBound, uint32_t upperBound,
+                                                const std::set<uint32_t>& found) {
+    lock_guard<mutex> lk(mMut);
+
+    vector<uint32_t> removed;
+    auto it = mStations.lower_bound(lowerBound);
+    while (it != mStations.end() && it->first <= upperBound) {
+        if (found.count(it->first) == 0) {
+            removed.push_back(it->first);
+            it = mStations.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    mIsDirty |= !removed.empty();
+    return removed;
+}
+
+vector<ProgramInfo> StationDatabase::getPrograms(const ProgramFilter& filter) const {
+    lock_guard<mutex> lk(mMut);
+
+    vector<ProgramInfo> programs;
+    for (auto&& entry : mStations) {
+        ProgramInfo info = toProgramInfo(entry.second);
+        if (utils::satisfies(filter, info.selector)) programs.push_back(info);
+    }
+    return programs;
+}
+
+std::optional<ProgramInfo> StationDatabase::getProgram(uint32_t frequency) const {
+    lock_guard<mutex> lk(mMut);
+
+    auto it = mStations.find(frequency);
+    if (it == mStations.end()) return {};
+    return toProgramInfo(it->second);
+}
+
+void StationDatabase::markSwept() {
+    lock_guard<mutex> lk(mMut);
+    mLastSweep = time(nullptr);
+    mIsDirty = true;
+}
+
+bool StationDatabase::isStale(std::chrono::seconds maxAge) const {
+    lock_guard<mutex> lk(mMut);
+    if (mLastSweep == 0) return true;
+
+    // Before the clock is set it may run behind the last sweep, trust the list then.
+    time_t now = time(nullptr);
+    return now > mLastSweep && now - mLastSweep > maxAge.count();
+}
+
+ProgramInfo StationDatabase::toProgramInfo(const Station& station) {
+    ProgramInfo info = {};
+    info.selector = utils::make_selector_amfm(station.frequency);
+    if (station.pi != 0) {
+        info.selector.secondaryIds = hidl_vec<ProgramIdentifier>(
+            {utils::make_identifier(IdentifierType::RDS_PI, station.pi)});
+        info.metadata = hidl_vec<Metadata>(
+            {
+                utils::make_metadata(MetadataKey::RDS_PTY, station.pty),
+                utils::make_metadata(MetadataKey::RDS_PS, station.ps),
+            });
+    }
+    info.logicallyTunedTo = info.selector.primaryId;
+    info.physicallyTunedTo = info.selector.primaryId;
+    info.infoFlags |= ProgramInfoFlags::TUNABLE;
+    if (station.stereo) info.infoFlags |= ProgramInfoFlags::STEREO;
+    info.signalQuality = station.signalQuality;
+    return info;
+}
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace broadcastradio
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018 GlobalLogic LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef ANDROID_HARDWARE_BROADCASTRADIO_V2_0_STATIONDATABASE_H
+#define ANDROID_HARDWARE_BROADCASTRADIO_V2_0_STATIONDATABASE_H
+
+#include <android/hardware/broadcastradio/2.0/types.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace broadcastradio {
+namespace V2_0 {
+namespace kingfisher {
+
+struct Station {
+    uint32_t    frequency = 0;
+    uint32_t    signalQuality = 0;
+    bool        stereo = false;
+    uint16_t    pi = 0;     // 0 until RDS was decoded
+    uint8_t     pty = 0;
+    std::string ps;
+};
+
+/*
+ * Stations found by the background sweep, keyed by frequency. The list is
+ * kept in a text file so that it is available right after boot, before the
+ * next sweep had a chance to run.
+ */
+class StationDatabase {
+public:
+    explicit StationDatabase(const std::string& path);
+    ~StationDatabase();
+
+    void load();
+    bool save();
+    bool saveIfDirty();
+
+    // Adds or refreshes a station, returns true if anything visible changed.
+    bool update(const Station& station);
+    // Only refreshes a station that is already known.
+    bool refresh(uint32_t frequency, uint32_t signalQuality, bool stereo);
+    bool updateRds(uint32_t frequency, uint16_t pi, uint8_t pty, const std::string& ps);
+
+    // Drops the stations in [lowerBound, upperBound] a sweep did not find.
+    std::vector<uint32_t> removeMissing(uint32_t lowerBound, uint32_t upperBound,
+                                        const std::set<uint32_t>& found);
+
+    std::vector<ProgramInfo> getPrograms(const ProgramFilter& filter) const;
+    std::optional<ProgramInfo> getProgram(uint32_t frequency) const;
+
+    void markSwept();
+    bool isStale(std::chrono::seconds maxAge) const;
+
+    static ProgramInfo toProgramInfo(const Station& station);
+
+private:
+    mutable std::mutex              mMut;
+    const std::string               mPath;
+    std::map<uint32_t, Station>     mStations;
+    time_t                          mLastSweep = 0;
+    bool                            mIsDirty = false;
+};
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace broadcastradio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_BROADCASTRADIO_V2_0_STATIONDATABASE_H
@@ -20,6 +20,7 @@
 #include "TunerSession.h"
 
 #include "BroadcastRadio.h"
+#include "StationDatabase.h"
 
 #include <broadcastradio-utils-2x/Utils.h>
 #include <log/log.h>
@@ -59,9 +60,19 @@ static constexpr auto seek = 200ms;
 static constexpr auto step = 100ms;
 static constexpr auto tune = 150ms;
 static constexpr auto metadataCheck = 1s;
+static constexpr auto sweepStep = 20ms;
+static constexpr auto sweepResume = 2s;
+// RDS needs about a second to decode the PS name, AM stations carry none.
+static constexpr auto rdsDwell = 1s;
+// PS names of the current station are written to the database at most that
+// often, and at close().
+static constexpr auto stationsSave = 60s;
 
 }  // namespace delay
 
+// A complete sweep older than this is repeated when the list is requested.
+static constexpr std::chrono::hours gStationsMaxAge { 24 };
+
 static ProgramInfo makeDummyProgramInfo(const ProgramSelector& selector) {
     ProgramInfo info = {};
     info.selector = selector;
@@ -72,6 +83,14 @@ static ProgramInfo makeDummyProgramInfo(const ProgramSelector& selector) {
     return info;
 }
 
+static Station toStation(const ProgramInfo& info) {
+    Station station;
+    station.frequency = utils::getId(info.selector, IdentifierType::AMFM_FREQUENCY);
+    station.signalQuality = info.signalQuality;
+    station.stereo = (info.infoFlags & ProgramInfoFlags::STEREO) != 0;
+    return station;
+}
+
 TunerSession::TunerSession(BroadcastRadio& module,
                            const sp<ITunerCallback>& callback,
                            const int& deviceFd)
@@ -88,26 +107,63 @@ const BroadcastRadio& TunerSession::module() const {
     return mModule.get();
 }
 
-void TunerSession::tuneInternalLocked(const ProgramSelector& sel) {
-    ALOGV("%s(%s)", __func__, toString(sel).c_str());
+StationDatabase& TunerSession::stations() {
+    return mModule.get().getStations();
+}
 
-    mCurrentProgram = sel;
+bool TunerSession::setAmFmBandLocked(const FrequencyBand& band) {
+    v4l2_control ctrl = {.id = V4L2_TUNER_RADIO};
 
-    ProgramInfo info = makeDummyProgramInfo(sel);
+    if (band == FrequencyBand::FM) {
+        ALOGI("Setting FM band config");
+        ctrl.value = V4L2_BAND_MODULATION_FM;
+    } else if (band == FrequencyBand::AM_LW || band == FrequencyBand::AM_MW ||
+               band == FrequencyBand::AM_SW) {
+        ALOGI("Setting AM band config");
+        ctrl.value = V4L2_BAND_MODULATION_AM;
+    }
 
-    ALOGI("Tune channel type=%d, value=%ld", sel.primaryId.type, sel.primaryId.value);
+    if (ioctl(mDeviceFd, VIDIOC_S_CTRL, &ctrl) < 0) {
+        ALOGE("ioctl(VIDIOC_S_CTRL) failed, err=%s", strerror(errno));
+        return false;
+    }
+
+    ALOGI("Switched to frequency %d", band);
+    mCurrentBand = band;
+    return true;
+}
 
+bool TunerSession::setFrequencyLocked(uint32_t frequency) {
     v4l2_frequency freq = {
         .tuner = 0,
         .type = V4L2_TUNER_RADIO,
-        .frequency = static_cast<uint32_t>(sel.primaryId.value)
+        .frequency = frequency
     };
 
     if (ioctl(mDeviceFd, VIDIOC_S_FREQUENCY, &freq) < 0) {
         ALOGE("ioctl(VIDIOC_S_FREQUENCY) failed, err=%s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void TunerSession::tuneInternalLocked(const ProgramSelector& sel) {
+    ALOGV("%s(%s)", __func__, toString(sel).c_str());
+
+    mCurrentProgram = sel;
+
+    ProgramInfo info = makeDummyProgramInfo(sel);
+
+    ALOGI("Tune channel type=%d, value=%ld", sel.primaryId.type, sel.primaryId.value);
+
+    if (!setFrequencyLocked(static_cast<uint32_t>(sel.primaryId.value))) {
         mCallback->onTuneFailed(Result::INTERNAL_ERROR, sel);
     } else {
         if (gatherProgramInfo(info)) {
+            Station station = toStation(info);
+            if (stations().refresh(station.frequency, station.signalQuality, station.stereo)) {
+                notifyStationLocked(station.frequency);
+            }
             info.selector = sel;
             info.metadata = hidl_vec<Metadata>(
                 {
@@ -130,37 +186,18 @@ void TunerSession::switchAmFmBand(const FrequencyBand& band) {
         ALOGV("%s(band = %d)", __func__, band);
         std::lock_guard<std::mutex> lk(mMut);
 
-        v4l2_control ctrl = {.id = V4L2_TUNER_RADIO};
-
         uint32_t baseFrequency = 0;
 
         if (band == FrequencyBand::FM) {
-            ALOGI("Setting FM band config");
-            ctrl.value = V4L2_BAND_MODULATION_FM;
             baseFrequency = 87500;
         } else if (band == FrequencyBand::AM_LW || band == FrequencyBand::AM_MW ||
                    band == FrequencyBand::AM_SW) {
-            ALOGI("Setting AM band config");
-            ctrl.value = V4L2_BAND_MODULATION_AM;
             baseFrequency = 1620;
         }
 
-        if (ioctl(mDeviceFd, VIDIOC_S_CTRL, &ctrl) < 0) {
-            ALOGE("ioctl(VIDIOC_S_CTRL) failed, err=%s", strerror(errno));
-        } else {
-            ALOGI("Switched to frequency %d", band);
-            mCurrentBand = band;
-
+        if (setAmFmBandLocked(band)) {
             ALOGI("Tune to band channel %ld", mCurrentProgram.primaryId.value);
-            v4l2_frequency freq = {
-                .tuner = 0,
-                .type = V4L2_TUNER_RADIO,
-                .frequency = baseFrequency
-            };
-
-            if (ioctl(mDeviceFd, VIDIOC_S_FREQUENCY, &freq) < 0) {
-                ALOGE("ioctl(VIDIOC_S_FREQUENCY) failed, err=%s", strerror(errno));
-            } else {
+            if (setFrequencyLocked(baseFrequency)) {
                 ALOGV("ioctl(VIDIOC_S_FREQUENCY) success");
             }
         }
@@ -187,6 +224,7 @@ Return<Result> TunerSession::tune(const ProgramSelector& sel) {
     }
 
     cancelLocked();
+    stopSweepLocked();
 
     FrequencyBand newBand = utils::getBand(sel.primaryId.value);
     if (newBand != mCurrentBand) {
@@ -212,6 +250,7 @@ Return<Result> TunerSession::scan(bool directionUp, bool /* skipSubChannel */) {
     if (mIsClosed) return Result::INVALID_STATE;
 
     cancelLocked();
+    stopSweepLocked();
 
     if (mCurrentBand == FrequencyBand::UNKNOWN) {
         switchAmFmBand(FrequencyBand::FM);
@@ -220,7 +259,11 @@ Return<Result> TunerSession::scan(bool directionUp, bool /* skipSubChannel */) {
     mIsTuneCompleted = false;
 
     auto task = [this, directionUp]() {
-        std::lock_guard<std::mutex> lk(mMut);
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lk(mMut);
+            generation = mGeneration;
+        }
         ProgramInfo info;
 
         ALOGI("Seek start, direction=%d", directionUp);
@@ -232,12 +275,24 @@ Return<Result> TunerSession::scan(bool directionUp, bool /* skipSubChannel */) {
             .wrap_around = 1,
         };
 
-        if (ioctl(mDeviceFd, VIDIOC_S_HW_FREQ_SEEK, &freq_seek) < 0) {
+        // The seek takes up to a few seconds, the HIDL calls must not wait for it.
+        bool isSeekDone = ioctl(mDeviceFd, VIDIOC_S_HW_FREQ_SEEK, &freq_seek) == 0;
+        if (!isSeekDone) {
             ALOGE("ioctl(VIDIOC_S_HW_FREQ_SEEK) failed, err=%s", strerror(errno));
-        } else {
-            if (gatherProgramInfo(info)) {
+        }
+        bool hasInfo = isSeekDone && gatherProgramInfo(info);
+
+        std::lock_guard<std::mutex> lk(mMut);
+        // Superseded by another operation meanwhile.
+        if (mIsClosed || generation != mGeneration) return;
+
+        if (isSeekDone) {
+            if (hasInfo) {
                 mCurrentProgram = info.selector;
                 mCurrentProgramInfo = info;
+
+                Station station = toStation(info);
+                if (stations().update(station)) notifyStationLocked(station.frequency);
             }
             launchMetadataFetchTask();
         }
@@ -257,6 +312,7 @@ Return<Result> TunerSession::step(bool directionUp) {
     if (mIsClosed) return Result::INVALID_STATE;
 
     cancelLocked();
+    stopSweepLocked();
 
     if (!utils::hasId(mCurrentProgram, IdentifierType::AMFM_FREQUENCY)) {
         ALOGE("Can't step in anything else than AM/FM");
@@ -295,6 +351,10 @@ void TunerSession::cancelLocked() {
 
     mMetadataThreadExit = true;
     mThread.cancelAll();
+    mGeneration++;
+    // A sweep step is dropped with the other tasks, cancel() resumes the sweep.
+    mSweepTaskPending = false;
+    mSweepRdsPending = false;
     if (utils::getType(mCurrentProgram.primaryId) != IdentifierType::INVALID) {
         mIsTuneCompleted = true;
     }
@@ -306,6 +366,7 @@ Return<void> TunerSession::cancel() {
     if (mIsClosed) return {};
 
     cancelLocked();
+    resumeSweepLocked();
 
     return {};
 }
@@ -315,11 +376,32 @@ Return<Result> TunerSession::startProgramListUpdates(const ProgramFilter& filter
     std::lock_guard<mutex> lk(mMut);
     if (mIsClosed) return Result::INVALID_STATE;
 
-    return Result::NOT_SUPPORTED;
+    mIsListActive = true;
+    mListFilter = filter;
+    mListSent.clear();
+
+    // The stored list is sent right away, the sweep only adds what changed.
+    // It waits for a list request on an idle tuner rather than be heard.
+    bool isSweepNeeded = stations().isStale(gStationsMaxAge);
+    if (isSweepNeeded && !isTunerIdleLocked()) {
+        ALOGI("Station list is stale, sweeping once no program is selected");
+        isSweepNeeded = false;
+    }
+    notifyProgramListLocked(stations().getPrograms(filter), {}, true,
+                            !isSweepNeeded && !mIsSweeping);
+    if (isSweepNeeded) startSweepLocked();
+
+    return Result::OK;
 }
 
 Return<void> TunerSession::stopProgramListUpdates() {
     ALOGV("%s", __func__);
+    std::lock_guard<mutex> lk(mMut);
+
+    mIsListActive = false;
+    mListSent.clear();
+    // A pending step finishes the sweep and tunes back, an interrupted one just ends.
+    if (!mSweepTaskPending && !mSweepStepRunning) mIsSweeping = false;
     return {};
 }
 
@@ -360,6 +442,9 @@ Return<void> TunerSession::close() {
     mIsClosed = true;
     mMetadataThreadExit = true;
     mThread.cancelAll();
+    mIsSweeping = false;
+    mSweepTaskPending = false;
+    stations().saveIfDirty();
     return {};
 }
 
@@ -421,10 +506,19 @@ void TunerSession::launchMetadataFetchTask() {
     }
     mMetadataThreadExit = false;
     mMetadataTask = [this]() {
+        if (mMetadataThreadExit) return;
+
+        // Read without the lock, the HIDL calls must not wait for the device.
         struct si46xx_rds_data_s rds = {};
         int ret = read(mDeviceFd, &rds, sizeof(rds));
+        int readErrno = errno;
+
+        std::lock_guard<mutex> lk(mMut);
+        // Tuned elsewhere meanwhile, the data is of the previous station.
+        if (mMetadataThreadExit) return;
+
         if (ret < 0) {
-            ALOGE("RDS data read failed, err=%s", strerror(errno));
+            ALOGE("RDS data read failed, err=%s", strerror(readErrno));
         } else if (!ret) {
             ALOGV("No RDS data available.");
         } else {
@@ -434,6 +528,15 @@ void TunerSession::launchMetadataFetchTask() {
                     utils::make_metadata(MetadataKey::RDS_PS, rds.ps_name),
                 });
             mCallback->onCurrentProgramInfoChanged(mCurrentProgramInfo);
+
+            if (utils::hasId(mCurrentProgram, IdentifierType::AMFM_FREQUENCY)) {
+                auto frequency = utils::getId(mCurrentProgram, IdentifierType::AMFM_FREQUENCY);
+                std::string ps(rds.ps_name, strnlen(rds.ps_name, sizeof(rds.ps_name)));
+                if (stations().updateRds(frequency, rds.pi, rds.pty, ps)) {
+                    notifyStationLocked(frequency);
+                }
+                saveStationsThrottledLocked();
+            }
         }
 
         if (!mMetadataThreadExit) {
@@ -443,6 +546,225 @@ void TunerSession::launchMetadataFetchTask() {
     mThread.schedule(mMetadataTask, delay::metadataCheck);
 }
 
+void TunerSession::saveStationsThrottledLocked() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - mLastStationsSave < delay::stationsSave) return;
+    if (stations().saveIfDirty()) mLastStationsSave = now;
+}
+
+void TunerSession::notifyProgramListLocked(const vector<ProgramInfo>& modified,
+                                           const vector<uint32_t>& removed,
+                                           bool purge, bool complete) {
+    if (!mIsListActive) return;
+
+    vector<ProgramInfo> sent;
+    for (auto&& info : modified) {
+        if (!utils::satisfies(mListFilter, info.selector)) continue;
+
+        auto frequency = utils::getId(info.selector, IdentifierType::AMFM_FREQUENCY);
+        bool isNew = mListSent.insert(frequency).second;
+        if (!isNew && mListFilter.excludeModifications) continue;
+        sent.push_back(info);
+    }
+
+    // Only what the client was sent can be removed from its list.
+    vector<ProgramIdentifier> gone;
+    for (auto frequency : removed) {
+        if (mListSent.erase(frequency) == 0) continue;
+        gone.push_back(utils::make_identifier(IdentifierType::AMFM_FREQUENCY, frequency));
+    }
+
+    if (sent.empty() && gone.empty() && !purge && !complete) return;
+
+    ProgramListChunk chunk = {};
+    chunk.purge = purge;
+    chunk.complete = complete;
+    chunk.modified = sent;
+    chunk.removed = gone;
+    mCallback->onProgramListUpdated(chunk);
+}
+
+void TunerSession::notifyStationLocked(uint32_t frequency) {
+    auto info = stations().getProgram(frequency);
+    if (info) notifyProgramListLocked({*info}, {}, false, false);
+}
+
+void TunerSession::startSweepLocked() {
+    if (mIsSweeping) {
+        resumeSweepLocked();
+        return;
+    }
+
+    ALOGI("Starting background station sweep");
+    mIsSweeping = true;
+    mSweepRange = 0;
+    mSweepFrequency = 0;
+    mSweepRdsPending = false;
+    mSweepFound.clear();
+    scheduleSweepStepLocked(delay::sweepStep);
+}
+
+void TunerSession::scheduleSweepStepLocked(std::chrono::milliseconds delay) {
+    mSweepTaskPending = true;
+    auto task = [this]() { sweepStep(); };
+    mThread.schedule(task, delay);
+}
+
+bool TunerSession::isTunerIdleLocked() const {
+    return !utils::hasId(mCurrentProgram, IdentifierType::AMFM_FREQUENCY);
+}
+
+void TunerSession::resumeSweepLocked() {
+    if (mIsClosed || !mIsSweeping || mSweepTaskPending || mSweepStepRunning) return;
+    if (!isTunerIdleLocked()) return;
+
+    ALOGV("%s: range %zu from %u", __func__, mSweepRange, mSweepFrequency);
+    scheduleSweepStepLocked(delay::sweepResume);
+}
+
+bool TunerSession::unlockForDeviceLocked(std::unique_lock<mutex>& lk,
+                                         const std::function<void()>& access) {
+    uint64_t generation = mGeneration;
+    mSweepStepRunning = true;
+    lk.unlock();
+    access();
+    lk.lock();
+    mSweepStepRunning = false;
+
+    if (mIsClosed) return false;
+    if (generation != mGeneration) {
+        // A foreground operation took the tuner, the sweep resumes after it.
+        resumeSweepLocked();
+        return false;
+    }
+    if (!mIsSweeping || !mIsListActive) {
+        finishSweepLocked(false);
+        return false;
+    }
+    return true;
+}
+
+void TunerSession::sweepStep() {
+    std::unique_lock<mutex> lk(mMut);
+    mSweepTaskPending = false;
+    if (!mIsSweeping) return;
+    if (!mIsListActive) {
+        finishSweepLocked(false);
+        return;
+    }
+
+    // The client must not hear the sweep.
+    if (!isTunerIdleLocked()) {
+        finishSweepLocked(false);
+        return;
+    }
+
+    // Keeps a pending metadata fetch from reading RDS of the swept stations.
+    mMetadataThreadExit = true;
+
+    if (mSweepRdsPending) {
+        mSweepRdsPending = false;
+        struct si46xx_rds_data_s rds = {};
+        int ret = 0;
+        if (!unlockForDeviceLocked(lk, [&]() { ret = read(mDeviceFd, &rds, sizeof(rds)); })) {
+            return;
+        }
+        if (ret > 0) {
+            std::string ps(rds.ps_name, strnlen(rds.ps_name, sizeof(rds.ps_name)));
+            if (stations().updateRds(mSweepFrequency, rds.pi, rds.pty, ps)) {
+                notifyStationLocked(mSweepFrequency);
+            }
+        }
+    }
+
+    auto ranges = module().getAmFmConfig().ranges;
+    if (mSweepRange >= ranges.size()) {
+        finishSweepLocked(true);
+        return;
+    }
+    const AmFmBandRange& range = ranges[mSweepRange];
+    FrequencyBand band = utils::getBand(range.lowerBound);
+
+    // Every step tunes to where the last one stopped, a foreground operation
+    // may have moved the tuner in between.
+    uint32_t from = mSweepFrequency != 0 ? mSweepFrequency : range.lowerBound;
+    if ((band != mCurrentBand && !setAmFmBandLocked(band)) || !setFrequencyLocked(from)) {
+        ALOGW("Skipping range %u-%u", range.lowerBound, range.upperBound);
+        mSweepRange++;
+        mSweepFrequency = 0;
+        scheduleSweepStepLocked(delay::sweepStep);
+        return;
+    }
+
+    v4l2_hw_freq_seek freq_seek = {
+        .tuner = 0,
+        .type = V4L2_TUNER_RADIO,
+        .seek_upward = 1,
+        .wrap_around = 0,
+    };
+
+    ProgramInfo info = {};
+    int seekErrno = 0;
+    bool hasInfo = false;
+    if (!unlockForDeviceLocked(lk, [&]() {
+            if (ioctl(mDeviceFd, VIDIOC_S_HW_FREQ_SEEK, &freq_seek) < 0) {
+                seekErrno = errno;
+            } else {
+                hasInfo = gatherProgramInfo(info);
+            }
+        })) {
+        return;
+    }
+
+    bool isRangeDone = false;
+    if (seekErrno != 0) {
+        if (seekErrno != ENODATA) {
+            ALOGE("ioctl(VIDIOC_S_HW_FREQ_SEEK) failed, err=%s", strerror(seekErrno));
+            finishSweepLocked(false);
+            return;
+        }
+        // No station up to the end of the band.
+        isRangeDone = true;
+    } else if (!hasInfo) {
+        finishSweepLocked(false);
+        return;
+    }
+
+    Station station = isRangeDone ? Station() : toStation(info);
+    if (isRangeDone || station.frequency <= from || station.frequency > range.upperBound) {
+        // Seeking ran off the end of the range, what was not found is gone.
+        ALOGI("Swept range %u-%u", range.lowerBound, range.upperBound);
+        auto removed = stations().removeMissing(range.lowerBound, range.upperBound, mSweepFound);
+        notifyProgramListLocked({}, removed, false, false);
+        mSweepRange++;
+        mSweepFrequency = 0;
+        scheduleSweepStepLocked(delay::sweepStep);
+        return;
+    }
+
+    mSweepFrequency = station.frequency;
+    mSweepFound.insert(station.frequency);
+    if (stations().update(station)) notifyStationLocked(station.frequency);
+
+    mSweepRdsPending = band == FrequencyBand::FM;
+    scheduleSweepStepLocked(mSweepRdsPending ? delay::rdsDwell : delay::sweepStep);
+}
+
+void TunerSession::finishSweepLocked(bool complete) {
+    ALOGI("Station sweep %s, %zu stations found", complete ? "complete" : "stopped",
+          mSweepFound.size());
+
+    mIsSweeping = false;
+    mSweepRdsPending = false;
+    if (complete) stations().markSwept();
+    stations().saveIfDirty();
+    notifyProgramListLocked({}, {}, false, true);
+}
+
+void TunerSession::stopSweepLocked() {
+    if (mIsSweeping) finishSweepLocked(false);
+}
+
 }  // namespace kingfisher {
 }  // namespace V2_0 {
 }  // namespace broadcastradio {
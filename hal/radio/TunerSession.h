@@ -22,6 +22,7 @@
 #include <broadcastradio-utils/WorkerThread.h>
 
 #include <optional>
+#include <set>
 
 namespace android {
 namespace hardware {
@@ -30,6 +31,7 @@ namespace V2_0 {
 namespace kingfisher {
 
 class BroadcastRadio;
+class StationDatabase;
 
 using utils::FrequencyBand;
 
@@ -63,8 +65,31 @@ private:
     void cancelLocked();
     bool gatherProgramInfo(ProgramInfo& info);
     const BroadcastRadio& module() const;
+    StationDatabase& stations();
+    bool setAmFmBandLocked(const FrequencyBand& band);
+    bool setFrequencyLocked(uint32_t frequency);
     void tuneInternalLocked(const ProgramSelector& sel);
 
+    void notifyProgramListLocked(const std::vector<ProgramInfo>& modified,
+                                 const std::vector<uint32_t>& removed,
+                                 bool purge, bool complete);
+    void notifyStationLocked(uint32_t frequency);
+    void saveStationsThrottledLocked();
+    void startSweepLocked();
+    void scheduleSweepStepLocked(std::chrono::milliseconds delay);
+    // No program is selected, the sweep can not be heard.
+    bool isTunerIdleLocked() const;
+    void resumeSweepLocked();
+    void sweepStep();
+    // Runs a blocking device access of a sweep step without the lock. Returns
+    // false if the step must end, because of a foreground operation, close()
+    // or the end of the list updates meanwhile.
+    bool unlockForDeviceLocked(std::unique_lock<std::mutex>& lk,
+                               const std::function<void()>& access);
+    void finishSweepLocked(bool complete);
+    // Ends the sweep for a foreground tune(), step() or scan().
+    void stopSweepLocked();
+
 
     std::mutex                              mMut;
     WorkerThread                            mThread;
@@ -77,10 +102,31 @@ private:
     const int&                              mDeviceFd;
     std::reference_wrapper<BroadcastRadio>  mModule;
 
+    // Bumped by every foreground operation, a seek done without the lock
+    // drops its result when it changed meanwhile.
+    uint64_t                                mGeneration = 0;
+    std::chrono::steady_clock::time_point   mLastStationsSave;
+
     bool                                    mIsTuneCompleted = false;
     ProgramSelector                         mCurrentProgram = {};
     ProgramInfo                             mCurrentProgramInfo = {};
     FrequencyBand                           mCurrentBand = FrequencyBand::UNKNOWN;
+
+    bool                                    mIsListActive = false;
+    ProgramFilter                           mListFilter = {};
+    std::set<uint32_t>                      mListSent;
+
+    // Background sweep, one seek per WorkerThread task so that any foreground
+    // operation preempts it. It only runs while no program is selected,
+    // tune(), step() and scan() end it.
+    bool                                    mIsSweeping = false;
+    bool                                    mSweepTaskPending = false;
+    // A step is in a device access without the lock.
+    bool                                    mSweepStepRunning = false;
+    size_t                                  mSweepRange = 0;
+    uint32_t                                mSweepFrequency = 0;
+    bool                                    mSweepRdsPending = false;
+    std::set<uint32_t>                      mSweepFound;
 };
 
 }  // namespace kingfisher {
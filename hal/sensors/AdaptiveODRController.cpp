@@ -0,0 +1,129 @@
+#define LOG_TAG "SensorsHAL::AdaptiveODR"
+
+#include <algorithm>
+#include <cmath>
+
+#include "AdaptiveODRController.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace kingfisher {
+
+using ::android::hardware::sensors::V1_0::SensorType;
+
+AdaptiveODRController::AdaptiveODRController() :
+        mAccelNorms(accelWindowSize, 0.0f)
+{
+    reset();
+}
+
+void AdaptiveODRController::reset()
+{
+    std::lock_guard<std::mutex> lock(mLock);
+
+    mAccelCount = 0;
+    mAccelStill = false;
+    mGyroStill = true;
+    mStillSince = 0;
+    mIsStationary = false;
+}
+
+uint16_t AdaptiveODRController::limitODR(uint16_t requestedODR, uint16_t idleODR) const
+{
+    if (!mIsStationary.load() || !idleODR)
+        return requestedODR;
+
+    return std::min(requestedODR, idleODR);
+}
+
+bool AdaptiveODRController::update(const std::vector<Event>& events, size_t first)
+{
+    bool isChanged = false;
+
+    std::lock_guard<std::mutex> lock(mLock);
+
+    for (size_t i = first; i < events.size(); i++) {
+        if (events[i].sensorType == SensorType::ACCELEROMETER) {
+            isChanged |= updateAccel(events[i]);
+        } else if (events[i].sensorType == SensorType::GYROSCOPE) {
+            isChanged |= updateGyro(events[i]);
+        }
+    }
+
+    return isChanged;
+}
+
+bool AdaptiveODRController::updateAccel(const Event& event)
+{
+    const float norm = std::sqrt(event.u.vec3.x * event.u.vec3.x +
+        event.u.vec3.y * event.u.vec3.y + event.u.vec3.z * event.u.vec3.z);
+    bool isMoving = false;
+
+    if (mAccelCount >= accelWindowSize) {
+        float mean = 0;
+        for (size_t i = 0; i < accelWindowSize; i++)
+            mean += mAccelNorms[i];
+        mean /= accelWindowSize;
+
+        isMoving = (std::fabs(norm - mean) > accelWakeDelta);
+    }
+
+    mAccelNorms[mAccelCount % accelWindowSize] = norm;
+    mAccelCount++;
+
+    if (mAccelCount >= accelWindowSize) {
+        float mean = 0;
+        float variance = 0;
+        for (size_t i = 0; i < accelWindowSize; i++)
+            mean += mAccelNorms[i];
+        mean /= accelWindowSize;
+        for (size_t i = 0; i < accelWindowSize; i++)
+            variance += (mAccelNorms[i] - mean) * (mAccelNorms[i] - mean);
+        variance /= accelWindowSize;
+
+        mAccelStill = (variance < accelVarianceThreshold);
+    }
+
+    return updateState(isMoving, event.timestamp);
+}
+
+bool AdaptiveODRController::updateGyro(const Event& event)
+{
+    const float norm = std::sqrt(event.u.vec3.x * event.u.vec3.x +
+        event.u.vec3.y * event.u.vec3.y + event.u.vec3.z * event.u.vec3.z);
+
+    mGyroStill = (norm < gyroThreshold);
+
+    return updateState(!mGyroStill, event.timestamp);
+}
+
+bool AdaptiveODRController::updateState(bool isMoving, int64_t timestamp)
+{
+    if (isMoving || !mAccelStill || !mGyroStill) {
+        mStillSince = 0;
+        if (mIsStationary.load()) {
+            ALOGD("Motion detected, restoring requested ODR");
+            mIsStationary = false;
+            return true;
+        }
+        return false;
+    }
+
+    if (!mStillSince) {
+        mStillSince = timestamp;
+    } else if (!mIsStationary.load() && (timestamp - mStillSince) >= stillHoldNs) {
+        ALOGD("Board is stationary, dropping ODR");
+        mIsStationary = true;
+        return true;
+    }
+
+    return false;
+}
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,73 @@
+#ifndef ANDROID_HARDWARE_ADAPTIVE_ODR_CONTROLLER_V2_0_KINGFISHER_H
+#define ANDROID_HARDWARE_ADAPTIVE_ODR_CONTROLLER_V2_0_KINGFISHER_H
+
+#include <android/hardware/sensors/1.0/ISensors.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "common.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace kingfisher {
+
+using ::android::hardware::sensors::V1_0::Event;
+
+/*
+ * Detects that the board is standing still (accelerometer magnitude variance
+ * and gyroscope magnitude are below thresholds for a hold time) and limits
+ * the physical trigger frequency of the hardware groups while it is so.
+ *
+ * Any single sample showing motion switches back to the requested rate, so
+ * the wake-up latency is bounded by one sample period at the idle ODR.
+ */
+class AdaptiveODRController
+{
+    public:
+        AdaptiveODRController();
+
+        /*
+         * Takes the events from index `first` on, the ones before were seen
+         * by an earlier call. Returns true if the stationary state has been
+         * changed.
+         */
+        bool update(const std::vector<Event>&, size_t first);
+        void reset();
+        bool isStationary() const { return mIsStationary.load(); }
+        uint16_t limitODR(uint16_t requestedODR, uint16_t idleODR) const;
+
+    private:
+        bool updateAccel(const Event&);
+        bool updateGyro(const Event&);
+        bool updateState(bool isMoving, int64_t timestamp);
+
+        std::mutex mLock;
+        std::atomic<bool> mIsStationary = false;
+
+        static constexpr size_t accelWindowSize = 16;
+        std::vector<float> mAccelNorms;
+        size_t mAccelCount;
+        bool mAccelStill;
+        bool mGyroStill;
+        int64_t mStillSince;
+
+        /* (m/s^2)^2, noise floor of LSM9DS0 in 4G mode is well below */
+        static constexpr float accelVarianceThreshold = 0.01f;
+        /* m/s^2, single sample deviation from the window mean */
+        static constexpr float accelWakeDelta = 0.3f;
+        /* rad/s */
+        static constexpr float gyroThreshold = 0.05f;
+        /* Board has to be still during this time before ODR is dropped */
+        static constexpr int64_t stillHoldNs = static_cast<int64_t>(2 * NSEC);
+};
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif//ANDROID_HARDWARE_ADAPTIVE_ODR_CONTROLLER_V2_0_KINGFISHER_H
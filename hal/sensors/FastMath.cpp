@@ -0,0 +1,248 @@
+#define LOG_TAG "SensorsHAL::FastMath"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#define FAST_MATH_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FAST_MATH_SSE
+#endif
+
+#include "FastMath.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace kingfisher {
+
+using namespace fastmath;
+
+/* Chunk used to keep temporaries of the composed batch functions on stack */
+static constexpr size_t batchChunkSize = 32;
+
+#if defined(FAST_MATH_NEON)
+
+using float4 = float32x4_t;
+static constexpr size_t simdWidth = 4;
+
+static inline float32x4_t atan2x4(float32x4_t y, float32x4_t x)
+{
+    float32x4_t ax = vabsq_f32(x);
+    float32x4_t ay = vabsq_f32(y);
+    float32x4_t maxValue = vmaxq_f32(vmaxq_f32(ax, ay), vdupq_n_f32(FLT_MIN));
+    float32x4_t ratio = vdivq_f32(vminq_f32(ax, ay), maxValue);
+    float32x4_t r2 = vmulq_f32(ratio, ratio);
+
+    float32x4_t angle = vfmaq_f32(vdupq_n_f32(ATAN_C4), r2, vdupq_n_f32(ATAN_C5));
+    angle = vfmaq_f32(vdupq_n_f32(ATAN_C3), r2, angle);
+    angle = vfmaq_f32(vdupq_n_f32(ATAN_C2), r2, angle);
+    angle = vfmaq_f32(vdupq_n_f32(ATAN_C1), r2, angle);
+    angle = vfmaq_f32(vdupq_n_f32(ATAN_C0), r2, angle);
+    angle = vmulq_f32(ratio, angle);
+
+    angle = vbslq_f32(vcgtq_f32(ay, ax), vsubq_f32(vdupq_n_f32(PI_2), angle), angle);
+    angle = vbslq_f32(vcltq_f32(x, vdupq_n_f32(0.0f)), vsubq_f32(vdupq_n_f32(PI), angle), angle);
+
+    /* Take the sign of y */
+    uint32x4_t signMask = vdupq_n_u32(0x80000000);
+    return vbslq_f32(signMask, y, angle);
+}
+
+static inline void sincosx4(float32x4_t x, float32x4_t& sinValue, float32x4_t& cosValue)
+{
+    float32x4_t k = vrndnq_f32(vmulq_f32(x, vdupq_n_f32(TWO_OVER_PI)));
+    int32x4_t quadrant = vcvtq_s32_f32(k);
+    float32x4_t r = vfmsq_f32(x, k, vdupq_n_f32(PI_2_A));
+    r = vfmsq_f32(r, k, vdupq_n_f32(PI_2_B));
+    r = vfmsq_f32(r, k, vdupq_n_f32(PI_2_C));
+    float32x4_t r2 = vmulq_f32(r, r);
+
+    float32x4_t s = vfmaq_f32(vdupq_n_f32(SIN_C2), r2, vdupq_n_f32(SIN_C3));
+    s = vfmaq_f32(vdupq_n_f32(SIN_C1), r2, s);
+    s = vfmaq_f32(r, vmulq_f32(r, r2), s);
+
+    float32x4_t c = vfmaq_f32(vdupq_n_f32(COS_C3), r2, vdupq_n_f32(COS_C4));
+    c = vfmaq_f32(vdupq_n_f32(COS_C2), r2, c);
+    c = vfmaq_f32(vdupq_n_f32(COS_C1), r2, c);
+    c = vfmaq_f32(vdupq_n_f32(1.0f), r2, c);
+
+    uint32x4_t swapMask = vtstq_s32(quadrant, vdupq_n_s32(1));
+    float32x4_t sinBase = vbslq_f32(swapMask, c, s);
+    float32x4_t cosBase = vbslq_f32(swapMask, s, c);
+
+    uint32x4_t sinSign = vshlq_n_u32(vreinterpretq_u32_s32(
+        vandq_s32(quadrant, vdupq_n_s32(2))), 30);
+    uint32x4_t cosSign = vshlq_n_u32(vreinterpretq_u32_s32(
+        vandq_s32(vaddq_s32(quadrant, vdupq_n_s32(1)), vdupq_n_s32(2))), 30);
+
+    sinValue = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(sinBase), sinSign));
+    cosValue = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(cosBase), cosSign));
+}
+
+static inline float32x4_t rsqrtx4(float32x4_t x)
+{
+    float32x4_t y = vrsqrteq_f32(x);
+
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y));
+    y = vmulq_f32(y, vrsqrtsq_f32(vmulq_f32(x, y), y));
+
+    return y;
+}
+
+#define LOAD4(ptr) vld1q_f32(ptr)
+#define STORE4(ptr, value) vst1q_f32(ptr, value)
+
+#elif defined(FAST_MATH_SSE)
+
+using float4 = __m128;
+static constexpr size_t simdWidth = 4;
+
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 atan2x4(__m128 y, __m128 x)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    __m128 ax = _mm_andnot_ps(signMask, x);
+    __m128 ay = _mm_andnot_ps(signMask, y);
+    __m128 maxValue = _mm_max_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FLT_MIN));
+    __m128 ratio = _mm_div_ps(_mm_min_ps(ax, ay), maxValue);
+    __m128 r2 = _mm_mul_ps(ratio, ratio);
+
+    __m128 angle = _mm_add_ps(_mm_set1_ps(ATAN_C4), _mm_mul_ps(r2, _mm_set1_ps(ATAN_C5)));
+    angle = _mm_add_ps(_mm_set1_ps(ATAN_C3), _mm_mul_ps(r2, angle));
+    angle = _mm_add_ps(_mm_set1_ps(ATAN_C2), _mm_mul_ps(r2, angle));
+    angle = _mm_add_ps(_mm_set1_ps(ATAN_C1), _mm_mul_ps(r2, angle));
+    angle = _mm_add_ps(_mm_set1_ps(ATAN_C0), _mm_mul_ps(r2, angle));
+    angle = _mm_mul_ps(ratio, angle);
+
+    angle = select4(_mm_cmpgt_ps(ay, ax), _mm_sub_ps(_mm_set1_ps(PI_2), angle), angle);
+    angle = select4(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_sub_ps(_mm_set1_ps(PI), angle), angle);
+
+    /* Take the sign of y */
+    return _mm_or_ps(angle, _mm_and_ps(signMask, y));
+}
+
+static inline void sincosx4(__m128 x, __m128& sinValue, __m128& cosValue)
+{
+    /* Default MXCSR rounding is to nearest */
+    __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(TWO_OVER_PI)));
+    __m128 k = _mm_cvtepi32_ps(quadrant);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(k, _mm_set1_ps(PI_2_A)));
+    r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(PI_2_B)));
+    r = _mm_sub_ps(r, _mm_mul_ps(k, _mm_set1_ps(PI_2_C)));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 s = _mm_add_ps(_mm_set1_ps(SIN_C2), _mm_mul_ps(r2, _mm_set1_ps(SIN_C3)));
+    s = _mm_add_ps(_mm_set1_ps(SIN_C1), _mm_mul_ps(r2, s));
+    s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), s));
+
+    __m128 c = _mm_add_ps(_mm_set1_ps(COS_C3), _mm_mul_ps(r2, _mm_set1_ps(COS_C4)));
+    c = _mm_add_ps(_mm_set1_ps(COS_C2), _mm_mul_ps(r2, c));
+    c = _mm_add_ps(_mm_set1_ps(COS_C1), _mm_mul_ps(r2, c));
+    c = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(r2, c));
+
+    __m128 swapMask = _mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sinBase = select4(swapMask, c, s);
+    __m128 cosBase = select4(swapMask, s, c);
+
+    __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(
+        _mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(
+        _mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+
+    sinValue = _mm_xor_ps(sinBase, sinSign);
+    cosValue = _mm_xor_ps(cosBase, cosSign);
+}
+
+static inline __m128 rsqrtx4(__m128 x)
+{
+    __m128 y = _mm_rsqrt_ps(x);
+
+    /* rsqrtps gives 12 bits, one Newton-Raphson step is enough */
+    __m128 xyy = _mm_mul_ps(_mm_mul_ps(x, y), y);
+    return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), xyy));
+}
+
+#define LOAD4(ptr) _mm_loadu_ps(ptr)
+#define STORE4(ptr, value) _mm_storeu_ps(ptr, value)
+
+#endif
+
+void fastAtan2Batch(const float* y, const float* x, float* out, size_t count)
+{
+    size_t i = 0;
+
+#if defined(FAST_MATH_NEON) || defined(FAST_MATH_SSE)
+    for (; i + simdWidth <= count; i += simdWidth) {
+        STORE4(out + i, atan2x4(LOAD4(y + i), LOAD4(x + i)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = fastAtan2(y[i], x[i]);
+    }
+}
+
+void fastAsinBatch(const float* in, float* out, size_t count)
+{
+    float cosValue[batchChunkSize];
+
+    for (size_t start = 0; start < count; start += batchChunkSize) {
+        size_t chunk = std::min(batchChunkSize, count - start);
+
+        for (size_t i = 0; i < chunk; i++) {
+            float x = in[start + i];
+            cosValue[i] = std::sqrt((1.0f - x) * (1.0f + x));
+        }
+
+        fastAtan2Batch(in + start, cosValue, out + start, chunk);
+    }
+}
+
+void fastSinCosBatch(const float* in, float* sinOut, float* cosOut, size_t count)
+{
+    size_t i = 0;
+
+#if defined(FAST_MATH_NEON) || defined(FAST_MATH_SSE)
+    for (; i + simdWidth <= count; i += simdWidth) {
+        float4 sinValue;
+        float4 cosValue;
+        sincosx4(LOAD4(in + i), sinValue, cosValue);
+        STORE4(sinOut + i, sinValue);
+        STORE4(cosOut + i, cosValue);
+    }
+#endif
+
+    for (; i < count; i++) {
+        fastSinCos(in[i], sinOut[i], cosOut[i]);
+    }
+}
+
+void fastRsqrtBatch(const float* in, float* out, size_t count)
+{
+    size_t i = 0;
+
+#if defined(FAST_MATH_NEON) || defined(FAST_MATH_SSE)
+    for (; i + simdWidth <= count; i += simdWidth) {
+        STORE4(out + i, rsqrtx4(LOAD4(in + i)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = fastRsqrt(in[i]);
+    }
+}
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
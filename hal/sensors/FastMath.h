@@ -0,0 +1,137 @@
+#ifndef ANDROID_HARDWARE_FAST_MATH_V2_0_KINGFISHER_H
+#define ANDROID_HARDWARE_FAST_MATH_V2_0_KINGFISHER_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace kingfisher {
+
+/*
+ * Single precision approximations used by the fusion kernels in place of
+ * libm. Maximum errors below are measured against double precision libm over
+ * the float range of the argument unless stated otherwise:
+ *
+ *   fastAtan2   2.0e-6 rad absolute
+ *   fastAsin    2.0e-6 rad absolute, argument in [-1, 1]
+ *   fastSinCos  4.0e-7 absolute, |x| <= 1000 rad
+ *   fastRsqrt   5.0e-6 relative, normal positive arguments
+ *
+ * NaN and infinite arguments are not handled. The batch forms give the same
+ * results as the scalar ones within the error above and use NEON on arm64 or
+ * SSE2 on x86, falling back to the scalar loop otherwise.
+ */
+
+namespace fastmath {
+
+constexpr float PI = 3.14159265358979f;
+constexpr float PI_2 = 1.57079632679490f;
+constexpr float TWO_OVER_PI = 0.63661977236758f;
+/* pi/2 split in three floats for argument reduction, k * PI_2_A is exact */
+constexpr float PI_2_A = 1.5703125f;
+constexpr float PI_2_B = 4.837512969970703125e-4f;
+constexpr float PI_2_C = 7.54978995489188216e-8f;
+
+/* Minimax polynomial of atan(x) on [0, 1] */
+constexpr float ATAN_C0 = 0.99997726f;
+constexpr float ATAN_C1 = -0.33262347f;
+constexpr float ATAN_C2 = 0.19354346f;
+constexpr float ATAN_C3 = -0.11643287f;
+constexpr float ATAN_C4 = 0.05265332f;
+constexpr float ATAN_C5 = -0.01172120f;
+
+/* Taylor series of sin(x) and cos(x) on [-pi/4, pi/4] */
+constexpr float SIN_C1 = -1.0f / 6.0f;
+constexpr float SIN_C2 = 1.0f / 120.0f;
+constexpr float SIN_C3 = -1.0f / 5040.0f;
+constexpr float COS_C1 = -1.0f / 2.0f;
+constexpr float COS_C2 = 1.0f / 24.0f;
+constexpr float COS_C3 = -1.0f / 720.0f;
+constexpr float COS_C4 = 1.0f / 40320.0f;
+
+static inline float atanPoly(float x)
+{
+    float x2 = x * x;
+
+    return x * (ATAN_C0 + x2 * (ATAN_C1 + x2 * (ATAN_C2 + x2 * (ATAN_C3 +
+        x2 * (ATAN_C4 + x2 * ATAN_C5)))));
+}
+
+}  // namespace fastmath
+
+static inline float fastAtan2(float y, float x)
+{
+    float ax = std::fabs(x);
+    float ay = std::fabs(y);
+    float maxValue = std::fmax(ax, ay);
+    float ratio = (maxValue > 0.0f) ? std::fmin(ax, ay) / maxValue : 0.0f;
+    float angle = fastmath::atanPoly(ratio);
+
+    if (ay > ax) {
+        angle = fastmath::PI_2 - angle;
+    }
+    if (x < 0.0f) {
+        angle = fastmath::PI - angle;
+    }
+
+    return std::copysign(angle, y);
+}
+
+static inline float fastAsin(float x)
+{
+    return fastAtan2(x, std::sqrt((1.0f - x) * (1.0f + x)));
+}
+
+static inline void fastSinCos(float x, float& sinValue, float& cosValue)
+{
+    float k = std::nearbyint(x * fastmath::TWO_OVER_PI);
+    int32_t quadrant = static_cast<int32_t>(k);
+    float r = ((x - k * fastmath::PI_2_A) - k * fastmath::PI_2_B) - k * fastmath::PI_2_C;
+    float r2 = r * r;
+
+    float s = r + r * r2 * (fastmath::SIN_C1 + r2 * (fastmath::SIN_C2 + r2 * fastmath::SIN_C3));
+    float c = 1.0f + r2 * (fastmath::COS_C1 + r2 * (fastmath::COS_C2 +
+        r2 * (fastmath::COS_C3 + r2 * fastmath::COS_C4)));
+
+    if (quadrant & 1) {
+        std::swap(s, c);
+    }
+
+    sinValue = (quadrant & 2) ? -s : s;
+    cosValue = ((quadrant + 1) & 2) ? -c : c;
+}
+
+static inline float fastRsqrt(float x)
+{
+    uint32_t bits;
+    float y;
+
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5f375a86 - (bits >> 1);
+    std::memcpy(&y, &bits, sizeof(y));
+
+    /* Two Newton-Raphson steps */
+    y = y * (1.5f - 0.5f * x * y * y);
+    y = y * (1.5f - 0.5f * x * y * y);
+
+    return y;
+}
+
+void fastAtan2Batch(const float* y, const float* x, float* out, size_t count);
+void fastAsinBatch(const float* in, float* out, size_t count);
+void fastSinCosBatch(const float* in, float* sinOut, float* cosOut, size_t count);
+void fastRsqrtBatch(const float* in, float* out, size_t count);
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif//ANDROID_HARDWARE_FAST_MATH_V2_0_KINGFISHER_H
@@ -0,0 +1,196 @@
+#ifndef ANDROID_HARDWARE_FUSION_KERNELS_V2_0_KINGFISHER_H
+#define ANDROID_HARDWARE_FUSION_KERNELS_V2_0_KINGFISHER_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+
+#include "FastMath.h"
+#include "FusionSensor.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_0 {
+namespace kingfisher {
+
+/*
+ * Batch kernels used by the virtual sensors. Each one walks whole columns of
+ * FusionData without any state carried between samples, so the loops can be
+ * vectorized by the compiler. Stateful filtering stays in process().
+ *
+ * The *Reference kernels are the original libm based math, used instead of
+ * the FastMath approximations when FUSION_REFERENCE_MATH is defined.
+ */
+
+/* Number of samples processed per step, temporaries are kept on stack */
+static constexpr size_t fusionKernelChunk = 32;
+
+/* Tilt of every axis against the horizontal plane, from gravity */
+static inline void accelTiltKernelReference(const Vec3Columns& accel, size_t count, Vec3Columns& tilt)
+{
+    const float* __restrict ax = accel.x.data();
+    const float* __restrict ay = accel.y.data();
+    const float* __restrict az = accel.z.data();
+    float* __restrict tx = tilt.x.data();
+    float* __restrict ty = tilt.y.data();
+    float* __restrict tz = tilt.z.data();
+
+    for (size_t i = 0; i < count; i++) {
+        tx[i] = std::atan(ax[i] / std::sqrt((ay[i] * ay[i] + az[i] * az[i])));
+        ty[i] = std::atan(ay[i] / std::sqrt((ax[i] * ax[i] + az[i] * az[i])));
+        tz[i] = std::atan(az[i] / std::sqrt((ax[i] * ax[i] + ay[i] * ay[i])));
+    }
+}
+
+/* Heading in the horizontal plane, not tilt compensated */
+static inline void magnAzimuthKernelReference(const Vec3Columns& magn, size_t count, std::vector<float>& azimuth)
+{
+    const float* __restrict mx = magn.x.data();
+    const float* __restrict my = magn.y.data();
+    float* __restrict out = azimuth.data();
+
+    for (size_t i = 0; i < count; i++) {
+        out[i] = std::atan2(my[i], mx[i]) - M_PI / 2.0;
+    }
+}
+
+/* Roll (phi), pitch (theta) and tilt compensated yaw (psi) */
+static inline void eulerAnglesKernelReference(const Vec3Columns& accel, const Vec3Columns& magn,
+    size_t count, Vec3Columns& angles)
+{
+    const float* __restrict ax = accel.x.data();
+    const float* __restrict ay = accel.y.data();
+    const float* __restrict az = accel.z.data();
+    const float* __restrict mx = magn.x.data();
+    const float* __restrict my = magn.y.data();
+    const float* __restrict mz = magn.z.data();
+    float* __restrict roll = angles.x.data();
+    float* __restrict pitch = angles.y.data();
+    float* __restrict yaw = angles.z.data();
+
+    for (size_t i = 0; i < count; i++) {
+        roll[i] = std::atan2(ay[i], az[i]);
+        pitch[i] = std::atan2(-ax[i], ay[i] * sin(roll[i]) + az[i] * cos(roll[i]));
+        yaw[i] = atan2(mz[i] * sin(roll[i]) - my[i] * cos(roll[i]), mx[i] * cos(pitch[i]) +
+            my[i] * sin(roll[i]) * sin(pitch[i]) + mz[i] * sin(pitch[i]) * cos(roll[i]));
+    }
+}
+
+/*
+ * Same as atan(a / sqrt(b^2 + c^2)) of the reference, computed as
+ * asin(a / |v|) with a single reciprocal square root per sample
+ */
+static inline void accelTiltKernel(const Vec3Columns& accel, size_t count, Vec3Columns& tilt)
+{
+#ifdef FUSION_REFERENCE_MATH
+    accelTiltKernelReference(accel, count, tilt);
+#else
+    float invNorm[fusionKernelChunk];
+    float ratio[fusionKernelChunk];
+
+    for (size_t start = 0; start < count; start += fusionKernelChunk) {
+        const size_t chunk = std::min(fusionKernelChunk, count - start);
+        const float* __restrict ax = accel.x.data() + start;
+        const float* __restrict ay = accel.y.data() + start;
+        const float* __restrict az = accel.z.data() + start;
+
+        for (size_t i = 0; i < chunk; i++) {
+            invNorm[i] = std::max(ax[i] * ax[i] + ay[i] * ay[i] + az[i] * az[i], FLT_MIN);
+        }
+        fastRsqrtBatch(invNorm, invNorm, chunk);
+
+        const float* axes[] = { ax, ay, az };
+        float* tiltAxes[] = { tilt.x.data() + start, tilt.y.data() + start, tilt.z.data() + start };
+        for (size_t axis = 0; axis < 3; axis++) {
+            for (size_t i = 0; i < chunk; i++) {
+                ratio[i] = std::clamp(axes[axis][i] * invNorm[i], -1.0f, 1.0f);
+            }
+            fastAsinBatch(ratio, tiltAxes[axis], chunk);
+        }
+    }
+#endif
+}
+
+static inline void magnAzimuthKernel(const Vec3Columns& magn, size_t count, std::vector<float>& azimuth)
+{
+#ifdef FUSION_REFERENCE_MATH
+    magnAzimuthKernelReference(magn, count, azimuth);
+#else
+    float* __restrict out = azimuth.data();
+
+    fastAtan2Batch(magn.y.data(), magn.x.data(), out, count);
+    for (size_t i = 0; i < count; i++) {
+        out[i] -= fastmath::PI_2;
+    }
+#endif
+}
+
+static inline void eulerAnglesKernel(const Vec3Columns& accel, const Vec3Columns& magn,
+    size_t count, Vec3Columns& angles)
+{
+#ifdef FUSION_REFERENCE_MATH
+    eulerAnglesKernelReference(accel, magn, count, angles);
+#else
+    float sinRoll[fusionKernelChunk];
+    float cosRoll[fusionKernelChunk];
+    float sinPitch[fusionKernelChunk];
+    float cosPitch[fusionKernelChunk];
+    float num[fusionKernelChunk];
+    float den[fusionKernelChunk];
+
+    for (size_t start = 0; start < count; start += fusionKernelChunk) {
+        const size_t chunk = std::min(fusionKernelChunk, count - start);
+        const float* __restrict ax = accel.x.data() + start;
+        const float* __restrict ay = accel.y.data() + start;
+        const float* __restrict az = accel.z.data() + start;
+        const float* __restrict mx = magn.x.data() + start;
+        const float* __restrict my = magn.y.data() + start;
+        const float* __restrict mz = magn.z.data() + start;
+        float* __restrict roll = angles.x.data() + start;
+        float* __restrict pitch = angles.y.data() + start;
+        float* __restrict yaw = angles.z.data() + start;
+
+        fastAtan2Batch(ay, az, roll, chunk);
+        fastSinCosBatch(roll, sinRoll, cosRoll, chunk);
+
+        for (size_t i = 0; i < chunk; i++) {
+            num[i] = -ax[i];
+            den[i] = ay[i] * sinRoll[i] + az[i] * cosRoll[i];
+        }
+        fastAtan2Batch(num, den, pitch, chunk);
+        fastSinCosBatch(pitch, sinPitch, cosPitch, chunk);
+
+        for (size_t i = 0; i < chunk; i++) {
+            num[i] = mz[i] * sinRoll[i] - my[i] * cosRoll[i];
+            den[i] = mx[i] * cosPitch[i] + my[i] * sinRoll[i] * sinPitch[i] +
+                mz[i] * sinPitch[i] * cosRoll[i];
+        }
+        fastAtan2Batch(num, den, yaw, chunk);
+    }
+#endif
+}
+
+/* Linear interpolation of `multiplier - 1` samples between each pair */
+static inline void lerpKernel(const std::vector<float>& in, size_t count, int multiplier,
+    std::vector<float>& out)
+{
+    const float* __restrict src = in.data();
+    float* __restrict dst = out.data();
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        for (int j = 0; j < multiplier; j++) {
+            float factor = (float) j / multiplier;
+            dst[i * multiplier + j] = src[i] + (src[i + 1] - src[i]) * factor;
+        }
+    }
+}
+
+}  // namespace kingfisher
+}  // namespace V2_0
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+#endif//ANDROID_HARDWARE_FUSION_KERNELS_V2_0_KINGFISHER_H
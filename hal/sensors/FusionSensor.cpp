@@ -36,7 +36,9 @@ void FusionSensor::FusionSensor::activate(FUSION_MODE mode, uint32_t sensorHandl
 {
     if (activate) {
         if (!mAcc->hasActiveListeners()) {
+            const std::lock_guard<std::mutex> lock(mBufferLock);
             mCurrentAccelEvents.clear();
+            clearStreamLocked(STREAM_ACCEL);
         }
         mAcc->activate(activate);
         mAcc->addVirtualListener(sensorHandle);
@@ -47,7 +49,9 @@ void FusionSensor::FusionSensor::activate(FUSION_MODE mode, uint32_t sensorHandl
     if (mode != FUSION_NOMAG) {
         if (activate) {
             if (!mMag->hasActiveListeners()) {
+                const std::lock_guard<std::mutex> lock(mBufferLock);
                 mCurrentMagnEvents.clear();
+                clearStreamLocked(STREAM_MAGN);
             }
             mMag->activate(activate);
             mMag->addVirtualListener(sensorHandle);
@@ -59,7 +63,9 @@ void FusionSensor::FusionSensor::activate(FUSION_MODE mode, uint32_t sensorHandl
     if (mode != FUSION_NOGYRO) {
         if (activate) {
             if (!mGyro->hasActiveListeners()) {
+                const std::lock_guard<std::mutex> lock(mBufferLock);
                 mCurrentGyroEvents.clear();
+                clearStreamLocked(STREAM_GYRO);
             }
             mGyro->activate(activate);
             mGyro->addVirtualListener(sensorHandle);
@@ -82,69 +88,175 @@ void FusionSensor::batch(FUSION_MODE mode, uint64_t ns)
     }
 }
 
+int FusionSensor::getStreamIndex(SensorType sensorType) const
+{
+    switch (sensorType) {
+        case SensorType::ACCELEROMETER:
+            return STREAM_ACCEL;
+        case SensorType::MAGNETIC_FIELD:
+            return STREAM_MAGN;
+        case SensorType::GYROSCOPE:
+            return STREAM_GYRO;
+        default:
+            return -1;
+    }
+}
+
+bool FusionSensor::isStreamParticipating(int stream) const
+{
+    switch (stream) {
+        case STREAM_ACCEL:
+            return mAcc->hasActiveListeners();
+        case STREAM_MAGN:
+            return mMag->hasActiveListeners();
+        case STREAM_GYRO:
+            return mGyro->hasActiveListeners();
+        default:
+            return false;
+    }
+}
+
+void FusionSensor::clearStreamLocked(int stream)
+{
+    mPendingEvents[stream].clear();
+    mLastPushedTimestamp[stream] = 0;
+}
+
 void FusionSensor::pushEvents(const std::vector<Event> &events)
 {
     if (events.empty())
         return;
 
-    const std::lock_guard<std::mutex> lock(mBufferLock);
+    uint32_t readyModes = 0;
+    {
+        const std::lock_guard<std::mutex> lock(mBufferLock);
 
-    for (size_t i = 0; i < events.size(); i++) {
-        if (events[i].sensorType == SensorType::ACCELEROMETER) {
-            if (mCurrentAccelEvents.size() >= FusionSensor::mMaxFusionData) {
-                mCurrentAccelEvents.pop_front();
+        for (size_t i = 0; i < events.size(); i++) {
+            int stream = getStreamIndex(events[i].sensorType);
+            if (stream < 0)
+                continue;
+
+            /* Same event may be passed twice by the group poll loop */
+            if (events[i].timestamp <= mLastPushedTimestamp[stream])
+                continue;
+
+            if (mPendingEvents[stream].size() >= FusionSensor::mMaxPendingEvents) {
+                mPendingEvents[stream].pop_front();
             }
-            mCurrentAccelEvents.push_back(events[i]);
-        } else if (events[i].sensorType == SensorType::MAGNETIC_FIELD) {
-            if (mCurrentMagnEvents.size() >= FusionSensor::mMaxFusionData) {
-                mCurrentMagnEvents.pop_front();
+            mPendingEvents[stream].push_back(events[i]);
+            mLastPushedTimestamp[stream] = events[i].timestamp;
+            mNewestTimestamp = std::max(mNewestTimestamp, events[i].timestamp);
+        }
+
+        releaseOrderedLocked(readyModes);
+    }
+
+    if (!mEventsReadyCb)
+        return;
+
+    for (int mode = 0; mode < NUM_FUSION_MODE; mode++) {
+        if (readyModes & (1u << mode)) {
+            mEventsReadyCb(static_cast<FUSION_MODE>(mode));
+        }
+    }
+}
+
+void FusionSensor::releaseOrderedLocked(uint32_t& readyModes)
+{
+    static const uint32_t requiredStreams[NUM_FUSION_MODE] = {
+        [FUSION_9AXIS] = (1u << STREAM_ACCEL) | (1u << STREAM_MAGN) | (1u << STREAM_GYRO),
+        [FUSION_NOMAG] = (1u << STREAM_ACCEL) | (1u << STREAM_GYRO),
+        [FUSION_NOGYRO] = (1u << STREAM_ACCEL) | (1u << STREAM_MAGN),
+    };
+
+    int64_t watermark = std::numeric_limits<int64_t>::max();
+    for (int stream = 0; stream < STREAM_COUNT; stream++) {
+        if (isStreamParticipating(stream)) {
+            watermark = std::min(watermark, mLastPushedTimestamp[stream]);
+        }
+    }
+
+    while (true) {
+        int oldest = -1;
+        for (int stream = 0; stream < STREAM_COUNT; stream++) {
+            if (mPendingEvents[stream].empty())
+                continue;
+            if (oldest < 0 || mPendingEvents[stream].front().timestamp <
+                    mPendingEvents[oldest].front().timestamp) {
+                oldest = stream;
             }
-            mCurrentMagnEvents.push_back(events[i]);
-        } else if (events[i].sensorType == SensorType::GYROSCOPE) {
-            if (mCurrentGyroEvents.size() >= FusionSensor::mMaxFusionData) {
-                mCurrentGyroEvents.pop_front();
+        }
+
+        if (oldest < 0)
+            break;
+
+        const Event event = mPendingEvents[oldest].front();
+        if (event.timestamp > watermark &&
+            event.timestamp + mReorderWindowNs.load() > mNewestTimestamp) {
+            break;
+        }
+        mPendingEvents[oldest].pop_front();
+
+        /* Arrived after the reorder window has already moved past it */
+        if (event.timestamp < mLastReleasedTimestamp) {
+            ALOGV("Dropping late event of type %d", static_cast<int>(event.sensorType));
+            continue;
+        }
+        mLastReleasedTimestamp = event.timestamp;
+
+        if (oldest == STREAM_ACCEL) {
+            mCurrentAccelEvents.push(event);
+        } else if (oldest == STREAM_MAGN) {
+            mCurrentMagnEvents.push(event);
+        } else {
+            mCurrentGyroEvents.push(event);
+        }
+
+        for (int mode = 0; mode < NUM_FUSION_MODE; mode++) {
+            mReleasedStreams[mode] |= (1u << oldest);
+            if ((mReleasedStreams[mode] & requiredStreams[mode]) == requiredStreams[mode]) {
+                mReleasedStreams[mode] = 0;
+                readyModes |= (1u << mode);
             }
-            mCurrentGyroEvents.push_back(events[i]);
         }
     }
 }
 
-std::vector<FusionData> FusionSensor::getFusionEvents(FUSION_MODE mode)
+void FusionSensor::getFusionEvents(FUSION_MODE mode, FusionData& fusionData)
 {
     const std::lock_guard<std::mutex> lock(mBufferLock);
     size_t readyEvents = mCurrentAccelEvents.size();
-    std::vector<FusionData> retData;
+    const bool useMagn = (mode == FUSION_9AXIS || mode == FUSION_NOGYRO);
+    const bool useGyro = (mode == FUSION_9AXIS || mode == FUSION_NOMAG);
 
-    if (mode == FUSION_9AXIS || mode == FUSION_NOGYRO) {
+    if (useMagn) {
         readyEvents = std::min(readyEvents, mCurrentMagnEvents.size());
     }
-    if (mode == FUSION_9AXIS || mode == FUSION_NOMAG) {
+    if (useGyro) {
         readyEvents = std::min(readyEvents, mCurrentGyroEvents.size());
     }
 
-    std::list<Event>::iterator accelIter = mCurrentAccelEvents.begin();
-    std::list<Event>::iterator gyroIter = mCurrentGyroEvents.begin();
-    std::list<Event>::iterator magnIter = mCurrentMagnEvents.begin();
-
-    for (size_t i = 0; i < readyEvents; i++) {
-        FusionData fusionData = {
-            .accelEvent = *accelIter,
-        };
-        accelIter++;
-
-        if (mode == FUSION_9AXIS || mode == FUSION_NOGYRO) {
-            fusionData.magEvent = *magnIter;
-            magnIter++;
-        }
-        if (mode == FUSION_9AXIS || mode == FUSION_NOMAG) {
-            fusionData.gyroEvent = *gyroIter;
-            gyroIter++;
-        }
+    fusionData.resize(readyEvents);
 
-        retData.push_back(fusionData);
+    mCurrentAccelEvents.copyTo(fusionData.accel, readyEvents);
+    if (useMagn) {
+        mCurrentMagnEvents.copyTo(fusionData.magn, readyEvents);
+    }
+    if (useGyro) {
+        mCurrentGyroEvents.copyTo(fusionData.gyro, readyEvents);
+        mCurrentGyroEvents.copyTimestampsTo(fusionData.timestamp, readyEvents);
+    } else {
+        mCurrentAccelEvents.copyTimestampsTo(fusionData.timestamp, readyEvents);
     }
+}
+
+void FusionSensor::setSlowestODR(uint16_t odr)
+{
+    int64_t window = mMinReorderWindowNs;
 
-    return retData;
+    if (odr)
+        window = std::max(window, static_cast<int64_t>(2 * NSEC / odr));
+    mReorderWindowNs = window;
 }
 
 int FusionSensor::getMinODR(FUSION_MODE mode){
@@ -155,7 +267,7 @@ int FusionSensor::getMinODR(FUSION_MODE mode){
     if (mode != FUSION_NOGYRO) {
         minODR = std::min(minODR, mGyro->getODR());
     }
-    return minODR;
+    return std::min(minODR, mODRLimit.load());
 }
 
 }  // namespace kingfisher
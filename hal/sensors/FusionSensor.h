@@ -3,7 +3,10 @@
 
 #include <android/hardware/sensors/1.0/ISensors.h>
 #include <string>
-#include <list>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <limits>
 
 #include "SensorDescriptors.h"
 #include "common.h"
@@ -20,22 +23,105 @@ using ::android::hardware::sensors::V1_0::OperationMode;
 using ::android::hardware::sensors::V1_0::Result;
 using ::android::hardware::sensors::V1_0::SensorInfo;
 
+/* Structure-of-arrays batch of vec3 samples */
+struct Vec3Columns
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    void resize(size_t size) { x.resize(size); y.resize(size); z.resize(size); }
+};
+
+/*
+ * Fused hardware samples, one column per axis. Timestamp is taken from the
+ * gyroscope if the fusion mode uses it, from the accelerometer otherwise.
+ */
 struct FusionData
 {
-    Event accelEvent;
-    Event gyroEvent;
-    Event magEvent;
+    std::vector<int64_t> timestamp;
+    Vec3Columns accel;
+    Vec3Columns gyro;
+    Vec3Columns magn;
+
+    size_t size() const { return timestamp.size(); }
+    void resize(size_t size)
+    {
+        timestamp.resize(size);
+        accel.resize(size);
+        gyro.resize(size);
+        magn.resize(size);
+    }
+};
+
+/* Fixed-capacity ring of vec3 samples, oldest sample is dropped on overflow */
+template <size_t Capacity>
+class SampleRing
+{
+    public:
+        size_t size() const { return mCount; }
+        void clear() { mHead = 0; mCount = 0; }
+
+        void push(const Event& event)
+        {
+            size_t pos;
+            if (mCount < Capacity) {
+                pos = (mHead + mCount) % Capacity;
+                mCount++;
+            } else {
+                pos = mHead;
+                mHead = (mHead + 1) % Capacity;
+            }
+            mTimestamp[pos] = event.timestamp;
+            mX[pos] = event.u.vec3.x;
+            mY[pos] = event.u.vec3.y;
+            mZ[pos] = event.u.vec3.z;
+        }
+
+        /* Copies the oldest `count` samples, ring is unwrapped in two runs */
+        void copyTo(Vec3Columns& to, size_t count) const
+        {
+            size_t first = std::min(count, Capacity - mHead);
+            std::copy(mX + mHead, mX + mHead + first, to.x.begin());
+            std::copy(mY + mHead, mY + mHead + first, to.y.begin());
+            std::copy(mZ + mHead, mZ + mHead + first, to.z.begin());
+            std::copy(mX, mX + count - first, to.x.begin() + first);
+            std::copy(mY, mY + count - first, to.y.begin() + first);
+            std::copy(mZ, mZ + count - first, to.z.begin() + first);
+        }
+
+        void copyTimestampsTo(std::vector<int64_t>& to, size_t count) const
+        {
+            size_t first = std::min(count, Capacity - mHead);
+            std::copy(mTimestamp + mHead, mTimestamp + mHead + first, to.begin());
+            std::copy(mTimestamp, mTimestamp + count - first, to.begin() + first);
+        }
+
+    private:
+        int64_t mTimestamp[Capacity];
+        float mX[Capacity];
+        float mY[Capacity];
+        float mZ[Capacity];
+        size_t mHead = 0;
+        size_t mCount = 0;
 };
 
+using EventsReadyCallback = std::function<void(FUSION_MODE)>;
+
 class FusionSensor
 {
     public:
+        void setEventsReadyCallback(const EventsReadyCallback& cb) { mEventsReadyCb = cb; }
         void addHwSensors(std::vector<std::shared_ptr<BaseSensor>>&);
         void activate(FUSION_MODE, uint32_t, bool);
         void batch(FUSION_MODE, uint64_t);
         void pushEvents(const std::vector<Event>&);
         int getMinODR(FUSION_MODE);
-        std::vector<FusionData> getFusionEvents(FUSION_MODE);
+        /* Caps the ODR reported by getMinODR while hardware runs slower */
+        void setODRLimit(uint16_t limit) { mODRLimit = limit; }
+        /* Physical output rate of the slowest participating hardware sensor */
+        void setSlowestODR(uint16_t);
+        void getFusionEvents(FUSION_MODE, FusionData&);
 
     private:
         std::shared_ptr<BaseSensor> mAcc;
@@ -43,9 +129,40 @@ class FusionSensor
         std::shared_ptr<BaseSensor> mGyro;
         std::mutex mBufferLock;
         static const size_t mMaxFusionData = 20;
-        std::list<Event> mCurrentAccelEvents;
-        std::list<Event> mCurrentGyroEvents;
-        std::list<Event> mCurrentMagnEvents;
+        SampleRing<mMaxFusionData> mCurrentAccelEvents;
+        SampleRing<mMaxFusionData> mCurrentGyroEvents;
+        SampleRing<mMaxFusionData> mCurrentMagnEvents;
+        std::atomic<uint16_t> mODRLimit = std::numeric_limits<uint16_t>::max();
+
+        /*
+         * Merge stage: hardware groups are polled by separate threads, so
+         * events are held per stream and released to the lists above in
+         * timestamp order. An event is released once every participating
+         * stream has reported a newer one, or after mReorderWindowNs.
+         */
+        enum FusionStream {
+            STREAM_ACCEL,
+            STREAM_MAGN,
+            STREAM_GYRO,
+            STREAM_COUNT
+        };
+
+        int getStreamIndex(SensorType) const;
+        bool isStreamParticipating(int) const;
+        void releaseOrderedLocked(uint32_t& readyModes);
+        void clearStreamLocked(int);
+
+        std::deque<Event> mPendingEvents[STREAM_COUNT];
+        int64_t mLastPushedTimestamp[STREAM_COUNT] = {};
+        int64_t mNewestTimestamp = 0;
+        int64_t mLastReleasedTimestamp = 0;
+        /* Bitmask of streams released since the mode listeners were notified */
+        uint32_t mReleasedStreams[NUM_FUSION_MODE] = {};
+        EventsReadyCallback mEventsReadyCb;
+        /* At least two periods of the slowest hardware stream */
+        static constexpr int64_t mMinReorderWindowNs = static_cast<int64_t>(NSEC / 10);
+        std::atomic<int64_t> mReorderWindowNs = mMinReorderWindowNs;
+        static constexpr size_t mMaxPendingEvents = 64;
 };
 
 }  // namespace kingfisher
@@ -1,4 +1,5 @@
 #include "GameRotationSensor.h"
+#include "FusionKernels.h"
 
 namespace android {
 namespace hardware {
@@ -6,8 +7,6 @@ namespace sensors {
 namespace V2_0 {
 namespace kingfisher {
 
-using ::android::hardware::sensors::V1_0::SensorStatus;
-
 GameRotationSensor::GameRotationSensor(const SensorDescriptor &sensorDescriptor, FusionSensor &fusionSensor) :
         VirtualSensor(sensorDescriptor, fusionSensor),
         mAngleX(0.0), mAngleY(0.0), mAngleZ(0.0), mIsNeedInitPosition(false)
@@ -33,39 +32,29 @@ void GameRotationSensor::boundValues(float &value)
     value /= M_PI;
 }
 
-int GameRotationSensor::process(const std::vector<FusionData> &fusionData, std::vector<Event> &events)
+int GameRotationSensor::process(const FusionData &fusionData, std::vector<Event> &events)
 {
-    Event newEvent;
-
-    for (size_t i = 0; i < fusionData.size(); i++) {
-        float dt = fusionData[i].gyroEvent.timestamp - mTimestamp;
-
-        if (mTimestamp >= fusionData[i].gyroEvent.timestamp) {
-            continue;
-        }
-
-        if (dt > NSEC) {
-            mTimestamp = fusionData[i].gyroEvent.timestamp;
-            continue;
-        }
-        mTimestamp = fusionData[i].gyroEvent.timestamp;
+    size_t count = selectNewSamples(fusionData);
+    if (!count) {
+        return events.size();
+    }
 
-        newEvent = fusionData[i].accelEvent;
-        newEvent.sensorType = mSensorDescriptor.sensorInfo.type;
-        newEvent.u.vec3.status = SensorStatus::ACCURACY_HIGH;
-        newEvent.sensorHandle = mSensorDescriptor.sensorInfo.sensorHandle;
+    /* Stateless part of the filter for the whole batch */
+    mAccelAngles.resize(fusionData.size());
+    accelTiltKernel(fusionData.accel, fusionData.size(), mAccelAngles);
 
-        float xAccel = fusionData[i].accelEvent.u.vec3.x;
-        float yAccel = fusionData[i].accelEvent.u.vec3.y;
-        float zAccel = fusionData[i].accelEvent.u.vec3.z;
+    for (size_t n = 0; n < count; n++) {
+        size_t i = mSampleIndexes[n];
+        float dt = mSampleDt[n];
+        Event newEvent = createEvent(fusionData.timestamp[i]);
 
-        float xGyro = fusionData[i].gyroEvent.u.vec3.x;
-        float yGyro = fusionData[i].gyroEvent.u.vec3.y;
-        float zGyro = fusionData[i].gyroEvent.u.vec3.z;
+        float xGyro = fusionData.gyro.x[i];
+        float yGyro = fusionData.gyro.y[i];
+        float zGyro = fusionData.gyro.z[i];
 
-        float xAccelAngle = std::atan(xAccel / std::sqrt((yAccel * yAccel + zAccel * zAccel)));
-        float yAccelAngle = std::atan(yAccel / std::sqrt((xAccel * xAccel + zAccel * zAccel)));
-        float zAccelAngle = std::atan(zAccel / std::sqrt((xAccel * xAccel + yAccel * yAccel)));
+        float xAccelAngle = mAccelAngles.x[i];
+        float yAccelAngle = mAccelAngles.y[i];
+        float zAccelAngle = mAccelAngles.z[i];
 
         if (mIsNeedInitPosition) {
             mAngleX = xAccelAngle;
@@ -74,19 +63,17 @@ int GameRotationSensor::process(const std::vector<FusionData> &fusionData, std::
             mIsNeedInitPosition = false;
         }
 
-        newEvent.timestamp = mTimestamp;
-
         /* Accumulate gyro value should be multiplied by time difference between the current and the last events. */
         if (std::fabs(xGyro) > THRESHOLD) {
-            mAngleX += xGyro * (dt / NSEC);
+            mAngleX += xGyro * dt;
         }
 
         if (std::fabs(yGyro) > THRESHOLD) {
-            mAngleY += yGyro * (dt / NSEC);
+            mAngleY += yGyro * dt;
         }
 
         if (std::fabs(zGyro) > THRESHOLD) {
-            mAngleZ += zGyro * (dt / NSEC);
+            mAngleZ += zGyro * dt;
         }
 
         /* Simple complementary filter */
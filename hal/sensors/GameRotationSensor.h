@@ -28,8 +28,11 @@ class GameRotationSensor : public VirtualSensor
         explicit GameRotationSensor(const SensorDescriptor&, FusionSensor&);
 
     protected:
-        int process(const std::vector<FusionData>&, std::vector<Event>&) override;
+        int process(const FusionData&, std::vector<Event>&) override;
         void preActivateActions() override;
+
+        /* Per-batch angles computed by the kernels */
+        Vec3Columns mAccelAngles;
         void boundValues(float&);
 
         float mAngleX;
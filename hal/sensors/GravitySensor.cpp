@@ -8,35 +8,22 @@ namespace sensors {
 namespace V2_0 {
 namespace kingfisher {
 
-using ::android::hardware::sensors::V1_0::SensorStatus;
-
 GravitySensor::GravitySensor(const SensorDescriptor &sensorDescriptor, FusionSensor &fusionSensor) :
         VirtualSensor(sensorDescriptor, fusionSensor)
 {
 }
 
-int GravitySensor::process(const std::vector<FusionData> &fusionData, std::vector<Event> &events)
+int GravitySensor::process(const FusionData &fusionData, std::vector<Event> &events)
 {
-    Event newEvent;
-
-    for (size_t i = 0; i < fusionData.size(); i++) {
-        float dt = fusionData[i].gyroEvent.timestamp - mTimestamp;
-
-        if (mTimestamp >= fusionData[i].gyroEvent.timestamp) {
-            continue;
-        }
-
-        if (dt > NSEC) {
-            mTimestamp = fusionData[i].gyroEvent.timestamp;
-            continue;
-        }
-        mTimestamp = fusionData[i].gyroEvent.timestamp;
-
-        newEvent = fusionData[i].accelEvent;
-        newEvent.sensorType = mSensorDescriptor.sensorInfo.type;
-        newEvent.u.vec3.status = SensorStatus::ACCURACY_HIGH;
-        newEvent.sensorHandle = mSensorDescriptor.sensorInfo.sensorHandle;
-        newEvent.timestamp = mTimestamp;
+    size_t count = selectNewSamples(fusionData);
+
+    for (size_t n = 0; n < count; n++) {
+        size_t i = mSampleIndexes[n];
+        Event newEvent = createEvent(fusionData.timestamp[i]);
+
+        newEvent.u.vec3.x = fusionData.accel.x[i];
+        newEvent.u.vec3.y = fusionData.accel.y[i];
+        newEvent.u.vec3.z = fusionData.accel.z[i];
 
         events.push_back(newEvent);
     }
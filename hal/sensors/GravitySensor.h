@@ -27,7 +27,7 @@ class GravitySensor : public VirtualSensor
         explicit GravitySensor(const SensorDescriptor&, FusionSensor&);
 
     protected:
-        int process(const std::vector<FusionData>&, std::vector<Event>&) override;
+        int process(const FusionData&, std::vector<Event>&) override;
         void preActivateActions() override { };
 };
 
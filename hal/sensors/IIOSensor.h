@@ -22,7 +22,11 @@ using ::android::hardware::sensors::V1_0::OperationMode;
 using ::android::hardware::sensors::V1_0::Result;
 using ::android::hardware::sensors::V1_0::SensorInfo;
 
-class IIOSensor : public BaseSensor
+/*
+ * Final, so the specialized poll loops in Sensors call it without virtual
+ * dispatch.
+ */
+class IIOSensor final : public BaseSensor
 {
     public:
         explicit IIOSensor(const SensorDescriptor &);
@@ -28,7 +28,7 @@ class LinearAccelerationSensor : public VirtualSensor
         explicit LinearAccelerationSensor(const SensorDescriptor&, FusionSensor&);
 
     protected:
-        int process(const std::vector<FusionData>&, std::vector<Event>&) override;
+        int process(const FusionData&, std::vector<Event>&) override;
         void preActivateActions() override { };
 
         float mGravityX;
@@ -1,6 +1,7 @@
 #include <iterator>
 #include <algorithm>
 #include "OrientationSensor.h"
+#include "FusionKernels.h"
 
 namespace android {
 namespace hardware {
@@ -8,8 +9,6 @@ namespace sensors {
 namespace V2_0 {
 namespace kingfisher {
 
-using ::android::hardware::sensors::V1_0::SensorStatus;
-
 OrientationSensor::OrientationSensor(const SensorDescriptor &sensorDescriptor, FusionSensor &fusionSensor) :
         VirtualSensor(sensorDescriptor, fusionSensor),
         mAngleX(0.0), mAngleY(0.0), mAngleZ(0.0)
@@ -23,45 +22,27 @@ void OrientationSensor::preActivateActions()
     mAngleZ = 0;
 }
 
-int OrientationSensor::process(const std::vector<FusionData> &fusionData, std::vector<Event> &events)
+int OrientationSensor::process(const FusionData &fusionData, std::vector<Event> &events)
 {
-    Event newEvent;
-
-    for (size_t i = 0; i < fusionData.size(); i++) {
-        float dt = fusionData[i].gyroEvent.timestamp - mTimestamp;
-
-        if (mTimestamp >= fusionData[i].gyroEvent.timestamp) {
-            continue;
-        }
-
-        if (dt > NSEC) {
-            mTimestamp = fusionData[i].gyroEvent.timestamp;
-            continue;
-        }
-        mTimestamp = fusionData[i].gyroEvent.timestamp;
-
-        newEvent = fusionData[i].accelEvent;
-        newEvent.sensorType = mSensorDescriptor.sensorInfo.type;
-        newEvent.u.vec3.status = SensorStatus::ACCURACY_HIGH;
-        newEvent.sensorHandle = mSensorDescriptor.sensorInfo.sensorHandle;
+    size_t count = selectNewSamples(fusionData);
+    if (!count) {
+        return events.size();
+    }
 
-        float xAccel = fusionData[i].accelEvent.u.vec3.x;
-        float yAccel = fusionData[i].accelEvent.u.vec3.y;
-        float zAccel = fusionData[i].accelEvent.u.vec3.z;
+    mAngles.resize(fusionData.size());
+    eulerAnglesKernel(fusionData.accel, fusionData.magn, fusionData.size(), mAngles);
 
-        float xMagn = fusionData[i].magEvent.u.vec3.x;
-        float yMagn = fusionData[i].magEvent.u.vec3.y;
-        float zMagn = fusionData[i].magEvent.u.vec3.z;
+    for (size_t n = 0; n < count; n++) {
+        size_t i = mSampleIndexes[n];
+        Event newEvent = createEvent(fusionData.timestamp[i]);
 
-        mAngleX = std::atan2(yAccel, zAccel); //phi
-        mAngleY = std::atan2(-xAccel, yAccel * sin(mAngleX) + zAccel * cos(mAngleX)); //theta
-        mAngleZ = atan2(zMagn * sin(mAngleX) - yMagn * cos(mAngleX), xMagn * cos(mAngleY) +
-            yMagn * sin(mAngleX) * sin(mAngleY) + zMagn * sin(mAngleY) * cos(mAngleX)); //psi
+        mAngleX = mAngles.x[i]; //phi
+        mAngleY = mAngles.y[i]; //theta
+        mAngleZ = mAngles.z[i]; //psi
 
         newEvent.u.vec3.x = mAngleX * 180 / M_PI;
         newEvent.u.vec3.y = mAngleY * 180 / M_PI;
         newEvent.u.vec3.z = mAngleZ * 180 / M_PI;
-        newEvent.timestamp = mTimestamp;
 
         events.push_back(newEvent);
     }
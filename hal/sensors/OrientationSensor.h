@@ -33,8 +33,11 @@ class OrientationSensor : public VirtualSensor
         explicit OrientationSensor(const SensorDescriptor&, FusionSensor&);
 
     protected:
-        int process(const std::vector<FusionData>&, std::vector<Event>&) override;
+        int process(const FusionData&, std::vector<Event>&) override;
         void preActivateActions() override;
+
+        /* Roll, pitch and yaw of the current batch */
+        Vec3Columns mAngles;
 };
 
 }  // namespace kingfisher
@@ -1,6 +1,7 @@
 #include <iterator>
 #include <algorithm>
 #include "RotationVector.h"
+#include "FusionKernels.h"
 
 namespace android {
 namespace hardware {
@@ -8,8 +9,6 @@ namespace sensors {
 namespace V2_0 {
 namespace kingfisher {
 
-using ::android::hardware::sensors::V1_0::SensorStatus;
-
 RotationVector::RotationVector(const SensorDescriptor &sensorDescriptor, FusionSensor &fusionSensor) :
         VirtualSensor(sensorDescriptor, fusionSensor)
 {
@@ -34,65 +33,50 @@ void RotationVector::boundValues(float &value)
     value /= M_PI;
 }
 
-int RotationVector::process(const std::vector<FusionData> &fusionData, std::vector<Event> &events)
+int RotationVector::process(const FusionData &fusionData, std::vector<Event> &events)
 {
-    Event newEvent;
-
-    for (size_t i = 0; i < fusionData.size(); i++) {
-        float dt = fusionData[i].gyroEvent.timestamp - mTimestamp;
-
-        if (mTimestamp >= fusionData[i].gyroEvent.timestamp) {
-            continue;
-        }
-
-        if (dt > NSEC) {
-            mTimestamp = fusionData[i].gyroEvent.timestamp;
-            continue;
-        }
-        mTimestamp = fusionData[i].gyroEvent.timestamp;
-
-        newEvent = fusionData[i].gyroEvent;
-        newEvent.sensorType = mSensorDescriptor.sensorInfo.type;
-        newEvent.u.vec3.status = SensorStatus::ACCURACY_HIGH;
-        newEvent.sensorHandle = mSensorDescriptor.sensorInfo.sensorHandle;
-
-        float xAccel = fusionData[i].accelEvent.u.vec3.x;
-        float yAccel = fusionData[i].accelEvent.u.vec3.y;
-        float zAccel = fusionData[i].accelEvent.u.vec3.z;
+    size_t count = selectNewSamples(fusionData);
+    if (!count) {
+        return events.size();
+    }
 
-        float xMagn = fusionData[i].magEvent.u.vec3.x;
-        float yMagn = fusionData[i].magEvent.u.vec3.y;
+    /* Stateless part of the filter for the whole batch */
+    mAccelAngles.resize(fusionData.size());
+    mAzimuth.resize(fusionData.size());
+    accelTiltKernel(fusionData.accel, fusionData.size(), mAccelAngles);
+    magnAzimuthKernel(fusionData.magn, fusionData.size(), mAzimuth);
 
-        float xGyro = fusionData[i].gyroEvent.u.vec3.x;
-        float yGyro = fusionData[i].gyroEvent.u.vec3.y;
-        float zGyro = fusionData[i].gyroEvent.u.vec3.z;
+    for (size_t n = 0; n < count; n++) {
+        size_t i = mSampleIndexes[n];
+        float dt = mSampleDt[n];
+        Event newEvent = createEvent(fusionData.timestamp[i]);
 
-        float xAccelAngle = std::atan(xAccel / std::sqrt((yAccel * yAccel + zAccel * zAccel)));
-        float yAccelAngle = std::atan(yAccel / std::sqrt((xAccel * xAccel + zAccel * zAccel)));
-        float zAccelAngle = std::atan(zAccel / std::sqrt((xAccel * xAccel + yAccel * yAccel)));
+        float xGyro = fusionData.gyro.x[i];
+        float yGyro = fusionData.gyro.y[i];
+        float zGyro = fusionData.gyro.z[i];
 
-        float azimuth = std::atan2(yMagn, xMagn) - M_PI / 2.0;
+        float xAccelAngle = mAccelAngles.x[i];
+        float yAccelAngle = mAccelAngles.y[i];
+        float zAccelAngle = mAccelAngles.z[i];
 
         if (mIsNeedInitPosition) {
             mCurrAngleX = xAccelAngle;
             mCurrAngleY = yAccelAngle;
-            mCurrAngleZ = azimuth;
+            mCurrAngleZ = mAzimuth[i];
             mIsNeedInitPosition = false;
         }
 
-        newEvent.timestamp = mTimestamp;
-
         /* Accumulate gyro value should be multiplied by time difference between the current and the last events. */
         if (std::fabs(xGyro) > THRESHOLD) {
-            mCurrAngleX += xGyro * (dt / NSEC);
+            mCurrAngleX += xGyro * dt;
         }
 
         if (std::fabs(yGyro) > THRESHOLD) {
-            mCurrAngleY += yGyro * (dt / NSEC);
+            mCurrAngleY += yGyro * dt;
         }
 
         if (std::fabs(zGyro) > THRESHOLD) {
-            mCurrAngleZ += zGyro * (dt / NSEC);
+            mCurrAngleZ += zGyro * dt;
         }
 
         /* Simple complementary filter */
@@ -27,9 +27,13 @@ class RotationVector : public VirtualSensor
         explicit RotationVector(const SensorDescriptor&, FusionSensor&);
 
     protected:
-        int process(const std::vector<FusionData>&, std::vector<Event>&) override;
+        int process(const FusionData&, std::vector<Event>&) override;
         void preActivateActions() override;
 
+        /* Per-batch angles computed by the kernels */
+        Vec3Columns mAccelAngles;
+        std::vector<float> mAzimuth;
+
         void boundValues(float&);
 
         float mCurrAngleX = 0;
@@ -2,6 +2,7 @@
 #define IIO_SENSOR_DESCRIPTOR_H
 
 #include <android/hardware/sensors/1.0/ISensors.h>
+#include <algorithm>
 #include <cmath>
 #include <thread>
 
@@ -131,6 +132,65 @@ const static std::vector<SensorsGroupDescriptor> sensorGroupDescriptors = {
     },
 };
 
+/*
+ * Whether a sensor is computed from the others, indexed like sensors_descriptors
+ * below. Only this is needed at compile time, the rest of the table holds strings
+ * and cannot be constexpr. Hardware sensors must go first.
+ */
+constexpr bool sensorIsVirtual[] = {
+    [SensorIndex::ACC]    = false,
+    [SensorIndex::GYR]    = false,
+    [SensorIndex::MAG]    = false,
+    [SensorIndex::GRAV]   = true,
+    [SensorIndex::ROTV]   = true,
+    [SensorIndex::GEOMAG] = true,
+    [SensorIndex::LINACC] = true,
+    [SensorIndex::GAME]   = true,
+    [SensorIndex::ORIENT] = true,
+};
+
+static_assert(sizeof(sensorIsVirtual) / sizeof(sensorIsVirtual[0]) == SensorIndex::COUNT,
+              "sensorIsVirtual must describe every SensorIndex");
+
+constexpr size_t sensorHandleToIndex(uint32_t handle)
+{
+    return handle - 1;
+}
+
+constexpr size_t countHwSensors()
+{
+    size_t count = 0;
+    for (size_t i = 0; i < SensorIndex::COUNT; i++) {
+        if (!sensorIsVirtual[i])
+            count++;
+    }
+    return count;
+}
+
+constexpr size_t HW_SENSOR_COUNT = countHwSensors();
+
+/*
+ * Compile-time list of the sensors read from one IIO buffer. Groups matching
+ * one of the layouts get a poll loop specialized for them, others fall back
+ * to the generic one.
+ */
+template <uint32_t... Handles>
+struct IIOGroupLayout
+{
+    static_assert(((sensorHandleToIndex(Handles) < HW_SENSOR_COUNT) && ...),
+                  "Only hardware sensors can be placed to the IIO group");
+
+    static bool matches(const std::vector<uint32_t>& handles)
+    {
+        const uint32_t layout[] = { Handles... };
+        return std::equal(handles.begin(), handles.end(),
+                          std::begin(layout), std::end(layout));
+    }
+};
+
+using AccMagnGroupLayout = IIOGroupLayout<HandleIndex::ACC_HANDLE, HandleIndex::MAGN_HANDLE>;
+using GyroGroupLayout = IIOGroupLayout<HandleIndex::GYRO_HANDLE>;
+
 /* TODO: Change the legacy architecture by moving this info to sensor constructors */
 static SensorDescriptor sensors_descriptors[] = {
     [SensorIndex::ACC] = {
@@ -366,6 +426,10 @@ static SensorDescriptor sensors_descriptors[] = {
     },
 };
 
+static_assert(sizeof(sensors_descriptors) / sizeof(sensors_descriptors[0]) ==
+              sizeof(sensorIsVirtual) / sizeof(sensorIsVirtual[0]),
+              "sensorIsVirtual and sensors_descriptors must list the same sensors");
+
 }  // namespace kingfisher
 }  // namespace V2_0
 }  // namespace sensors
@@ -49,10 +49,14 @@ Sensors::Sensors()
 
     /* Do not change the sensors push sequence! */
     /* Firstly, initialize hardware sensors, then virtual */
-    mSensors.push_back(std::make_shared<IIOSensor>(mSensorDescriptors[SensorIndex::ACC]));
-    mSensors.push_back(std::make_shared<IIOSensor>(mSensorDescriptors[SensorIndex::GYR]));
-    mSensors.push_back(std::make_shared<IIOSensor>(mSensorDescriptors[SensorIndex::MAG]));
+    mIIOSensors[SensorIndex::ACC] = std::make_shared<IIOSensor>(mSensorDescriptors[SensorIndex::ACC]);
+    mIIOSensors[SensorIndex::GYR] = std::make_shared<IIOSensor>(mSensorDescriptors[SensorIndex::GYR]);
+    mIIOSensors[SensorIndex::MAG] = std::make_shared<IIOSensor>(mSensorDescriptors[SensorIndex::MAG]);
+    for (size_t i = 0; i < HW_SENSOR_COUNT; i++) {
+        mSensors.push_back(mIIOSensors[i]);
+    }
     mFusionSensor.addHwSensors(mSensors);
+    mFusionSensor.setEventsReadyCallback([this](FUSION_MODE mode) { notifyListeners(mode); });
 
     mSensors.push_back(std::make_shared<GravitySensor>
         (mSensorDescriptors[SensorIndex::GRAV], mFusionSensor));
@@ -117,117 +121,162 @@ void Sensors::parseBuffer(const IIOCombinedBuffer& from, IIOBuffer& to, uint32_t
     return;
 }
 
+/* Same as parseBuffer(), resolved at compile time */
+template <uint32_t Handle>
+static inline void parseIIOBuffer(const IIOCombinedBuffer& from, IIOBuffer& to)
+{
+    if constexpr (Handle == HandleIndex::ACC_HANDLE) {
+        to.coords = from.accelMagnBuf.accel;
+        to.timestamp = from.accelMagnBuf.timestamp;
+    } else if constexpr (Handle == HandleIndex::MAGN_HANDLE) {
+        to.coords = from.accelMagnBuf.magn;
+        to.timestamp = from.accelMagnBuf.timestamp;
+    } else {
+        to.coords = from.genericBuf.coords;
+        to.timestamp = from.genericBuf.timestamp;
+    }
+}
+
+/*
+ * Per-sample path shared by the specialized and the generic group loops.
+ * With SensorT = IIOSensor all the calls are resolved statically.
+ */
+template <typename SensorT, typename ParserT>
+inline void Sensors::processSample(SensorT& sensor, uint16_t triggerODR,
+    const ParserT& parser, std::vector<Event>& outEvents)
+{
+    sensor.addTicks(sensor.getODR());
+    if (sensor.getTicks() >= triggerODR) {
+        sensor.resetTicks();
+        if (sensor.isActive() || sensor.hasActiveListeners()) {
+            IIOBuffer readBuffer;
+            parser(readBuffer);
+            sensor.transformData(readBuffer);
+            size_t firstNew = outEvents.size();
+            sensor.getReadyEvents(outEvents, mMode);
+
+            if (mMode == OperationMode::NORMAL &&
+                mAdaptiveODR.update(outEvents, firstNew)) {
+                applyAdaptiveODR();
+            }
+
+            mFusionSensor.pushEvents(outEvents);
+        }
+    }
+    if (sensor.isActive()) {
+        postEvents(outEvents);
+        outEvents.clear();
+    }
+}
+
+template <uint32_t Handle>
+inline void Sensors::processIIOSample(const IIOCombinedBuffer& rawBuffer,
+    uint16_t triggerODR, std::vector<Event>& outEvents)
+{
+    constexpr size_t sensorIndex = sensorHandleToIndex(Handle);
+
+    processSample(*mIIOSensors[sensorIndex], triggerODR,
+        [&rawBuffer](IIOBuffer& to) { parseIIOBuffer<Handle>(rawBuffer, to); },
+        outEvents);
+}
+
+bool Sensors::readIIOGroupBuffer(uint32_t groupIndex, IIOCombinedBuffer& rawBuffer, int& retryCount)
+{
+    int readBytes = ::read(mSensorGroups[groupIndex].fd,
+        &rawBuffer, mSensorGroups[groupIndex].bufSize);
+    if (readBytes == mSensorGroups[groupIndex].bufSize)
+        return true;
+
+    ALOGE("Failed to read data from %s buffer file",
+        mSensorGroups[groupIndex].name.c_str());
+    ALOGE("Expected %d bytes, actual %d",
+        mSensorGroups[groupIndex].bufSize, readBytes);
+    if(++retryCount > maxReadRetries)
+        mTerminatePollThreads = true;
+
+    return false;
+}
+
+/*
+ * Poll loop for groups described by IIOGroupLayout. The sensors of the group,
+ * their buffer layout and the index lookups are known at compile time.
+ */
+template <uint32_t... Handles>
+void Sensors::pollIIOGroup(uint32_t groupIndex, IIOGroupLayout<Handles...>)
+{
+    int retryCount = 0;
+    std::vector<Event> outEvents;
+
+    while(!mTerminatePollThreads.load()) {
+        IIOCombinedBuffer rawBuffer;
+        if (!readIIOGroupBuffer(groupIndex, rawBuffer, retryCount))
+            continue;
+
+        /* Decimate against the physical rate, it may be lower than requested */
+        uint16_t maxODR = getTriggerODRFromGroup(groupIndex);
+
+        (processIIOSample<Handles>(rawBuffer, maxODR, outEvents), ...);
+    }
+}
+
 /*
  * Generalized method to handle all sensors. Handles special case with LSM9DS0 -
  * accelerometer and magnetometer. They are placed at the same I2C address and
  * have same chrdev in /dev.
 */
-void Sensors::pollIIODeviceGroupBuffer(uint32_t groupIndex)
+void Sensors::pollIIOGroupGeneric(uint32_t groupIndex)
 {
     int retryCount = 0;
     std::vector<Event> outEvents;
 
     while(!mTerminatePollThreads.load()) {
         IIOCombinedBuffer rawBuffer;
-        int readBytes = ::read(mSensorGroups[groupIndex].fd,
-            &rawBuffer, mSensorGroups[groupIndex].bufSize);
-        if (readBytes == mSensorGroups[groupIndex].bufSize) {
-            IIOBuffer readBuffer;
+        if (!readIIOGroupBuffer(groupIndex, rawBuffer, retryCount))
+            continue;
 
-            uint16_t maxODR = getMaxODRFromGroup(groupIndex);
-
-            for (size_t i = 0; i < mSensorGroups[groupIndex].sensorHandles.size(); i++) {
-                uint32_t sensorHandle = mSensorGroups[groupIndex].sensorHandles[i];
-                uint32_t sensorIndex = handleToIndex(sensorHandle);
-                uint16_t sensorODR = mSensors[sensorIndex]->getODR();
-
-                mSensors[sensorIndex]->addTicks(sensorODR);
-                if (mSensors[sensorIndex]->getTicks() >= maxODR) {
-                    mSensors[sensorIndex]->resetTicks();
-                    if (mSensors[sensorIndex]->isActive() ||
-                        mSensors[sensorIndex]->hasActiveListeners()) {
-                        parseBuffer(rawBuffer, readBuffer, sensorHandle);
-                        mSensors[sensorIndex]->transformData(readBuffer);
-                        mSensors[sensorIndex]->getReadyEvents(outEvents, mMode);
-
-                        mFusionSensor.pushEvents(outEvents);
-                        setReadyFlag(mSensors[sensorIndex]->getSensorType());
-                        notifyListeners();
-                    }
-                }
-                if (mSensors[sensorIndex]->isActive()) {
-                    postEvents(outEvents);
-                    outEvents.clear();
-                }
-            }
-        } else {
-            ALOGE("Failed to read data from %s buffer file",
-                mSensorGroups[groupIndex].name.c_str());
-            ALOGE("Expected %d bytes, actual %d",
-                mSensorGroups[groupIndex].bufSize, readBytes);
-            if(++retryCount > maxReadRetries)
-                mTerminatePollThreads = true;
+        /* Decimate against the physical rate, it may be lower than requested */
+        uint16_t maxODR = getTriggerODRFromGroup(groupIndex);
+
+        for (size_t i = 0; i < mSensorGroups[groupIndex].sensorHandles.size(); i++) {
+            uint32_t sensorHandle = mSensorGroups[groupIndex].sensorHandles[i];
+
+            processSample(*mSensors[handleToIndex(sensorHandle)], maxODR,
+                [this, &rawBuffer, sensorHandle](IIOBuffer& to) {
+                    parseBuffer(rawBuffer, to, sensorHandle);
+                },
+                outEvents);
         }
     }
 }
 
-void Sensors::setReadyFlag(SensorType sensorType)
+void Sensors::pollIIODeviceGroupBuffer(uint32_t groupIndex)
 {
-    if (sensorType == SensorType::ACCELEROMETER) {
-        mAccelEventReady = true;
-    } else if (sensorType == SensorType::MAGNETIC_FIELD) {
-        mMagnEventReady = true;
-    } else if (sensorType == SensorType::GYROSCOPE) {
-        mGyroEventReady = true;
-    }
-}
+    const std::vector<uint32_t>& handles = mSensorGroups[groupIndex].sensorHandles;
 
-void Sensors::resetReadyFlag(FUSION_MODE mode)
-{
-    mAccelEventReady = false;
-    if (mode == FUSION_9AXIS) {
-        mMagnEventReady = false;
-        mGyroEventReady = false;
-    } else if (mode == FUSION_NOMAG) {
-        mGyroEventReady = false;
-    } else if (mode == FUSION_NOGYRO) {
-        mMagnEventReady = false;
+    if (AccMagnGroupLayout::matches(handles)) {
+        pollIIOGroup(groupIndex, AccMagnGroupLayout());
+    } else if (GyroGroupLayout::matches(handles)) {
+        pollIIOGroup(groupIndex, GyroGroupLayout());
+    } else {
+        ALOGI("No static layout for %s, using generic poll loop",
+            mSensorGroups[groupIndex].name.c_str());
+        pollIIOGroupGeneric(groupIndex);
     }
 }
 
-void Sensors::notifyListeners()
+/*
+ * Called by FusionSensor once the timestamp ordered stream holds new data for
+ * every hardware sensor the fusion mode needs.
+ */
+void Sensors::notifyListeners(FUSION_MODE mode)
 {
-    bool isEventsProcessed = false;
-    if (!mAccelEventReady.load())
-        return;
-
     for (size_t i = 0; i < mSensorGroups.size(); i++) {
-        if (!mSensorGroups[i].isVirtual) {
+        if (!mSensorGroups[i].isVirtual || mSensorGroups[i].mode != mode) {
             continue;
         }
 
         uint32_t sensorHandle = mSensorGroups[i].sensorHandles[0];
-        uint32_t sensorIndex = handleToIndex(sensorHandle);
-
-        if (mSensorGroups[i].mode == FUSION_9AXIS &&
-            mMagnEventReady.load() && mGyroEventReady.load()) {
-            mSensors[sensorIndex]->notifyEventsReady();
-            isEventsProcessed = true;
-        } else if (mSensorGroups[i].mode == FUSION_NOMAG &&
-            mGyroEventReady.load()) {
-            mSensors[sensorIndex]->notifyEventsReady();
-            isEventsProcessed = true;
-        } else if (mSensorGroups[i].mode == FUSION_NOGYRO &&
-            mMagnEventReady.load()) {
-            mSensors[sensorIndex]->notifyEventsReady();
-            isEventsProcessed = true;
-        }
-    }
-
-    if (isEventsProcessed) {
-        for (size_t i = 0; i < mSensorGroups.size(); i++) {
-            resetReadyFlag(mSensorGroups[i].mode);
-        }
+        mSensors[handleToIndex(sensorHandle)]->notifyEventsReady();
     }
 }
 
@@ -302,13 +351,33 @@ Return<Result> Sensors::activate(int32_t sensorHandle, bool enabled)
     if (!testHandle(sensorHandle))
         return Result::BAD_VALUE;
 
+    size_t sensorIndex = handleToIndex(sensorHandle);
+    if (sensorIndex < HW_SENSOR_COUNT) {
+        mDirectlyActive[sensorIndex] = enabled;
+        /* The idle trigger limit depends on directly activated sensors */
+        applyAdaptiveODR();
+    }
+
+    activateSensor(sensorHandle, enabled);
+
+    /* The fusion inputs may have gained or lost their listeners */
+    std::lock_guard<std::mutex> lock(mTriggerLock);
+    updateReorderWindowLocked();
+
+    return Result::OK;
+}
+
+/*
+ * Same as activate(), also used for the hardware sensors a virtual sensor
+ * depends on, which are not directly activated by the client.
+ */
+void Sensors::activateSensor(int32_t sensorHandle, bool enabled)
+{
     mSensors[handleToIndex(sensorHandle)]->activate(enabled);
 
     int groupIndex = getGroupIndexByHandle(sensorHandle);
     /* If any sensor in group is active, we can't disable whole group */
     activateGroup(isActiveGroup(groupIndex), groupIndex);
-
-    return Result::OK;
 }
 
 /*
@@ -346,6 +415,9 @@ Return<Result> Sensors::initialize(const ::android::hardware::MQDescriptorSync<E
         sensor->activate(true);
     }
 
+    mAdaptiveODR.reset();
+    applyAdaptiveODR();
+
     if (!mPollThreadsStarted.load()) {
         startPollThreads();
         mPollThreadsStarted = true;
@@ -367,19 +439,21 @@ Return<Result> Sensors::HWBatch(int32_t sensorHandle, int64_t samplingPeriodNs,
 {
     Return<Result> res(Result::OK);
 
-    uint16_t currMaxODR = getMaxODRFromGroup(getGroupIndexByHandle(sensorHandle));
+    std::lock_guard<std::mutex> lock(mTriggerLock);
+    uint16_t currMaxODR = getTriggerODRFromGroup(getGroupIndexByHandle(sensorHandle));
 
     res = mSensors[handleToIndex(sensorHandle)]->batch(samplingPeriodNs, argMaxReportLatencyNs);
     if (res != Result::OK)
         return res;
 
-    uint16_t newMaxODR = getMaxODRFromGroup(getGroupIndexByHandle(sensorHandle));
+    uint16_t newMaxODR = getTriggerODRFromGroup(getGroupIndexByHandle(sensorHandle));
 
     if (newMaxODR != currMaxODR) {
         ALOGD("Setting new trigger freq for %s = %u Hz",
             mSensorGroups[getGroupIndexByHandle(sensorHandle)].name.c_str(), newMaxODR);
         setTriggerFreq(newMaxODR, getGroupIndexByHandle(sensorHandle));
     }
+    updateReorderWindowLocked();
 
     return res;
 
@@ -416,10 +490,17 @@ Return<Result> Sensors::batch(int32_t sensorHandle, int64_t samplingPeriodNs, in
     int index = getGroupIndexByHandle(sensorHandle);
     if (mSensorGroups[index].isVirtual) {
         return virtualBatch(sensorHandle, samplingPeriodNs, argMaxReportLatencyNs);
-    } else {
-        return HWBatch(sensorHandle, samplingPeriodNs, argMaxReportLatencyNs);
     }
 
+    Return<Result> res = HWBatch(sensorHandle, samplingPeriodNs, argMaxReportLatencyNs);
+    if (res == Result::OK) {
+        /* Remembered apart, virtual sensors batch the same hardware sensor */
+        size_t sensorIndex = handleToIndex(sensorHandle);
+        mDirectODR[sensorIndex] = mSensors[sensorIndex]->getODR();
+        applyAdaptiveODR();
+    }
+    return res;
+
 }
 
 Return<Result> Sensors::flush(int32_t sensorHandle)
@@ -515,14 +596,17 @@ void Sensors::activateGroup(bool enable, uint32_t index)
     const int value = enable ? 1 : 0;
 
     if (mSensorGroups[index].isVirtual) {
-        /* Enable or disable hardware sensors */
-        activate(HandleIndex::ACC_HANDLE, enable);
-        if (mSensorGroups[index].mode != FUSION_NOMAG) {
-            activate(HandleIndex::MAGN_HANDLE, enable);
+        /* Enable or disable hardware sensors, directly activated ones stay on */
+        if (enable || !mDirectlyActive[SensorIndex::ACC].load())
+            activateSensor(HandleIndex::ACC_HANDLE, enable);
+        if (mSensorGroups[index].mode != FUSION_NOMAG &&
+            (enable || !mDirectlyActive[SensorIndex::MAG].load())) {
+            activateSensor(HandleIndex::MAGN_HANDLE, enable);
         }
 
-        if (mSensorGroups[index].mode != FUSION_NOGYRO) {
-            activate(HandleIndex::GYRO_HANDLE, enable);
+        if (mSensorGroups[index].mode != FUSION_NOGYRO &&
+            (enable || !mDirectlyActive[SensorIndex::GYR].load())) {
+            activateSensor(HandleIndex::GYRO_HANDLE, enable);
         }
     } else if (!fileWriteInt(mSensorGroups[index].bufferSwitchFileName, value)) {
         ALOGE("Failed to write to the %s", mSensorGroups[index].bufferSwitchFileName.c_str());
@@ -580,6 +664,104 @@ uint16_t Sensors::getMaxODRFromGroup(uint32_t index)
     return max_ODR;
 }
 
+/*
+ * The lowest ODR all sensors of the group support, used as the trigger
+ * frequency while the board is stationary.
+ */
+uint16_t Sensors::getIdleODRFromGroup(uint32_t index)
+{
+    uint16_t idle_ODR = 0;
+
+    for (size_t i = 0; i < mSensorGroups[index].sensorHandles.size(); i++) {
+        uint32_t sensor_handle = mSensorGroups[index].sensorHandles[i];
+        idle_ODR = std::max(idle_ODR, mSensorDescriptors[handleToIndex(sensor_handle)].minODR);
+    }
+
+    return idle_ODR;
+}
+
+/*
+ * Highest ODR a client requested through batch() for a hardware sensor of
+ * the group it has activated directly, 0 if there is none.
+ */
+uint16_t Sensors::getDirectODRFromGroup(uint32_t index)
+{
+    uint16_t direct_ODR = 0;
+
+    for (size_t i = 0; i < mSensorGroups[index].sensorHandles.size(); i++) {
+        size_t sensor_index = handleToIndex(mSensorGroups[index].sensorHandles[i]);
+        if (sensor_index < HW_SENSOR_COUNT && mDirectlyActive[sensor_index].load())
+            direct_ODR = std::max(direct_ODR, mDirectODR[sensor_index].load());
+    }
+
+    return direct_ODR;
+}
+
+/*
+ * Physical trigger frequency of the group, may be reduced by adaptive ODR.
+ * Never below the rate of a directly activated sensor, only the rate of the
+ * fusion inputs is reduced.
+ */
+uint16_t Sensors::getTriggerODRFromGroup(uint32_t index)
+{
+    uint16_t maxODR = getMaxODRFromGroup(index);
+    uint16_t triggerODR = mAdaptiveODR.limitODR(maxODR, getIdleODRFromGroup(index));
+
+    return std::max(triggerODR, std::min(getDirectODRFromGroup(index), maxODR));
+}
+
+/*
+ * Reprograms the hardware triggers after the stationary state or the direct
+ * requests have changed. Virtual sensors keep their contracted rate:
+ * FusionSensor reports the reduced rate and they interpolate up to the
+ * requested one.
+ */
+void Sensors::applyAdaptiveODR()
+{
+    std::lock_guard<std::mutex> lock(mTriggerLock);
+    uint16_t fusionLimit = std::numeric_limits<uint16_t>::max();
+
+    for (size_t i = 0; i < mSensorGroups.size(); i++) {
+        if (mSensorGroups[i].isVirtual)
+            continue;
+
+        uint16_t triggerODR = getTriggerODRFromGroup(i);
+        if (triggerODR != mSensorGroups[i].currODR) {
+            ALOGD("Setting adaptive trigger freq for %s = %u Hz",
+                mSensorGroups[i].name.c_str(), triggerODR);
+            setTriggerFreq(triggerODR, i);
+        }
+
+        if (mAdaptiveODR.isStationary())
+            fusionLimit = std::min(fusionLimit, triggerODR);
+    }
+
+    mFusionSensor.setODRLimit(fusionLimit);
+    updateReorderWindowLocked();
+}
+
+/*
+ * The merge stage in FusionSensor waits for the slowest fusion input, whose
+ * period grows when adaptive ODR drops the trigger of its group. A sensor
+ * is decimated to its own ODR below the trigger rate.
+ */
+void Sensors::updateReorderWindowLocked()
+{
+    uint16_t slowestODR = 0;
+
+    for (size_t i = 0; i < HW_SENSOR_COUNT; i++) {
+        if (!mSensors[i]->hasActiveListeners())
+            continue;
+
+        uint32_t groupIndex = getGroupIndexByHandle(mSensors[i]->getSensorInfo().sensorHandle);
+        uint16_t outputODR = std::min(mSensors[i]->getODR(), getTriggerODRFromGroup(groupIndex));
+        if (outputODR && (!slowestODR || outputODR < slowestODR))
+            slowestODR = outputODR;
+    }
+
+    mFusionSensor.setSlowestODR(slowestODR);
+}
+
 void Sensors::openFileDescriptors()
 {
     for (size_t i = 0; i < mSensorGroups.size(); i++) {
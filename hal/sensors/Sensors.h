@@ -14,6 +14,7 @@
 #include "SensorDescriptors.h"
 #include "common.h"
 #include "FusionSensor.h"
+#include "AdaptiveODRController.h"
 
 namespace android {
 namespace hardware {
@@ -60,8 +61,18 @@ class Sensors : public ISensors
         Return<Result> HWBatch(int32_t, int64_t, int64_t);
         Return<Result> virtualBatch(int32_t, int64_t, int64_t);
         void pollIIODeviceGroupBuffer(uint32_t groupIndex);
+        template <uint32_t... Handles>
+        void pollIIOGroup(uint32_t groupIndex, IIOGroupLayout<Handles...>);
+        void pollIIOGroupGeneric(uint32_t groupIndex);
+        bool readIIOGroupBuffer(uint32_t groupIndex, IIOCombinedBuffer&, int& retryCount);
+        template <uint32_t Handle>
+        void processIIOSample(const IIOCombinedBuffer&, uint16_t triggerODR, std::vector<Event>&);
+        template <typename SensorT, typename ParserT>
+        void processSample(SensorT&, uint16_t triggerODR, const ParserT&, std::vector<Event>&);
         void pollVirtualDeviceGroupBuffer(uint32_t groupIndex);
 
+        void activateSensor(int32_t, bool);
+
         void startPollThreads();
         void stopPollThreads();
 
@@ -75,6 +86,11 @@ class Sensors : public ISensors
         bool setTriggerFreq(uint16_t, uint32_t);
         void activateAllGroups();
         uint16_t getMaxODRFromGroup(uint32_t);
+        uint16_t getIdleODRFromGroup(uint32_t);
+        uint16_t getDirectODRFromGroup(uint32_t);
+        uint16_t getTriggerODRFromGroup(uint32_t);
+        void applyAdaptiveODR();
+        void updateReorderWindowLocked();
         void openFileDescriptors();
         void closeFileDescriptors();
         void parseBuffer(const IIOCombinedBuffer& from, IIOBuffer& to, uint32_t sensorHandle);
@@ -93,7 +109,14 @@ class Sensors : public ISensors
         };
 
         std::vector<std::shared_ptr<BaseSensor>> mSensors;
+        /* Same hardware sensors as in mSensors, by their concrete type */
+        std::shared_ptr<IIOSensor> mIIOSensors[HW_SENSOR_COUNT];
         FusionSensor mFusionSensor;
+        AdaptiveODRController mAdaptiveODR;
+        std::mutex mTriggerLock;
+        /* Hardware sensors activated and batched by the client itself */
+        std::atomic<bool> mDirectlyActive[HW_SENSOR_COUNT] = {};
+        std::atomic<uint16_t> mDirectODR[HW_SENSOR_COUNT] = {};
 
         OperationMode mMode;
 
@@ -115,12 +138,7 @@ class Sensors : public ISensors
 
         std::atomic<bool> mPollThreadsStarted;
 
-        std::atomic<bool> mAccelEventReady = false;
-        std::atomic<bool> mGyroEventReady = false;
-        std::atomic<bool> mMagnEventReady = false;
-        void setReadyFlag(SensorType);
-        void resetReadyFlag(FUSION_MODE);
-        void notifyListeners();
+        void notifyListeners(FUSION_MODE);
 };
 
 }  // namespace kingfisher
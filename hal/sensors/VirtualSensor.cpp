@@ -7,6 +7,7 @@
 #include "SensorDescriptors.h"
 #include "common.h"
 #include "VirtualSensor.h"
+#include "FusionKernels.h"
 
 namespace android {
 namespace hardware {
@@ -111,13 +112,15 @@ int VirtualSensor::getReadyEvents(std::vector<Event> &events, OperationMode mode
 
             std::lock_guard<std::mutex> bufferLock(mBufferLock);
             minRealODR = mFusionSensor.getMinODR(mFusionMode);
-            std::vector<FusionData> fusionData = mFusionSensor.getFusionEvents(mFusionMode);
+            mFusionSensor.getFusionEvents(mFusionMode, mFusionData);
+            const FusionData* fusionData = &mFusionData;
             if (mCurrODR > minRealODR) {
             // +1 Here to ensure that float value will be rounded upwards when casted to int
-                fusionData = LERP(fusionData, (mCurrODR/minRealODR) + 1);
+                LERP(mFusionData, (mCurrODR/minRealODR) + 1, mLerpData);
+                fusionData = &mLerpData;
             }
 
-            eventCount = process(fusionData, events);
+            eventCount = process(*fusionData, events);
 
 #ifdef POLL_DEBUG
             for (size_t i = 0; i < events.size(); ++i) {
@@ -163,7 +166,7 @@ void VirtualSensor::injectEvent(const Event& event)
     mInjectEventBuffer.eventBuffer.push(event);
 }
 
-std::vector<FusionData> VirtualSensor::LERP(std::vector<FusionData>& events, int multiplier)
+void VirtualSensor::LERP(const FusionData& in, int multiplier, FusionData& out)
 {
     // Increment multiplier to prevent last interpolated event being the same as
     // next HW event and distribute events more evenly
@@ -175,39 +178,76 @@ std::vector<FusionData> VirtualSensor::LERP(std::vector<FusionData>& events, int
     //			 └ Timeline
     // instead of |-------x-----x|
     multiplier++;
-    std::vector<FusionData> newEvents;
-    if (events.size() == 0) {
-        return newEvents;
+    if (in.size() == 0) {
+        out.resize(0);
+        return;
     }
-    for (unsigned long i = 0; i < events.size() - 1; i++) {
-        newEvents.push_back(events[i]);
-        for(int j = 1; j < multiplier; j++) {
-            FusionData temp;
-            temp.accelEvent = lerpEvent(events[i].accelEvent,
-                    events[i+1].accelEvent, (float) j / multiplier);
-
-            if (mFusionMode != FUSION_NOMAG) {
-                temp.magEvent = lerpEvent(events[i].magEvent,
-                        events[i+1].magEvent, (float) j / multiplier);
-            }
 
-            if (mFusionMode != FUSION_NOGYRO) {
-                temp.gyroEvent = lerpEvent(events[i].gyroEvent,
-                        events[i+1].gyroEvent, (float) j / multiplier);
-            }
-            newEvents.push_back(temp);
+    const size_t count = in.size();
+    out.resize((count - 1) * multiplier);
+
+    for (size_t i = 0; i + 1 < count; i++) {
+        for (int j = 0; j < multiplier; j++) {
+            out.timestamp[i * multiplier + j] = in.timestamp[i] +
+                ((in.timestamp[i + 1] - in.timestamp[i]) * ((float) j / multiplier));
+        }
+    }
+
+    lerpKernel(in.accel.x, count, multiplier, out.accel.x);
+    lerpKernel(in.accel.y, count, multiplier, out.accel.y);
+    lerpKernel(in.accel.z, count, multiplier, out.accel.z);
+
+    if (mFusionMode != FUSION_NOMAG) {
+        lerpKernel(in.magn.x, count, multiplier, out.magn.x);
+        lerpKernel(in.magn.y, count, multiplier, out.magn.y);
+        lerpKernel(in.magn.z, count, multiplier, out.magn.z);
+    }
+
+    if (mFusionMode != FUSION_NOGYRO) {
+        lerpKernel(in.gyro.x, count, multiplier, out.gyro.x);
+        lerpKernel(in.gyro.y, count, multiplier, out.gyro.y);
+        lerpKernel(in.gyro.z, count, multiplier, out.gyro.z);
+    }
+}
+
+/*
+ * Skips samples already reported and restarts after gaps longer than a
+ * second. Returns the number of samples to be processed.
+ */
+size_t VirtualSensor::selectNewSamples(const FusionData& fusionData)
+{
+    mSampleIndexes.clear();
+    mSampleDt.clear();
+
+    for (size_t i = 0; i < fusionData.size(); i++) {
+        float dt = fusionData.timestamp[i] - mTimestamp;
+
+        if (mTimestamp >= fusionData.timestamp[i]) {
+            continue;
+        }
+
+        mTimestamp = fusionData.timestamp[i];
+        if (dt > NSEC) {
+            continue;
         }
+
+        mSampleIndexes.push_back(i);
+        mSampleDt.push_back(dt / NSEC);
     }
-    return newEvents;
+
+    return mSampleIndexes.size();
 }
 
-Event VirtualSensor::lerpEvent(Event& e1, Event& e2, float factor){
-    Event newEvent;
-    newEvent.timestamp = e1.timestamp + ((e2.timestamp - e1.timestamp) * factor);
-    newEvent.u.vec3.x = e1.u.vec3.x + (e2.u.vec3.x - e1.u.vec3.x) * factor;
-    newEvent.u.vec3.y = e1.u.vec3.y + (e2.u.vec3.y - e1.u.vec3.y) * factor;
-    newEvent.u.vec3.z = e1.u.vec3.z + (e2.u.vec3.z - e1.u.vec3.z) * factor;
-    return newEvent;
+Event VirtualSensor::createEvent(int64_t timestamp) const
+{
+    Event event = {};
+
+    event.timestamp = timestamp;
+    event.sensorType = mSensorDescriptor.sensorInfo.type;
+    event.sensorHandle = mSensorDescriptor.sensorInfo.sensorHandle;
+    event.u.vec3.status = SensorStatus::ACCURACY_HIGH;
+
+    return event;
 }
 
 }  // namespace kingfisher
@@ -41,15 +41,23 @@ class VirtualSensor : public BaseSensor
         bool hasActiveListeners() const override { return false; };
 
     protected:
-        virtual int process(const std::vector<FusionData>&, std::vector<Event>&) = 0;
+        virtual int process(const FusionData&, std::vector<Event>&) = 0;
         virtual void preActivateActions() = 0;
-        std::vector<FusionData> LERP(std::vector<FusionData>&, int mul);
-        Event lerpEvent(Event& e1, Event& e2, float factor);
+        void LERP(const FusionData&, int mul, FusionData&);
+        size_t selectNewSamples(const FusionData&);
+        Event createEvent(int64_t timestamp) const;
 
         FusionSensor &mFusionSensor;
         FUSION_MODE mFusionMode;
         std::mutex mBufferLock;
         std::atomic<bool> mNeedFlush = false;
+
+        /* Batches reused between calls to avoid reallocation */
+        FusionData mFusionData;
+        FusionData mLerpData;
+        /* Filled by selectNewSamples(): indexes of new samples and their dt in seconds */
+        std::vector<uint32_t> mSampleIndexes;
+        std::vector<float> mSampleDt;
 #ifdef POLL_DEBUG
         uint32_t mCounter;
 #endif
@@ -0,0 +1,186 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <vector>
+
+#include "../FastMath.h"
+
+using namespace android::hardware::sensors::V2_0::kingfisher;
+
+/* Same amount of samples the fusion kernels handle in one batch */
+constexpr size_t count = 256;
+
+static std::vector<float> makeInput(float from, float to)
+{
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = from + (to - from) * i / (count - 1);
+    }
+    return values;
+}
+
+static void BM_LibmAtan2(benchmark::State& state)
+{
+    std::vector<float> y = makeInput(-10.0f, 10.0f), x = makeInput(10.0f, -5.0f), out(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = std::atan2(y[i], x[i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LibmAtan2);
+
+static void BM_FastAtan2(benchmark::State& state)
+{
+    std::vector<float> y = makeInput(-10.0f, 10.0f), x = makeInput(10.0f, -5.0f), out(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = fastAtan2(y[i], x[i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastAtan2);
+
+static void BM_FastAtan2Batch(benchmark::State& state)
+{
+    std::vector<float> y = makeInput(-10.0f, 10.0f), x = makeInput(10.0f, -5.0f), out(count);
+    for (auto _ : state) {
+        fastAtan2Batch(y.data(), x.data(), out.data(), count);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastAtan2Batch);
+
+static void BM_LibmAsin(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(-1.0f, 1.0f), out(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = std::asin(in[i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LibmAsin);
+
+static void BM_FastAsin(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(-1.0f, 1.0f), out(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = fastAsin(in[i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastAsin);
+
+static void BM_FastAsinBatch(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(-1.0f, 1.0f), out(count);
+    for (auto _ : state) {
+        fastAsinBatch(in.data(), out.data(), count);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastAsinBatch);
+
+static void BM_LibmSinCos(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(-10.0f, 10.0f), s(count), c(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            s[i] = std::sin(in[i]);
+            c[i] = std::cos(in[i]);
+        }
+        benchmark::DoNotOptimize(s.data());
+        benchmark::DoNotOptimize(c.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LibmSinCos);
+
+static void BM_FastSinCos(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(-10.0f, 10.0f), s(count), c(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            fastSinCos(in[i], s[i], c[i]);
+        }
+        benchmark::DoNotOptimize(s.data());
+        benchmark::DoNotOptimize(c.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastSinCos);
+
+static void BM_FastSinCosBatch(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(-10.0f, 10.0f), s(count), c(count);
+    for (auto _ : state) {
+        fastSinCosBatch(in.data(), s.data(), c.data(), count);
+        benchmark::DoNotOptimize(s.data());
+        benchmark::DoNotOptimize(c.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastSinCosBatch);
+
+static void BM_LibmRsqrt(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(1.0e-3f, 1.0e3f), out(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = 1.0f / std::sqrt(in[i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_LibmRsqrt);
+
+static void BM_FastRsqrt(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(1.0e-3f, 1.0e3f), out(count);
+    for (auto _ : state) {
+        for (size_t i = 0; i < count; i++) {
+            out[i] = fastRsqrt(in[i]);
+        }
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastRsqrt);
+
+static void BM_FastRsqrtBatch(benchmark::State& state)
+{
+    std::vector<float> in = makeInput(1.0e-3f, 1.0e3f), out(count);
+    for (auto _ : state) {
+        fastRsqrtBatch(in.data(), out.data(), count);
+        benchmark::DoNotOptimize(out.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_FastRsqrtBatch);
+
+BENCHMARK_MAIN();
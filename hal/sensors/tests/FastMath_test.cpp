@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "../FastMath.h"
+
+using namespace android::hardware::sensors::V2_0::kingfisher;
+
+/* Error bounds documented in FastMath.h */
+constexpr double ATAN2_MAX_ERROR = 2.0e-6;
+constexpr double ASIN_MAX_ERROR = 2.0e-6;
+constexpr double SINCOS_MAX_ERROR = 4.0e-7;
+constexpr double SINCOS_MAX_ARG = 1000.0;
+constexpr double RSQRT_MAX_REL_ERROR = 5.0e-6;
+
+constexpr size_t samples = 100000;
+
+/* Evenly spaced floats in [from, to], both ends included */
+static std::vector<float> linspace(double from, double to, size_t count)
+{
+    std::vector<float> values(count);
+    for (size_t i = 0; i < count; i++) {
+        values[i] = static_cast<float>(from + (to - from) * i / (count - 1));
+    }
+    return values;
+}
+
+TEST(FastMathTest, Atan2)
+{
+    double maxError = 0.0;
+    std::vector<float> angles = linspace(-M_PI, M_PI, samples);
+
+    for (float radius : {1.0e-30f, 1.0e-3f, 1.0f, 9.80665f, 1.0e3f, 1.0e30f}) {
+        for (float angle : angles) {
+            float y = radius * std::sin(angle);
+            float x = radius * std::cos(angle);
+            maxError = std::max(maxError, std::fabs(fastAtan2(y, x) - std::atan2(double(y), double(x))));
+        }
+    }
+    EXPECT_LE(maxError, ATAN2_MAX_ERROR);
+
+    EXPECT_EQ(fastAtan2(0.0f, 0.0f), 0.0f);
+    EXPECT_NEAR(fastAtan2(1.0f, 0.0f), M_PI_2, ATAN2_MAX_ERROR);
+    EXPECT_NEAR(fastAtan2(-1.0f, 0.0f), -M_PI_2, ATAN2_MAX_ERROR);
+    EXPECT_NEAR(fastAtan2(0.0f, -1.0f), M_PI, ATAN2_MAX_ERROR);
+}
+
+TEST(FastMathTest, Asin)
+{
+    double maxError = 0.0;
+    for (float x : linspace(-1.0, 1.0, samples)) {
+        maxError = std::max(maxError, std::fabs(fastAsin(x) - std::asin(double(x))));
+    }
+    EXPECT_LE(maxError, ASIN_MAX_ERROR);
+
+    EXPECT_NEAR(fastAsin(1.0f), M_PI_2, ASIN_MAX_ERROR);
+    EXPECT_NEAR(fastAsin(-1.0f), -M_PI_2, ASIN_MAX_ERROR);
+}
+
+TEST(FastMathTest, SinCos)
+{
+    double maxError = 0.0;
+    for (float x : linspace(-SINCOS_MAX_ARG, SINCOS_MAX_ARG, samples * 10)) {
+        float s, c;
+        fastSinCos(x, s, c);
+        maxError = std::max(maxError, std::fabs(s - std::sin(double(x))));
+        maxError = std::max(maxError, std::fabs(c - std::cos(double(x))));
+    }
+    EXPECT_LE(maxError, SINCOS_MAX_ERROR);
+}
+
+TEST(FastMathTest, Rsqrt)
+{
+    double maxError = 0.0;
+    std::vector<float> exponents = linspace(std::log2(FLT_MIN), std::log2(FLT_MAX), samples);
+
+    for (float e : exponents) {
+        float x = std::exp2(e);
+        if (!std::isnormal(x)) {
+            continue;
+        }
+        double expected = 1.0 / std::sqrt(double(x));
+        maxError = std::max(maxError, std::fabs(fastRsqrt(x) - expected) / expected);
+    }
+    EXPECT_LE(maxError, RSQRT_MAX_REL_ERROR);
+}
+
+/* Sizes cover an empty call, a partial vector and the chunked path with a tail */
+static const size_t batchSizes[] = { 0, 3, 4, 33, 1001 };
+
+TEST(FastMathTest, Atan2Batch)
+{
+    for (size_t count : batchSizes) {
+        std::vector<float> angles = linspace(-M_PI, M_PI, count + 2);
+        std::vector<float> y(count), x(count), out(count);
+        for (size_t i = 0; i < count; i++) {
+            y[i] = 3.0f * std::sin(angles[i + 1]);
+            x[i] = 3.0f * std::cos(angles[i + 1]);
+        }
+        fastAtan2Batch(y.data(), x.data(), out.data(), count);
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_NEAR(out[i], std::atan2(double(y[i]), double(x[i])), ATAN2_MAX_ERROR) << "i=" << i;
+        }
+    }
+}
+
+TEST(FastMathTest, AsinBatch)
+{
+    for (size_t count : batchSizes) {
+        std::vector<float> in = linspace(-1.0, 1.0, count + 2);
+        std::vector<float> out(count + 2);
+        fastAsinBatch(in.data(), out.data(), in.size());
+        for (size_t i = 0; i < in.size(); i++) {
+            EXPECT_NEAR(out[i], std::asin(double(in[i])), ASIN_MAX_ERROR) << "i=" << i;
+        }
+    }
+}
+
+TEST(FastMathTest, SinCosBatch)
+{
+    for (size_t count : batchSizes) {
+        std::vector<float> in = linspace(-SINCOS_MAX_ARG, SINCOS_MAX_ARG, count + 2);
+        std::vector<float> s(in.size()), c(in.size());
+        fastSinCosBatch(in.data(), s.data(), c.data(), in.size());
+        for (size_t i = 0; i < in.size(); i++) {
+            EXPECT_NEAR(s[i], std::sin(double(in[i])), SINCOS_MAX_ERROR) << "i=" << i;
+            EXPECT_NEAR(c[i], std::cos(double(in[i])), SINCOS_MAX_ERROR) << "i=" << i;
+        }
+    }
+}
+
+TEST(FastMathTest, RsqrtBatch)
+{
+    for (size_t count : batchSizes) {
+        std::vector<float> in = linspace(1.0e-3, 1.0e3, count + 2);
+        std::vector<float> out(in.size());
+        fastRsqrtBatch(in.data(), out.data(), in.size());
+        for (size_t i = 0; i < in.size(); i++) {
+            double expected = 1.0 / std::sqrt(double(in[i]));
+            EXPECT_NEAR(out[i], expected, expected * RSQRT_MAX_REL_ERROR) << "i=" << i;
+        }
+    }
+}